@@ -0,0 +1,133 @@
+#include <ctime>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <utility>
+
+#include "bench/benchmark.hpp"
+
+namespace {
+
+int const NAME_WIDTH = 48;
+
+std::string jsonString(std::string const & s)
+{
+    std::ostringstream out;
+    out << '"';
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+        else
+            out << c;
+    }
+    out << '"';
+    return out.str();
+}
+
+} // namespace
+
+void BenchmarkSuite::add(std::string name, std::function<void()> body, double items,
+                         std::function<BenchmarkCounters()> counters)
+{
+    benchmarks.push_back(Benchmark{std::move(name), std::move(body), items, std::move(counters)});
+}
+
+std::vector<BenchmarkResult> BenchmarkSuite::run(std::string const & filter, std::chrono::duration<double> minTime,
+                                                 std::function<void(BenchmarkResult const &)> const & onResult) const
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<BenchmarkResult> results;
+    for (Benchmark const & benchmark : benchmarks)
+    {
+        if (benchmark.name.find(filter) == std::string::npos)
+            continue;
+
+        benchmark.body();  // warm up
+
+        long calls = 0;
+        std::clock_t start_clock = std::clock();
+        auto start_time = Clock::now();
+        std::chrono::duration<double> elapsed(0);
+        do
+        {
+            benchmark.body();
+            ++calls;
+            elapsed = Clock::now() - start_time;
+        }
+        while (elapsed < minTime);
+        double cpuSeconds = double(std::clock() - start_clock)/CLOCKS_PER_SEC;
+
+        BenchmarkResult result;
+        result.name = benchmark.name;
+        result.iterations = calls;
+        result.realTime = elapsed.count()*1e9/calls;
+        result.cpuTime = cpuSeconds*1e9/calls;
+        result.itemsPerSecond = benchmark.items*calls/elapsed.count();
+        if (benchmark.counters)
+            result.counters = benchmark.counters();
+
+        onResult(result);
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+void printResultHeader(std::ostream & out)
+{
+    out << std::left << std::setw(NAME_WIDTH) << "Benchmark" << std::right
+        << std::setw(14) << "Time [ns]" << std::setw(14) << "CPU [ns]"
+        << std::setw(12) << "Iterations" << std::setw(16) << "Items/s" << '\n'
+        << std::string(NAME_WIDTH + 56, '-') << std::endl;
+}
+
+void printResult(std::ostream & out, BenchmarkResult const & result)
+{
+    out << std::left << std::setw(NAME_WIDTH) << result.name << std::right << std::fixed << std::setprecision(1)
+        << std::setw(14) << result.realTime << std::setw(14) << result.cpuTime
+        << std::setw(12) << result.iterations;
+    if (result.itemsPerSecond > 0.0)
+        out << std::setw(16) << std::scientific << std::setprecision(3) << result.itemsPerSecond;
+    out << std::defaultfloat << std::setprecision(4);
+    for (auto const & counter : result.counters)
+        out << "  " << counter.first << "=" << counter.second;
+    out << std::endl;
+}
+
+void writeJson(std::ostream & out, BenchmarkContext const & context, std::vector<BenchmarkResult> const & results)
+{
+    out << std::setprecision(17)
+        << "{\n"
+        << "  \"context\": {\n"
+        << "    \"date\": " << jsonString(context.date) << ",\n"
+        << "    \"num_cpus\": " << context.cpuCount << ",\n"
+        << "    \"batch_kernels\": " << jsonString(context.kernels) << ",\n"
+        << "    \"jit\": " << (context.jit ? "true" : "false") << ",\n"
+        << "    \"min_time\": " << context.minTime << "\n"
+        << "  },\n"
+        << "  \"benchmarks\": [";
+
+    for (std::size_t k = 0; k < results.size(); ++k)
+    {
+        BenchmarkResult const & result = results[k];
+        out << ((k == 0) ? "\n" : ",\n")
+            << "    {\n"
+            << "      \"name\": " << jsonString(result.name) << ",\n"
+            << "      \"run_type\": \"iteration\",\n"
+            << "      \"iterations\": " << result.iterations << ",\n"
+            << "      \"real_time\": " << result.realTime << ",\n"
+            << "      \"cpu_time\": " << result.cpuTime << ",\n"
+            << "      \"time_unit\": \"ns\"";
+        if (result.itemsPerSecond > 0.0)
+            out << ",\n      \"items_per_second\": " << result.itemsPerSecond;
+        for (auto const & counter : result.counters)
+            out << ",\n      " << jsonString(counter.first) << ": " << counter.second;
+        out << "\n    }";
+    }
+
+    out << "\n  ]\n}\n";
+}
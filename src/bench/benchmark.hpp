@@ -0,0 +1,72 @@
+#ifndef COMPLEXPLOT_BENCHMARK_HPP
+#define COMPLEXPLOT_BENCHMARK_HPP
+
+#include <chrono>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+// named values reported along with the timings, e.g. errors against a reference
+using BenchmarkCounters = std::vector<std::pair<std::string, double>>;
+
+// measured cost of one benchmark, per call of its body
+struct BenchmarkResult
+{
+    std::string name;
+    long iterations;
+    double realTime;        // wall clock nanoseconds
+    double cpuTime;         // process CPU nanoseconds, summed over all threads
+    double itemsPerSecond;  // 0 if the benchmark counts no items
+    BenchmarkCounters counters;
+};
+
+// describes the machine and build the results were taken on
+struct BenchmarkContext
+{
+    std::string date;  // ISO 8601, local time
+    unsigned cpuCount;
+    std::string kernels;  // instruction set of the batch kernels
+    bool jit;
+    double minTime;  // seconds
+};
+
+/*
+ *  Minimal runner in the spirit of Google Benchmark: each registered body is
+ *  called once to warm up and then repeatedly until minTime has passed.
+ *  Results can be printed as a table or written as JSON in the layout of
+ *  Google Benchmark ({"context": ..., "benchmarks": [...]}, counters as
+ *  extra fields like its user counters), so runs of different releases can
+ *  be compared with its tools.
+ */
+class BenchmarkSuite
+{
+public:
+    // items: units of work (points, pixels, characters) done by one call of body;
+    // counters, if given, is called once after the timing
+    void add(std::string name, std::function<void()> body, double items = 0.0,
+             std::function<BenchmarkCounters()> counters = nullptr);
+
+    // runs the benchmarks whose name contains filter; onResult is called after each
+    std::vector<BenchmarkResult> run(std::string const & filter, std::chrono::duration<double> minTime,
+                                     std::function<void(BenchmarkResult const &)> const & onResult) const;
+
+private:
+    struct Benchmark
+    {
+        std::string name;
+        std::function<void()> body;
+        double items;
+        std::function<BenchmarkCounters()> counters;
+    };
+
+    std::vector<Benchmark> benchmarks;
+};
+
+void printResultHeader(std::ostream & out);
+void printResult(std::ostream & out, BenchmarkResult const & result);
+
+void writeJson(std::ostream & out, BenchmarkContext const & context, std::vector<BenchmarkResult> const & results);
+
+#endif // COMPLEXPLOT_BENCHMARK_HPP
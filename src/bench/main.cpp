@@ -0,0 +1,564 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bench/benchmark.hpp"
+#include "engine/batch.hpp"
+#include "engine/coloring.hpp"
+#include "engine/engine.hpp"
+#include "engine/jit.hpp"
+
+namespace {
+
+int const GRID_SIZE = 256;
+
+// fixed corpus of the front end and end-to-end benchmarks; keep names stable across releases
+struct Formula
+{
+    char const * name;
+    char const * formula;
+};
+
+Formula const CORPUS[] = {
+    {"polynomial", "z^2 + 1"},
+    {"essential", "exp(1/z)"},
+    {"rational", "-z*(z - 1)/(z + i)^3"},
+    {"powers", "z^13 - z^7 + 1/z^5"},
+    {"complex_power", "(z^2 + 1)^(z - i)"},
+    {"taylor", "1 + z + z^2/2 + z^3/6 + z^4/24 + z^5/120 + z^6/720 + z^7/5040 + z^8/40320"},
+};
+
+// one formula per operator (with the z and constant loads around it)
+Formula const OPERATORS[] = {
+    {"neg", "-z"},
+    {"add", "z + i"},
+    {"sub", "z - i"},
+    {"mul", "z*z"},
+    {"div", "1/z"},
+    {"pow", "z^z"},
+    {"powi", "z^3"},
+    {"powr", "z^1.5"},
+    {"exp", "exp(z)"},
+};
+
+// constant exponents: generic std::pow against the integer and real exponent paths
+char const * const POWERS[] = {
+    "z^2 + 1",
+    "z^3 - 1",
+    "z^5 - 3*z^2 + z",
+    "(z^2 + 1)^7",
+    "z^(-2)",
+    "z^1.5",
+};
+
+int const REDRAW_SIZES[] = {256, 1024};
+
+// results are accumulated here so the measured work is not optimized away
+volatile double sink;
+
+// sample points of [-2, 2] x [-2, 2], one grid row after another, also in single precision
+struct Grid
+{
+    std::vector<double> re, im;
+    std::vector<double> outRe, outIm;
+
+    std::vector<float> re32, im32;
+    std::vector<float> outRe32, outIm32;
+
+    Grid() :
+        re(GRID_SIZE*GRID_SIZE), im(GRID_SIZE*GRID_SIZE),
+        outRe(GRID_SIZE*GRID_SIZE), outIm(GRID_SIZE*GRID_SIZE),
+        re32(GRID_SIZE*GRID_SIZE), im32(GRID_SIZE*GRID_SIZE),
+        outRe32(GRID_SIZE*GRID_SIZE), outIm32(GRID_SIZE*GRID_SIZE)
+    {
+        for (int j = 0; j < GRID_SIZE; ++j)
+        for (int i = 0; i < GRID_SIZE; ++i)
+        {
+            re[j*GRID_SIZE + i] = -2.0 + 4.0*(i + 0.5)/GRID_SIZE;
+            im[j*GRID_SIZE + i] = 2.0 - 4.0*(j + 0.5)/GRID_SIZE;
+        }
+        std::copy(re.begin(), re.end(), re32.begin());
+        std::copy(im.begin(), im.end(), im32.begin());
+    }
+
+    std::size_t size() const { return re.size(); }
+};
+
+std::shared_ptr<Function> makeFunction(char const * formula, bool optimize = true, Backend backend = Backend::INTERPRETER)
+{
+    auto f = std::make_shared<Function>();
+    f->fromFormula(formula, optimize);
+    f->setBackend(backend);
+    return f;
+}
+
+void addScalar(BenchmarkSuite & suite, std::string const & name, std::shared_ptr<Function> f, Grid & grid)
+{
+    suite.add(name, [f, &grid]()
+    {
+        for (std::size_t k = 0; k < grid.size(); ++k)
+        {
+            complex w = (*f)(complex(grid.re[k], grid.im[k]));
+            grid.outRe[k] = w.real();
+            grid.outIm[k] = w.imag();
+        }
+    }, grid.size());
+}
+
+void addBatch(BenchmarkSuite & suite, std::string const & name, std::shared_ptr<Function> f, Grid & grid)
+{
+    suite.add(name, [f, &grid]()
+    {
+        for (std::size_t k = 0; k < grid.size(); k += GRID_SIZE)
+            f->evalBatch(&grid.re[k], &grid.im[k], &grid.outRe[k], &grid.outIm[k], GRID_SIZE);
+    }, grid.size());
+}
+
+// single precision batch evaluation; counts the largest relative error against
+// double precision over the points where both are finite
+void addBatchFloat(BenchmarkSuite & suite, std::string const & name, std::shared_ptr<Function> f, Grid & grid)
+{
+    auto counters = [f, &grid]()
+    {
+        f->evalBatch(grid.re.data(), grid.im.data(), grid.outRe.data(), grid.outIm.data(), grid.size());
+        f->evalBatch(grid.re32.data(), grid.im32.data(), grid.outRe32.data(), grid.outIm32.data(), grid.size());
+
+        double maxError = 0.0;
+        std::size_t nonFinite = 0;
+        for (std::size_t k = 0; k < grid.size(); ++k)
+        {
+            complex w(grid.outRe[k], grid.outIm[k]);
+            complex w32(grid.outRe32[k], grid.outIm32[k]);
+            if (!std::isfinite(std::abs(w)) || !std::isfinite(std::abs(w32)) || w == 0.0)
+            {
+                ++nonFinite;
+                continue;
+            }
+            maxError = std::max(maxError, std::abs(w32 - w)/std::abs(w));
+        }
+        return BenchmarkCounters{{"max_rel_error", maxError}, {"non_finite", double(nonFinite)}};
+    };
+
+    suite.add(name, [f, &grid]()
+    {
+        for (std::size_t k = 0; k < grid.size(); k += GRID_SIZE)
+            f->evalBatch(&grid.re32[k], &grid.im32[k], &grid.outRe32[k], &grid.outIm32[k], GRID_SIZE);
+    }, grid.size(), counters);
+}
+
+void addFrontEnd(BenchmarkSuite & suite)
+{
+    for (Formula const & formula : CORPUS)
+    {
+        std::string text = formula.formula;
+        double characters = text.size();
+
+        suite.add(std::string("lexer/tokenize/") + formula.name, [text]()
+        {
+            sink = tokenizeFormula(text);
+        }, characters);
+
+        suite.add(std::string("parser/parse/") + formula.name, [text]()
+        {
+            Expression expression;
+            parseFormula(text, expression);
+        }, characters);
+
+        suite.add(std::string("function/from_formula/") + formula.name, [text]()
+        {
+            Function f;
+            f.fromFormula(text);
+        }, characters);
+    }
+}
+
+void addOperators(BenchmarkSuite & suite, Grid & grid)
+{
+    bool jit = NativeCode::available();
+
+    for (Formula const & op : OPERATORS)
+    {
+        std::string suffix = std::string("/") + op.name;
+        auto f = makeFunction(op.formula);
+
+        suite.add("eval/reference" + suffix, [f, &grid]()
+        {
+            for (std::size_t k = 0; k < grid.size(); ++k)
+            {
+                complex w = f->evalReference(complex(grid.re[k], grid.im[k]));
+                grid.outRe[k] = w.real();
+                grid.outIm[k] = w.imag();
+            }
+        }, grid.size());
+        addScalar(suite, "eval/compiled" + suffix, f, grid);
+        addBatch(suite, "eval/batch" + suffix, f, grid);
+        addBatchFloat(suite, "eval/batch_float" + suffix, f, grid);
+        if (jit)
+            addBatch(suite, "eval/jit" + suffix, makeFunction(op.formula, true, Backend::JIT), grid);
+    }
+}
+
+void addPowers(BenchmarkSuite & suite, Grid & grid)
+{
+    for (char const * formula : POWERS)
+    {
+        auto generic = makeFunction(formula, false);
+        auto special = makeFunction(formula);
+
+        addScalar(suite, std::string("pow/generic/scalar/") + formula, generic, grid);
+        addScalar(suite, std::string("pow/special/scalar/") + formula, special, grid);
+        addBatch(suite, std::string("pow/generic/batch/") + formula, generic, grid);
+        addBatch(suite, std::string("pow/special/batch/") + formula, special, grid);
+    }
+}
+
+void addColoring(BenchmarkSuite & suite, Grid & grid)
+{
+    auto rgb = std::make_shared<std::vector<unsigned char>>(3*grid.size());
+
+    suite.add("coloring/complex2rgb_HL", [&grid]()
+    {
+        double sum = 0.0;
+        for (std::size_t k = 0; k < grid.size(); ++k)
+        {
+            double r, g, b;
+            complex2rgb_HL(complex(grid.re[k], grid.im[k]), 1.0, r, g, b);
+            sum += r + g + b;
+        }
+        sink = sum;
+    }, grid.size());
+
+    suite.add("coloring/complex2rgb8_HL", [&grid, rgb]()
+    {
+        complex2rgb8_HL(grid.re.data(), grid.im.data(), grid.size(), 1.0, rgb->data());
+    }, grid.size());
+}
+
+void addCoordinates(BenchmarkSuite & suite)
+{
+    PlotData plotData;
+    plotData.reMin = -2.5;
+    plotData.reMax = 1.5;
+    plotData.imMin = -2.0;
+    plotData.imMax = 2.0;
+    plotData.imageWidth = 1000;
+    plotData.imageHeight = 1000;
+
+    suite.add("plotdata/image2complex", [plotData]()
+    {
+        double sum = 0.0;
+        for (int y = 0; y < plotData.imageHeight; ++y)
+        for (int x = 0; x < plotData.imageWidth; ++x)
+        {
+            double re, im;
+            plotData.image2complex(x, y, re, im);
+            sum += re + im;
+        }
+        sink = sum;
+    }, double(plotData.imageWidth)*plotData.imageHeight);
+}
+
+PlotData redrawPlotData(Formula const & formula, int size, Backend backend, int antialiasing,
+                        Precision precision = Precision::DOUBLE)
+{
+    PlotData plotData;
+    plotData.formula = formula.formula;
+    plotData.reMin = -2.0;
+    plotData.reMax = 2.0;
+    plotData.imMin = -2.0;
+    plotData.imMax = 2.0;
+    plotData.imageWidth = size;
+    plotData.imageHeight = size;
+    plotData.coloringMethod = 0;
+    plotData.colorSlope = 1.0;
+    plotData.backend = backend;
+    plotData.antialiasing = antialiasing;
+    plotData.precision = precision;
+    return plotData;
+}
+
+std::vector<unsigned char> render(PlotData const & plotData, RedrawInfo * info = nullptr)
+{
+    std::vector<unsigned char> pixels(3*std::size_t(plotData.imageWidth)*plotData.imageHeight);
+    ImageView image{pixels.data(), 3*std::ptrdiff_t(plotData.imageWidth), plotData.imageWidth, plotData.imageHeight};
+    std::atomic_bool cancellationToken(false);
+    RedrawInfo result = redraw(plotData, image, []() {}, cancellationToken);
+    if (info != nullptr)
+        *info = result;
+    return pixels;
+}
+
+// per-pixel error of plotData against the same frame rendered in double precision
+// without interpolation: the largest and mean difference of a color component, the
+// share of pixels differing and the share of pixels evaluated
+BenchmarkCounters pixelErrors(PlotData const & plotData)
+{
+    PlotData reference = plotData;
+    reference.precision = Precision::DOUBLE;
+    reference.interpolation = false;
+    std::vector<unsigned char> const expected = render(reference);
+    RedrawInfo info;
+    std::vector<unsigned char> const actual = render(plotData, &info);
+
+    int maxError = 0;
+    double sum = 0.0;
+    std::size_t differing = 0;
+    for (std::size_t p = 0; p < actual.size(); p += 3)
+    {
+        bool differs = false;
+        for (std::size_t c = p; c < p + 3; ++c)
+        {
+            int error = std::abs(int(actual[c]) - int(expected[c]));
+            maxError = std::max(maxError, error);
+            sum += error;
+            differs = differs || error != 0;
+        }
+        differing += differs;
+    }
+
+    return BenchmarkCounters{{"max_channel_error", double(maxError)},
+                             {"mean_channel_error", sum/actual.size()},
+                             {"differing_pixels", 3.0*differing/actual.size()},
+                             {"evaluated_pixels", double(info.profile.points)/info.profile.framePixels}};
+}
+
+void addRedraw(BenchmarkSuite & suite, std::string const & name, PlotData const & plotData,
+               std::function<BenchmarkCounters()> counters = nullptr)
+{
+    auto pixels = std::make_shared<std::vector<unsigned char>>(3*std::size_t(plotData.imageWidth)*plotData.imageHeight);
+
+    suite.add(name, [plotData, pixels]()
+    {
+        ImageView image{pixels->data(), 3*std::ptrdiff_t(plotData.imageWidth), plotData.imageWidth, plotData.imageHeight};
+        std::atomic_bool cancellationToken(false);
+        redraw(plotData, image, []() {}, cancellationToken);
+    }, double(plotData.imageWidth)*plotData.imageHeight, counters);
+}
+
+// whole frames through the tile pipeline, on the shared pool
+void addRedraw(BenchmarkSuite & suite)
+{
+    std::vector<Backend> backends{Backend::INTERPRETER};
+    if (NativeCode::available())
+        backends.push_back(Backend::JIT);
+
+    for (Backend backend : backends)
+    for (Formula const & formula : CORPUS)
+    for (int size : REDRAW_SIZES)
+    {
+        std::string name = std::string("redraw/") + ((backend == Backend::JIT) ? "jit/" : "interpreter/")
+                           + formula.name + "/" + std::to_string(size) + "x" + std::to_string(size);
+        addRedraw(suite, name, redrawPlotData(formula, size, backend, 1));
+    }
+
+    // single precision evaluation and coloring, with the error against double precision
+    for (Formula const & formula : CORPUS)
+    {
+        int const size = REDRAW_SIZES[1];
+        std::string name = std::string("redraw/float/") + formula.name + "/"
+                           + std::to_string(size) + "x" + std::to_string(size);
+        PlotData plotData = redrawPlotData(formula, size, Backend::INTERPRETER, 1, Precision::FLOAT);
+        addRedraw(suite, name, plotData, [plotData]() { return pixelErrors(plotData); });
+    }
+
+    // smooth regions filled by interpolation, with the error against the plain frame
+    for (Formula const & formula : CORPUS)
+    {
+        int const size = REDRAW_SIZES[1];
+        std::string name = std::string("redraw/interpolate/") + formula.name + "/"
+                           + std::to_string(size) + "x" + std::to_string(size);
+        PlotData plotData = redrawPlotData(formula, size, Backend::INTERPRETER, 1);
+        plotData.interpolation = true;
+        addRedraw(suite, name, plotData, [plotData]() { return pixelErrors(plotData); });
+    }
+
+    // a new color slope on every call: only the recoloring runs, from the polar values
+    for (Formula const & formula : CORPUS)
+    {
+        int const size = REDRAW_SIZES[1];
+        PlotData plotData = redrawPlotData(formula, size, Backend::INTERPRETER, 1);
+        auto cache = std::make_shared<std::pair<FrameCache, RenderCache>>();
+        auto pixels = std::make_shared<std::vector<unsigned char>>(3*std::size_t(size)*size);
+
+        std::string name = std::string("redraw/recolor/") + formula.name + "/"
+                           + std::to_string(size) + "x" + std::to_string(size);
+        suite.add(name, [plotData, cache, pixels]() mutable
+        {
+            ImageView image{pixels->data(), 3*std::ptrdiff_t(plotData.imageWidth), plotData.imageWidth, plotData.imageHeight};
+            std::atomic_bool cancellationToken(false);
+            plotData.colorSlope *= 1.0001;
+            redrawCached(plotData, image, cache->first, cache->second, 1, [](int) {}, []() {}, cancellationToken);
+        }, double(size)*size);
+    }
+
+    // adaptive anti-aliasing on top of the plain frame
+    for (Formula const & formula : CORPUS)
+    {
+        int const size = REDRAW_SIZES[1];
+        std::string name = std::string("redraw/antialias_3x3/") + formula.name + "/"
+                           + std::to_string(size) + "x" + std::to_string(size);
+        addRedraw(suite, name, redrawPlotData(formula, size, Backend::INTERPRETER, 3));
+    }
+}
+
+std::string currentDate()
+{
+    std::time_t now = std::time(nullptr);
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+    return buffer;
+}
+
+struct Options
+{
+    bool json = false;
+    std::string filter;
+    double minTime = 0.2;
+    std::string output;
+    bool help = false;
+};
+
+void parseArguments(std::vector<std::string> const & args, Options & options)
+{
+    for (std::size_t k = 0; k < args.size(); ++k)
+    {
+        std::string const & option = args[k];
+
+        if (option == "-h" || option == "--help")
+        {
+            options.help = true;
+            continue;
+        }
+
+        if (k + 1 == args.size())
+            throw std::invalid_argument("missing value for " + option);
+        std::string const & value = args[++k];
+
+        if (option == "--format")
+        {
+            if (value != "console" && value != "json")
+                throw std::invalid_argument("unknown format '" + value + "'");
+            options.json = (value == "json");
+        }
+        else if (option == "--filter")
+        {
+            options.filter = value;
+        }
+        else if (option == "--min-time")
+        {
+            try
+            {
+                options.minTime = std::stod(value);
+            }
+            catch (std::logic_error const &)
+            {
+                throw std::invalid_argument("invalid number '" + value + "' for " + option);
+            }
+        }
+        else if (option == "-o" || option == "--output")
+        {
+            options.output = value;
+        }
+        else
+        {
+            throw std::invalid_argument("unknown option '" + option + "'");
+        }
+    }
+}
+
+char const * usage()
+{
+    return
+        "Usage: complex-plot-bench [options]\n"
+        "\n"
+        "Micro and end-to-end benchmarks of the evaluation engine.\n"
+        "\n"
+        "Options:\n"
+        "      --format F      console (default) or json (Google Benchmark layout)\n"
+        "      --filter TEXT   only run benchmarks whose name contains TEXT\n"
+        "      --min-time S    run every benchmark for at least S seconds (default 0.2)\n"
+        "  -o, --output PATH   write the results to PATH instead of standard output\n"
+        "  -h, --help          show this help\n";
+}
+
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    Options options;
+    try
+    {
+        parseArguments(std::vector<std::string>(argv + 1, argv + argc), options);
+    }
+    catch (std::invalid_argument const & e)
+    {
+        std::cerr << "complex-plot-bench: " << e.what() << "\n\n" << usage();
+        return 2;
+    }
+
+    if (options.help)
+    {
+        std::cout << usage();
+        return 0;
+    }
+
+    std::ofstream file;
+    if (!options.output.empty())
+    {
+        file.open(options.output);
+        if (!file)
+        {
+            std::cerr << "complex-plot-bench: cannot open '" << options.output << "'" << std::endl;
+            return 1;
+        }
+    }
+    std::ostream & out = options.output.empty() ? std::cout : file;
+
+    Grid grid;
+    BenchmarkSuite suite;
+    addFrontEnd(suite);
+    addOperators(suite, grid);
+    addPowers(suite, grid);
+    addColoring(suite, grid);
+    addCoordinates(suite);
+    addRedraw(suite);
+
+    BenchmarkContext context;
+    context.date = currentDate();
+    context.cpuCount = std::thread::hardware_concurrency();
+    context.kernels = batchKernels().name;
+    context.jit = NativeCode::available();
+    context.minTime = options.minTime;
+
+    // the table is printed as the results come in, JSON at the end
+    if (!options.json)
+    {
+        out << context.date << "\n"
+            << "Running on " << context.cpuCount << " CPUs, batch kernels: " << context.kernels
+            << ", native code: " << (context.jit ? "yes" : "no") << "\n\n";
+        printResultHeader(out);
+    }
+
+    std::vector<BenchmarkResult> results = suite.run(options.filter, std::chrono::duration<double>(options.minTime),
+                                                     [&](BenchmarkResult const & result)
+    {
+        if (!options.json)
+            printResult(out, result);
+    });
+
+    if (options.json)
+        writeJson(out, context, results);
+
+    return 0;
+}
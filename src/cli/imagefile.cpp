@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <cctype>
+#include <csetjmp>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef COMPLEXPLOT_HAVE_PNG
+#include <png.h>
+#endif
+
+#ifdef COMPLEXPLOT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "cli/imagefile.hpp"
+
+#ifdef COMPLEXPLOT_HAVE_PNG
+struct ImageFile::PngState
+{
+    png_structp write;
+    png_infop info;
+};
+#else
+struct ImageFile::PngState {};
+#endif
+
+namespace {
+
+// written pages of a raw image are released in chunks of this many bytes
+std::size_t const RELEASE_BYTES = std::size_t(16) << 20;
+
+} // namespace
+
+ImageFile::ImageFile(std::string const & path, int width, int height) :
+    path(path),
+    format(formatFromPath(path)),
+    width(width),
+    height(height),
+    rowsWritten(0),
+    file(nullptr),
+    ownsFile(true),
+    png(nullptr),
+    fd(-1),
+    mapping(nullptr),
+    mappingSize(0),
+    released(0)
+{
+    try
+    {
+        open();
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+}
+
+ImageFile::ImageFile(std::FILE * stream, Format format, int width, int height) :
+    path("stream"),
+    format(format),
+    width(width),
+    height(height),
+    rowsWritten(0),
+    file(stream),
+    ownsFile(false),
+    png(nullptr),
+    fd(-1),
+    mapping(nullptr),
+    mappingSize(0),
+    released(0)
+{
+    try
+    {
+        open();
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+}
+
+ImageFile::~ImageFile()
+{
+    release();
+}
+
+void ImageFile::open()
+{
+    // raw rows go straight to a stream
+    if (format == Format::RAW)
+    {
+        if (ownsFile)
+            openMapping();
+        return;
+    }
+
+    if (ownsFile)
+    {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+            throw std::runtime_error("cannot open '" + path + "' for writing");
+    }
+
+    if (format == Format::PPM)
+    {
+        if (std::fprintf(file, "P6\n%d %d\n255\n", width, height) < 0)
+            fail("write error");
+        return;
+    }
+
+#ifdef COMPLEXPLOT_HAVE_PNG
+    png = new PngState{nullptr, nullptr};
+    png->write = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (png->write != nullptr)
+        png->info = png_create_info_struct(png->write);
+    if (png->info == nullptr)
+        fail("cannot initialize libpng");
+
+    if (setjmp(png_jmpbuf(png->write)))
+        fail("libpng error");
+
+    png_init_io(png->write, file);
+    png_set_IHDR(png->write, png->info, width, height, 8, PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png->write, png->info);
+#endif
+}
+
+#ifdef COMPLEXPLOT_HAVE_MMAP
+void ImageFile::openMapping()
+{
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        throw std::runtime_error("cannot open '" + path + "' for writing");
+
+    mappingSize = 3*std::size_t(width)*height;
+    if (ftruncate(fd, static_cast<off_t>(mappingSize)) != 0)
+        fail("cannot allocate the file");
+
+    void * memory = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+        fail("cannot map the file");
+    mapping = static_cast<unsigned char *>(memory);
+}
+
+// lets the system write back and drop the written pages; they stay in the file
+void ImageFile::releaseWritten(bool all)
+{
+    std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t written = 3*std::size_t(width)*rowsWritten;
+    std::size_t end = all ? mappingSize : written/page*page;
+    if (end < released + (all ? 1 : RELEASE_BYTES))
+        return;
+
+    if (msync(mapping + released, end - released, all ? MS_SYNC : MS_ASYNC) != 0)
+        fail("write error");
+    madvise(mapping + released, end - released, MADV_DONTNEED);
+    released = end;
+}
+#else
+void ImageFile::openMapping()
+{
+}
+
+void ImageFile::releaseWritten(bool)
+{
+}
+#endif
+
+void ImageFile::release()
+{
+#ifdef COMPLEXPLOT_HAVE_MMAP
+    if (mapping != nullptr)
+        munmap(mapping, mappingSize);
+    mapping = nullptr;
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+#endif
+
+#ifdef COMPLEXPLOT_HAVE_PNG
+    if (png != nullptr)
+        png_destroy_write_struct(&png->write, &png->info);
+#endif
+    delete png;
+    png = nullptr;
+
+    if (file != nullptr && ownsFile)
+        std::fclose(file);
+    file = nullptr;
+}
+
+void ImageFile::writeRow(unsigned char const * rgb)
+{
+    if (format == Format::RAW && ownsFile)
+    {
+        std::memcpy(mapping + 3*std::size_t(width)*rowsWritten, rgb, 3*std::size_t(width));
+        ++rowsWritten;
+        releaseWritten(false);
+        return;
+    }
+
+    if (format != Format::PNG)
+    {
+        if (std::fwrite(rgb, 3, width, file) != static_cast<std::size_t>(width))
+            fail("write error");
+        ++rowsWritten;
+        return;
+    }
+
+#ifdef COMPLEXPLOT_HAVE_PNG
+    if (setjmp(png_jmpbuf(png->write)))
+        fail("libpng error");
+    png_write_row(png->write, const_cast<png_bytep>(rgb));
+    ++rowsWritten;
+#endif
+}
+
+void ImageFile::close()
+{
+    if (rowsWritten != height)
+        fail("incomplete image");
+
+#ifdef COMPLEXPLOT_HAVE_MMAP
+    if (format == Format::RAW && ownsFile)
+    {
+        releaseWritten(true);
+        munmap(mapping, mappingSize);
+        mapping = nullptr;
+        int f = fd;
+        fd = -1;
+        if (::close(f) != 0)
+            throw std::runtime_error("cannot write '" + path + "'");
+        return;
+    }
+#endif
+
+#ifdef COMPLEXPLOT_HAVE_PNG
+    if (format == Format::PNG)
+    {
+        if (setjmp(png_jmpbuf(png->write)))
+            fail("libpng error");
+        png_write_end(png->write, nullptr);
+    }
+#endif
+
+    std::FILE * f = file;
+    file = nullptr;
+    if ((ownsFile ? std::fclose(f) : std::fflush(f)) != 0)
+        throw std::runtime_error("cannot write '" + path + "'");
+}
+
+ImageFile::Format ImageFile::formatFromPath(std::string const & path)
+{
+    std::string::size_type dot = path.rfind('.');
+    std::string extension = (dot == std::string::npos) ? std::string() : path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+
+    if (extension == "ppm")
+        return Format::PPM;
+#ifdef COMPLEXPLOT_HAVE_MMAP
+    if (extension == "rgb")
+        return Format::RAW;
+#endif
+#ifdef COMPLEXPLOT_HAVE_PNG
+    if (extension == "png")
+        return Format::PNG;
+#endif
+
+    std::string supported = ".ppm";
+#ifdef COMPLEXPLOT_HAVE_PNG
+    supported = ".png, " + supported;
+#endif
+#ifdef COMPLEXPLOT_HAVE_MMAP
+    supported += ", .rgb";
+#endif
+    throw std::invalid_argument("unsupported image format '" + path + "' (use " + supported + ")");
+}
+
+void ImageFile::fail(std::string const & what)
+{
+    throw std::runtime_error(what + " while writing '" + path + "'");
+}
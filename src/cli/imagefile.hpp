@@ -0,0 +1,66 @@
+#ifndef COMPLEXPLOT_IMAGEFILE_HPP
+#define COMPLEXPLOT_IMAGEFILE_HPP
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+/*
+ *  Row by row writer of 8-bit RGB images, picking the format from the file
+ *  extension: '.ppm' (binary PPM), '.png' (when built with libpng) or '.rgb'
+ *  (headerless packed RGB, on Unix). Raw images are written through a shared
+ *  memory mapping of the file whose written pages are released as rows come
+ *  in, so memory use does not grow with the image either.
+ *  Errors are reported with std::runtime_error.
+ */
+class ImageFile
+{
+public:
+    enum class Format { PPM, PNG, RAW };
+
+    ImageFile(std::string const & path, int width, int height);
+
+    // writes to an open stream instead, which close() flushes but leaves open;
+    // raw images are written to it row by row
+    ImageFile(std::FILE * stream, Format format, int width, int height);
+    ~ImageFile();
+
+    ImageFile(ImageFile const &) = delete;
+    ImageFile & operator=(ImageFile const &) = delete;
+
+    // rgb: width packed RGB triples
+    void writeRow(unsigned char const * rgb);
+
+    // flush and close; must be called after the last row
+    void close();
+
+    // throws std::invalid_argument for unsupported extensions
+    static Format formatFromPath(std::string const & path);
+
+private:
+    struct PngState;
+
+    std::string path;
+    Format format;
+    int width;
+    int height;
+    int rowsWritten;
+
+    std::FILE * file;
+    bool ownsFile;
+    PngState * png;
+
+    // RAW
+    int fd;
+    unsigned char * mapping;
+    std::size_t mappingSize;
+    std::size_t released;  // bytes at the start of mapping already handed back to the system
+
+    void open();
+    void openMapping();
+    void releaseWritten(bool all);
+    void release();
+    void fail(std::string const & what);
+};
+
+#endif // COMPLEXPLOT_IMAGEFILE_HPP
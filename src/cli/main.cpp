@@ -0,0 +1,351 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cli/imagefile.hpp"
+#include "cli/options.hpp"
+#include "engine/engine.hpp"
+
+namespace {
+
+// set by SIGINT; the job being rendered is abandoned
+std::atomic_bool cancelled(false);
+
+extern "C" void onInterrupt(int)
+{
+    cancelled = true;
+}
+
+// frames reused across the jobs of a run, and across runs through the disk tier
+struct JobCache
+{
+    RenderCache results;
+    FrameCache frame;
+};
+
+// bytes of the values and the image of a cached frame
+std::size_t frameBytes(PlotData const & plotData)
+{
+    return (2*sizeof(double) + 3)*std::size_t(plotData.imageWidth)*plotData.imageHeight;
+}
+
+// renders one job band by band, streaming the rows into the image file;
+// with cache, frames that fit its memory are rendered whole and kept, unless
+// interpolated, as the cache holds the values of every pixel
+bool render(RenderJob const & job, JobCache * cache, std::size_t cacheMemory, ThreadPool & pool, bool quiet, bool progress,
+            RedrawInfo & info)
+{
+    PlotData const & plotData = job.plotData;
+
+    // the image format is checked before rendering to fail early
+    ImageFile::formatFromPath(job.output);
+
+    // opened with the first band, so that a formula error leaves no file behind
+    std::unique_ptr<ImageFile> file;
+    RedrawInfo::DurationType writingDuration(0);
+
+    auto writeBand = [&](ImageView const & band)
+    {
+        auto writing_start_time = std::chrono::steady_clock::now();
+
+        if (!file)
+            file.reset(new ImageFile(job.output, plotData.imageWidth, plotData.imageHeight));
+        for (int y = band.top; y < band.top + band.height; ++y)
+            file->writeRow(band.scanLine(y));
+        if (band.top + band.height == plotData.imageHeight)
+            file->close();
+
+        writingDuration += std::chrono::steady_clock::now() - writing_start_time;
+    };
+
+    int percent = -1;
+    auto notifyProgress = [&](int rows)
+    {
+        int done = static_cast<int>(100*std::int64_t(rows)/plotData.imageHeight);
+        if (progress && done != percent)
+            std::cerr << "\r" << job.output << ": " << done << "%" << std::flush;
+        percent = done;
+    };
+
+    if (cache != nullptr && frameBytes(plotData) <= cacheMemory && !plotData.interpolation)
+    {
+        std::ptrdiff_t const stride = 3*std::ptrdiff_t(plotData.imageWidth);
+        std::vector<unsigned char> pixels(stride*plotData.imageHeight);
+        ImageView image{pixels.data(), stride, plotData.imageWidth, plotData.imageHeight};
+
+        auto notifyPass = [&](int step)
+        {
+            if (step == 1)
+                notifyProgress(plotData.imageHeight);
+        };
+
+        info = redrawCached(plotData, image, cache->frame, cache->results, 1, notifyPass, []() {}, cancelled, pool);
+        if (info.status == RedrawInfo::Status::FINISHED)
+            writeBand(image);
+    }
+    else
+    {
+        info = redrawBands(plotData, writeBand, notifyProgress, []() {}, cancelled, pool);
+    }
+    if (progress)
+        std::cerr << std::endl;
+
+    if (info.status == RedrawInfo::Status::ERROR)
+    {
+        std::cerr << job.output << ": " << info.message << std::endl;
+        return false;
+    }
+    if (info.status == RedrawInfo::Status::CANCELLED)
+    {
+        file.reset();
+        std::remove(job.output.c_str());
+        std::cerr << job.output << ": cancelled" << std::endl;
+        return false;
+    }
+
+    if (info.backend != plotData.backend)
+        std::cerr << job.output << ": native code is not available here, using the interpreter" << std::endl;
+
+    // writing overlaps with rendering, the rest is the wait for the last band
+    if (!quiet)
+    {
+        std::cout << std::fixed << std::setprecision(3)
+                  << job.output
+                  << ": Parsing: " << info.parsingDuration.count()
+                  << "s; Computing: " << info.computingDuration.count()
+                  << "s; Coloring: " << info.coloringDuration.count()
+                  << "s; Writing: " << writingDuration.count() << "s.";
+        if (plotData.antialiasing > 1)
+            std::cout << std::setprecision(1) << " Refined: " << 100.0*info.refinedFraction << "%.";
+        std::cout << std::endl;
+    }
+
+    return true;
+}
+
+// renders the frames of a parameter sweep into a numbered image sequence,
+// or into a raw RGB video stream for a .rgb path or - (stdout)
+bool sweep(Options const & options, ThreadPool & pool, RedrawInfo & info)
+{
+    PlotData const & plotData = options.job.plotData;
+    std::string const & output = options.job.output;
+
+    bool const stream = (output == "-") ||
+        (output.find('%') == std::string::npos && ImageFile::formatFromPath(output) == ImageFile::Format::RAW);
+
+    // checked before rendering to fail early
+    if (!stream)
+        ImageFile::formatFromPath(framePath(output, 0));
+
+    // timings go to stderr when the frames go to stdout
+    std::ostream & report = (output == "-") ? std::cerr : std::cout;
+
+    // opened with the first frame, so that a formula error leaves no file behind
+    std::FILE * video = nullptr;
+    std::size_t const frameSize = 3*std::size_t(plotData.imageWidth)*plotData.imageHeight;
+    RedrawInfo::DurationType writingDuration(0);
+
+    auto writeFrame = [&](int k, ImageView const & image)
+    {
+        auto writing_start_time = std::chrono::steady_clock::now();
+
+        if (stream)
+        {
+            if (video == nullptr)
+                video = (output == "-") ? stdout : std::fopen(output.c_str(), "wb");
+            if (video == nullptr || std::fwrite(image.data, 1, frameSize, video) != frameSize)
+                throw std::runtime_error("cannot write video stream");
+        }
+        else
+        {
+            ImageFile file(framePath(output, k), plotData.imageWidth, plotData.imageHeight);
+            for (int y = 0; y < plotData.imageHeight; ++y)
+                file.writeRow(image.scanLine(y));
+            file.close();
+        }
+
+        writingDuration += std::chrono::steady_clock::now() - writing_start_time;
+
+        if (options.progress)
+            std::cerr << "\r" << output << ": frame " << k + 1 << "/" << options.frames << std::flush;
+    };
+
+    try
+    {
+        info = redrawSweep(plotData, options.sweepFrom, options.sweepTo, options.frames, writeFrame, []() {},
+                           cancelled, pool);
+    }
+    catch (...)
+    {
+        if (video != nullptr && video != stdout)
+            std::fclose(video);
+        throw;
+    }
+    if (options.progress)
+        std::cerr << std::endl;
+
+    bool closed = true;
+    if (video == stdout)
+        closed = (std::fflush(video) == 0);
+    else if (video != nullptr)
+        closed = (std::fclose(video) == 0);
+    if (!closed)
+        throw std::runtime_error("cannot write video stream");
+
+    if (info.status == RedrawInfo::Status::ERROR)
+    {
+        std::cerr << output << ": " << info.message << std::endl;
+        return false;
+    }
+    if (info.status == RedrawInfo::Status::CANCELLED)
+    {
+        std::cerr << output << ": cancelled" << std::endl;
+        return false;
+    }
+
+    if (info.backend != plotData.backend)
+        std::cerr << output << ": native code is not available here, using the interpreter" << std::endl;
+
+    // throughput over the whole sweep, encoding of the last frame included
+    if (!options.quiet)
+    {
+        double const seconds = (info.parsingDuration + info.profile.renderingDuration).count();
+        report << std::fixed << std::setprecision(3)
+               << output
+               << ": Frames: " << options.frames
+               << "; Parsing: " << info.parsingDuration.count()
+               << "s; Computing: " << info.computingDuration.count()
+               << "s; Coloring: " << info.coloringDuration.count()
+               << "s; Writing: " << writingDuration.count() << "s; "
+               << std::setprecision(2) << ((seconds > 0.0) ? options.frames/seconds : 0.0) << " frames/s."
+               << std::endl;
+    }
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    Options options;
+    std::vector<RenderJob> jobs;
+
+    try
+    {
+        parseArguments(std::vector<std::string>(argv + 1, argv + argc), options);
+
+        if (options.help)
+        {
+            std::cout << usage();
+            return 0;
+        }
+
+        if (options.sweep)
+        {
+            if (!options.jobFile.empty())
+                throw std::invalid_argument("--sweep renders a single job, not a job file");
+            if (options.job.plotData.antialiasing > 1 || options.job.plotData.interpolation)
+                throw std::invalid_argument("sweep frames are neither anti-aliased nor interpolated");
+        }
+
+        if (!options.jobFile.empty())
+            jobs = readJobFile(options.jobFile, options.job);
+        else if (!options.job.output.empty())
+            jobs.push_back(options.job);
+        else
+            throw std::invalid_argument("missing output file");
+    }
+    catch (std::invalid_argument const & e)
+    {
+        std::cerr << "complex-plot-cli: " << e.what() << "\n\n" << usage();
+        return 2;
+    }
+
+    // one pool serves all jobs
+    std::unique_ptr<ThreadPool> ownPool;
+    if (options.threads != 0)
+        ownPool.reset(new ThreadPool(options.threads));
+    ThreadPool & pool = ownPool ? *ownPool : ThreadPool::shared();
+
+    // caching pays off with several jobs or with a cache directory
+    std::unique_ptr<JobCache> cache;
+    if (jobs.size() > 1 || !options.cacheDirectory.empty())
+    {
+        cache.reset(new JobCache);
+        cache->results.setBudget(options.cacheMemory);
+        if (!cache->results.setDiskTier(options.cacheDirectory, options.cacheDisk))
+        {
+            std::cerr << "complex-plot-cli: cannot create cache directory '" << options.cacheDirectory << "'" << std::endl;
+            return 2;
+        }
+    }
+
+    // opened before rendering, so that a bad path does not cost a whole run
+    std::ofstream profile;
+    if (!options.profileFile.empty())
+    {
+        profile.open(options.profileFile);
+        if (!profile)
+        {
+            std::cerr << "complex-plot-cli: cannot write profile '" << options.profileFile << "'" << std::endl;
+            return 2;
+        }
+        profile << "[";
+    }
+
+    std::signal(SIGINT, onInterrupt);
+
+    int failures = 0;
+    int profiled = 0;
+    for (RenderJob const & job : jobs)
+    {
+        if (cancelled)
+            break;
+
+        RedrawInfo info;
+        try
+        {
+            bool done = options.sweep ? sweep(options, pool, info) :
+                render(job, cache.get(), options.cacheMemory, pool, options.quiet, options.progress, info);
+            if (!done)
+                ++failures;
+        }
+        catch (std::exception const & e)
+        {
+            std::cerr << job.output << ": " << e.what() << std::endl;
+            ++failures;
+            continue;
+        }
+
+        if (profile.is_open())
+        {
+            profile << (profiled++ == 0 ? "\n  " : ",\n  ");
+            writeProfileJson(profile, info, job.output, 2);
+        }
+    }
+
+    if (profile.is_open())
+    {
+        profile << (profiled == 0 ? "]\n" : "\n]\n");
+        profile.close();
+        if (!profile)
+        {
+            std::cerr << "complex-plot-cli: cannot write profile '" << options.profileFile << "'" << std::endl;
+            ++failures;
+        }
+    }
+
+    if (cancelled)
+        return 130;
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,415 @@
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "cli/options.hpp"
+
+namespace {
+
+double toDouble(std::string const & option, std::string const & value)
+{
+    try
+    {
+        std::size_t used;
+        double d = std::stod(value, &used);
+        if (used == value.size())
+            return d;
+    }
+    catch (std::logic_error const &)
+    {
+    }
+    throw std::invalid_argument("invalid number '" + value + "' for " + option);
+}
+
+int toInt(std::string const & option, std::string const & value)
+{
+    try
+    {
+        std::size_t used;
+        int i = std::stoi(value, &used);
+        if (used == value.size())
+            return i;
+    }
+    catch (std::logic_error const &)
+    {
+    }
+    throw std::invalid_argument("invalid integer '" + value + "' for " + option);
+}
+
+// "a<sep>b" -> a, b
+void splitPair(std::string const & option, std::string const & value, char sep, std::string & a, std::string & b)
+{
+    std::string::size_type pos = value.find(sep);
+    if (pos == std::string::npos)
+        throw std::invalid_argument("expected 'A" + std::string(1, sep) + "B' for " + option + ", got '" + value + "'");
+    a = value.substr(0, pos);
+    b = value.substr(pos + 1);
+}
+
+} // namespace
+
+Options::Options() :
+    threads(0),
+    quiet(false),
+    progress(false),
+    sweep(false),
+    sweepFrom(0.0),
+    sweepTo(1.0),
+    frames(60),
+    cacheMemory(std::size_t(256) << 20),
+    cacheDisk(std::size_t(1024) << 20),
+    help(false)
+{
+    // same defaults as the GUI
+    job.plotData.formula = "z^2 + 1";
+    job.plotData.reMin = -5.0;
+    job.plotData.reMax = 5.0;
+    job.plotData.imMin = -5.0;
+    job.plotData.imMax = 5.0;
+    job.plotData.imageWidth = 1000;
+    job.plotData.imageHeight = 1000;
+    job.plotData.coloringMethod = 0;
+    job.plotData.colorSlope = 1.0;
+}
+
+void parseArguments(std::vector<std::string> const & args, Options & options)
+{
+    PlotData & plotData = options.job.plotData;
+
+    for (std::size_t k = 0; k < args.size(); ++k)
+    {
+        std::string const & option = args[k];
+
+        // options without a value
+        if (option == "-h" || option == "--help")
+        {
+            options.help = true;
+            continue;
+        }
+        if (option == "-q" || option == "--quiet")
+        {
+            options.quiet = true;
+            continue;
+        }
+        if (option == "-p" || option == "--progress")
+        {
+            options.progress = true;
+            continue;
+        }
+        if (option == "--interpolate")
+        {
+            plotData.interpolation = true;
+            continue;
+        }
+
+        if (k + 1 == args.size())
+            throw std::invalid_argument("missing value for " + option);
+        std::string const & value = args[++k];
+        std::string a, b;
+
+        if (option == "-f" || option == "--formula")
+        {
+            plotData.formula = value;
+        }
+        else if (option == "--param")
+        {
+            plotData.parameter = toDouble(option, value);
+        }
+        else if (option == "--sweep")
+        {
+            splitPair(option, value, ':', a, b);
+            options.sweep = true;
+            options.sweepFrom = toDouble(option, a);
+            options.sweepTo = toDouble(option, b);
+        }
+        else if (option == "--frames")
+        {
+            options.frames = toInt(option, value);
+            if (options.frames <= 0)
+                throw std::invalid_argument("frame count must be positive");
+        }
+        else if (option == "--re")
+        {
+            splitPair(option, value, ':', a, b);
+            plotData.reMin = toDouble(option, a);
+            plotData.reMax = toDouble(option, b);
+        }
+        else if (option == "--im")
+        {
+            splitPair(option, value, ':', a, b);
+            plotData.imMin = toDouble(option, a);
+            plotData.imMax = toDouble(option, b);
+        }
+        else if (option == "-s" || option == "--size")
+        {
+            splitPair(option, value, 'x', a, b);
+            plotData.imageWidth = toInt(option, a);
+            plotData.imageHeight = toInt(option, b);
+            if (plotData.imageWidth <= 0 || plotData.imageHeight <= 0)
+                throw std::invalid_argument("image size must be positive");
+        }
+        else if (option == "-a" || option == "--slope")
+        {
+            plotData.colorSlope = toDouble(option, value);
+        }
+        else if (option == "--aa")
+        {
+            int samples = toInt(option, value);
+            if (samples < 1 || samples % 2 == 0)
+                throw std::invalid_argument("samples per axis must be a positive odd number");
+            plotData.antialiasing = samples;
+        }
+        else if (option == "--aa-threshold")
+        {
+            plotData.antialiasingThreshold = toDouble(option, value);
+        }
+        else if (option == "-b" || option == "--backend")
+        {
+            if (value == "interpreter")
+                plotData.backend = Backend::INTERPRETER;
+            else if (value == "jit")
+                plotData.backend = Backend::JIT;
+            else
+                throw std::invalid_argument("unknown backend '" + value + "' for " + option);
+        }
+        else if (option == "--precision")
+        {
+            if (value == "double")
+                plotData.precision = Precision::DOUBLE;
+            else if (value == "float")
+                plotData.precision = Precision::FLOAT;
+            else if (value == "extended")
+                plotData.precision = Precision::EXTENDED;
+            else if (value == "auto")
+                plotData.precision = Precision::AUTO;
+            else
+                throw std::invalid_argument("unknown precision '" + value + "' for " + option);
+        }
+        else if (option == "-o" || option == "--output")
+        {
+            options.job.output = value;
+        }
+        else if (option == "-j" || option == "--jobs")
+        {
+            options.jobFile = value;
+        }
+        else if (option == "--cache-dir")
+        {
+            options.cacheDirectory = value;
+        }
+        else if (option == "--cache-memory" || option == "--cache-disk")
+        {
+            int megabytes = toInt(option, value);
+            if (megabytes < 0)
+                throw std::invalid_argument("cache size must not be negative");
+            (option == "--cache-memory" ? options.cacheMemory : options.cacheDisk) = std::size_t(megabytes) << 20;
+        }
+        else if (option == "--profile")
+        {
+            options.profileFile = value;
+        }
+        else if (option == "-t" || option == "--threads")
+        {
+            int threads = toInt(option, value);
+            if (threads < 0)
+                throw std::invalid_argument("thread count must not be negative");
+            options.threads = threads;
+        }
+        else
+        {
+            throw std::invalid_argument("unknown option '" + option + "'");
+        }
+    }
+}
+
+std::vector<std::string> splitLine(std::string const & line)
+{
+    std::vector<std::string> words;
+    std::string word;
+    bool inWord = false;
+    char quote = 0;
+
+    for (char c : line)
+    {
+        if (quote != 0)
+        {
+            if (c == quote)
+                quote = 0;
+            else
+                word += c;
+            continue;
+        }
+
+        if (c == '"' || c == '\'')
+        {
+            quote = c;
+            inWord = true;
+            continue;
+        }
+
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            if (inWord)
+                words.push_back(word);
+            word.clear();
+            inWord = false;
+            continue;
+        }
+
+        word += c;
+        inWord = true;
+    }
+
+    if (quote != 0)
+        throw std::invalid_argument("unterminated quote");
+    if (inWord)
+        words.push_back(word);
+
+    return words;
+}
+
+void parseJob(std::vector<std::string> const & words, RenderJob & job)
+{
+    Options options;
+    Options const defaultOptions;
+    options.job = job;
+    parseArguments(words, options);
+    if (!options.jobFile.empty() || options.threads != 0 || options.quiet || options.progress || options.help ||
+        !options.profileFile.empty() || !options.cacheDirectory.empty() || options.cacheMemory != defaultOptions.cacheMemory ||
+        options.cacheDisk != defaultOptions.cacheDisk || options.sweep || options.frames != defaultOptions.frames)
+        throw std::invalid_argument("only plot options are allowed in a job");
+    job = options.job;
+}
+
+std::vector<RenderJob> readJobFile(std::string const & path, RenderJob const & defaults)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::invalid_argument("cannot open job file '" + path + "'");
+
+    std::vector<RenderJob> jobs;
+    std::string line;
+    int number = 0;
+
+    while (std::getline(file, line))
+    {
+        ++number;
+        std::string::size_type first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+
+        RenderJob job = defaults;
+        try
+        {
+            parseJob(splitLine(line), job);
+            if (job.output.empty())
+                throw std::invalid_argument("missing output file");
+        }
+        catch (std::invalid_argument const & e)
+        {
+            throw std::invalid_argument(path + ":" + std::to_string(number) + ": " + e.what());
+        }
+
+        jobs.push_back(job);
+    }
+
+    return jobs;
+}
+
+std::string framePath(std::string const & pattern, int k)
+{
+    std::ostringstream path;
+    bool replaced = false;
+
+    for (std::string::size_type pos = 0; pos < pattern.size(); ++pos)
+    {
+        if (pattern[pos] != '%')
+        {
+            path << pattern[pos];
+            continue;
+        }
+        if (pos + 1 < pattern.size() && pattern[pos + 1] == '%')
+        {
+            path << '%';
+            ++pos;
+            continue;
+        }
+
+        std::string::size_type end = pattern.find_first_not_of("0123456789", pos + 1);
+        if (replaced || end == std::string::npos || pattern[end] != 'd' || end - pos > 4)
+            throw std::invalid_argument("output pattern '" + pattern + "' must contain one %d or %0Nd");
+
+        std::string const number = std::to_string(k);
+        std::string const width = pattern.substr(pos + 1, end - pos - 1);
+        std::size_t const digits = width.empty() ? 0 : std::stoul(width);
+        char const fill = (!width.empty() && width[0] == '0') ? '0' : ' ';
+        if (number.size() < digits)
+            path << std::string(digits - number.size(), fill);
+        path << number;
+
+        replaced = true;
+        pos = end;
+    }
+
+    if (!replaced)
+        throw std::invalid_argument("output pattern '" + pattern + "' must contain one %d or %0Nd");
+    return path.str();
+}
+
+char const * usage()
+{
+    return
+        "Usage: complex-plot-cli [options] -o OUTPUT\n"
+        "       complex-plot-cli [options] -j JOBFILE\n"
+        "       complex-plot-cli [options] --sweep T0:T1 -o PATTERN|STREAM\n"
+        "\n"
+        "Renders f(z) over a rectangle of the complex plane to a .png, .ppm or raw\n"
+        ".rgb image. The image is rendered and written in bands of rows, so memory\n"
+        "use does not depend on the image height.\n"
+        "\n"
+        "Options:\n"
+        "  -f, --formula F     function of z and of a parameter t (default \"z^2 + 1\")\n"
+        "      --param T       value of t (default 0)\n"
+        "      --re MIN:MAX    real range (default -5:5)\n"
+        "      --im MIN:MAX    imaginary range (default -5:5)\n"
+        "  -s, --size WxH      image size in pixels (default 1000x1000)\n"
+        "  -a, --slope A       color slope (default 1)\n"
+        "      --aa N          adaptive anti-aliasing: supersample pixels at edges\n"
+        "                      with NxN samples, N odd (default 1: off)\n"
+        "      --aa-threshold T\n"
+        "                      lightness or hue variance of the 3x3 neighbourhood\n"
+        "                      above which a pixel is refined (default 0.002)\n"
+        "      --interpolate   fill regions whose colors provably vary by less than\n"
+        "                      one step by interpolation, evaluating only their\n"
+        "                      corners; pixels differ by at most one color step\n"
+        "  -b, --backend B     evaluation backend: interpreter (default) or jit,\n"
+        "                      native code where supported\n"
+        "      --precision P   arithmetic: double (default), float, about twice as\n"
+        "                      fast and within one color step, extended, double-\n"
+        "                      double for deep zooms, or auto, float unless the\n"
+        "                      view is zoomed in too deep for it; double and auto\n"
+        "                      switch to extended where double falls short\n"
+        "  -o, --output PATH   output image\n"
+        "  -j, --jobs FILE     render the jobs listed in FILE, one per line, each\n"
+        "                      given with the options above; the command line\n"
+        "                      options are the defaults for every job\n"
+        "      --cache-dir DIR keep function values in DIR, so that a later run of\n"
+        "                      the same plot only recolors them\n"
+        "      --cache-memory MB\n"
+        "                      memory for frames reused across jobs (default 256)\n"
+        "      --cache-disk MB size limit of the cache directory (default 1024)\n"
+        "      --sweep T0:T1   render an animation of --frames images with t going\n"
+        "                      from T0 to T1; the formula is compiled once and each\n"
+        "                      frame is evaluated while the previous one is colored\n"
+        "                      and written. OUTPUT is an image path with a frame\n"
+        "                      number placeholder (frame%04d.png), or a raw RGB video\n"
+        "                      stream: a .rgb file or - for stdout\n"
+        "      --frames N      number of frames of a sweep (default 60)\n"
+        "  -t, --threads N     worker threads (default: one per hardware thread)\n"
+        "  -q, --quiet         do not print timings\n"
+        "  -p, --progress      show the progress of each image on stderr\n"
+        "      --profile PATH  write the timings, per-thread and per-operator\n"
+        "                      counters of every job to PATH as JSON\n"
+        "  -h, --help          show this help\n";
+}
@@ -0,0 +1,73 @@
+#ifndef COMPLEXPLOT_OPTIONS_HPP
+#define COMPLEXPLOT_OPTIONS_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "engine/plotdata.hpp"
+
+struct RenderJob
+{
+    PlotData plotData;
+    std::string output;
+};
+
+struct Options
+{
+    RenderJob job;        // single job, or defaults for the jobs in jobFile
+    std::string jobFile;
+    std::size_t threads;  // 0: one per hardware thread
+    bool quiet;
+    bool progress;  // report rendered rows on stderr
+    std::string profileFile;  // JSON profile of every job, empty: none
+
+    // parameter sweep: frames images with t from sweepFrom to sweepTo
+    bool sweep;
+    double sweepFrom;
+    double sweepTo;
+    int frames;
+
+    // frames kept across the jobs of a run, and in cacheDirectory across runs
+    std::string cacheDirectory;  // empty: no disk tier
+    std::size_t cacheMemory;     // bytes
+    std::size_t cacheDisk;       // bytes
+    bool help;
+
+    Options();
+};
+
+/*
+ *  Parses command line arguments (without the program name) into options.
+ *  Settings not mentioned keep their current values.
+ *  Throws std::invalid_argument on malformed input.
+ */
+void parseArguments(std::vector<std::string> const & args, Options & options);
+
+/*
+ *  Path of frame k of a sweep: the first %d of pattern, optionally with a
+ *  zero-padded width as in %04d, replaced by k; %% stands for %.
+ *  Throws std::invalid_argument if pattern has no such placeholder.
+ */
+std::string framePath(std::string const & pattern, int k);
+
+// words of a job line; quotes group words and are removed
+std::vector<std::string> splitLine(std::string const & line);
+
+/*
+ *  Parses the words of one job line into job, which holds the defaults. Throws
+ *  std::invalid_argument on malformed input and on options other than those
+ *  of the plot and its output (threads, caches, sweeps, ...).
+ */
+void parseJob(std::vector<std::string> const & words, RenderJob & job);
+
+/*
+ *  Reads a job file: one job per line, written with the same options as the
+ *  command line (quoted with "..." or '...' where needed); empty lines and
+ *  lines starting with '#' are skipped. Each job starts from 'defaults'.
+ */
+std::vector<RenderJob> readJobFile(std::string const & path, RenderJob const & defaults);
+
+char const * usage();
+
+#endif // COMPLEXPLOT_OPTIONS_HPP
@@ -0,0 +1,29 @@
+#include "batch.hpp"
+
+extern BatchKernels const batchKernelsGENERIC;
+#ifdef COMPLEXPLOT_BATCH_X86
+extern BatchKernels const batchKernelsAVX2;
+extern BatchKernels const batchKernelsAVX512;
+#endif
+
+namespace {
+
+BatchKernels const & selectBatchKernels()
+{
+#ifdef COMPLEXPLOT_BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq"))
+        return batchKernelsAVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return batchKernelsAVX2;
+#endif
+    return batchKernelsGENERIC;
+}
+
+} // namespace
+
+BatchKernels const & batchKernels()
+{
+    static BatchKernels const & kernels = selectBatchKernels();
+    return kernels;
+}
@@ -0,0 +1,73 @@
+#ifndef COMPLEXPLOT_BATCH_HPP
+#define COMPLEXPLOT_BATCH_HPP
+
+#include <cstddef>
+
+/*
+ *  Element-wise complex kernels over split (structure-of-arrays) real and
+ *  imaginary parts.
+ *
+ *  Every kernel processes exactly BATCH_SIZE lanes and projects its result
+ *  onto the Riemann sphere like std::proj. Outputs may alias inputs.
+ *  Results agree with the std::complex functions to a few ulp, except for
+ *  sin/cos based kernels (exp, pow) whose argument reduction loses accuracy
+ *  for imaginary parts beyond ~1e9 (~1e4 in single precision).
+ */
+
+std::size_t const BATCH_SIZE = 64;
+
+// the arithmetic and coloring kernels in the precision Real
+template <typename Real>
+struct ComplexKernels
+{
+    using Unary = void (*)(Real const * ar, Real const * ai, Real * dr, Real * di);
+    using Binary = void (*)(Real const * ar, Real const * ai,
+                            Real const * br, Real const * bi,
+                            Real * dr, Real * di);
+    using Power = void (*)(Real const * ar, Real const * ai, int n, Real * dr, Real * di);
+    using RealPower = void (*)(Real const * ar, Real const * ai, Real x, Real * dr, Real * di);
+
+    Unary proj;
+    Unary neg;
+    Unary exp;
+
+    Binary add;
+    Binary sub;
+    Binary mul;
+    Binary div;
+    Binary pow;
+
+    Power powi;      // integer exponent, same for all lanes
+    RealPower powr;  // real exponent, same for all lanes
+
+    // complex2rgb_HL over BATCH_SIZE lanes, writing packed 8-bit RGB triples
+    void (*colorHL)(Real const * re, Real const * im, double a, unsigned char * rgb);
+};
+
+struct BatchKernels : ComplexKernels<double>
+{
+    char const * name;
+
+    // arg z and log|z| in single precision (arg is NaN if z is), the part of
+    // colorHL that does not depend on the slope
+    void (*polar)(double const * re, double const * im, float * arg, float * lz);
+
+    // colorHL from the output of polar, within one quantization step of it
+    void (*colorPolarHL)(float const * arg, float const * lz, double a, unsigned char * rgb);
+
+    // the same kernels in single precision: twice the lanes per vector
+    // register, relative errors of a few 1e-7
+    ComplexKernels<float> single;
+
+    // the same kernels in double-double arithmetic, relative errors of a few
+    // 1e-32: every array holds 2*BATCH_SIZE doubles, the high parts of the
+    // lanes followed by their low parts. Infinite and NaN results, and those
+    // beyond the range of the extended exp and sin/cos, are the ones of the
+    // double kernels. colorHL colors the high parts.
+    ComplexKernels<double> extended;
+};
+
+// kernels for the widest instruction set supported by the running CPU
+BatchKernels const & batchKernels();
+
+#endif // COMPLEXPLOT_BATCH_HPP
@@ -0,0 +1,6 @@
+// Batch kernels compiled for the AVX2 and FMA (see CMakeLists.txt).
+
+#include "batch_impl.hpp"
+
+extern BatchKernels const batchKernelsAVX2;
+BatchKernels const batchKernelsAVX2 = makeBatchKernels("avx2");
@@ -0,0 +1,6 @@
+// Batch kernels compiled for the AVX-512F/DQ (see CMakeLists.txt).
+
+#include "batch_impl.hpp"
+
+extern BatchKernels const batchKernelsAVX512;
+BatchKernels const batchKernelsAVX512 = makeBatchKernels("avx512");
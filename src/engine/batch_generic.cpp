@@ -0,0 +1,6 @@
+// Batch kernels compiled for the baseline instruction set of the target (see CMakeLists.txt).
+
+#include "batch_impl.hpp"
+
+extern BatchKernels const batchKernelsGENERIC;
+BatchKernels const batchKernelsGENERIC = makeBatchKernels("generic");
@@ -0,0 +1,1278 @@
+/*
+ *  Batch kernel implementation, included once by every per-instruction-set
+ *  translation unit (batch_generic.cpp, batch_avx2.cpp, ...), each compiled
+ *  with its own target flags.
+ *
+ *  Everything here has internal linkage and no out-of-line library templates
+ *  are used, so the linker can never merge code compiled for one instruction
+ *  set into another. The loops are written branch-free so that the compiler
+ *  turns them into straight SIMD code.
+ *
+ *  The kernels are templates over the lane type; the scalar building blocks
+ *  (exp, log, sin/cos, atan2) are overloaded for double and float, the float
+ *  ones with polynomials of lower degree. The extended kernels build on the
+ *  double ones for their special values.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include "batch.hpp"
+
+#define BATCH_INLINE inline __attribute__((always_inline))
+#define BATCH_LOOP _Pragma("omp simd") for (std::size_t k = 0; k < BATCH_SIZE; ++k)
+
+namespace {
+
+double const INF = __builtin_inf();
+double const NOT_A_NUMBER = __builtin_nan("");
+double const PI = 3.14159265358979323846;
+double const PI_2 = 1.57079632679489661923;
+double const M_3_PI = 0.954929658551372015;  // 3/pi
+
+// adding and subtracting 1.5*2^52 rounds to the nearest integer for |x| < 2^51,
+// and the low mantissa bits of the intermediate sum hold that integer
+double const ROUND_MAGIC = 6755399441055744.0;
+
+// the same with 1.5*2^23, for |x| < 2^22
+float const ROUND_MAGIC_F = 12582912.0f;
+
+BATCH_INLINE std::uint64_t toBits(double x)
+{
+    std::uint64_t u;
+    std::memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+BATCH_INLINE double fromBits(std::uint64_t u)
+{
+    double x;
+    std::memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+BATCH_INLINE std::uint32_t toBits32(float x)
+{
+    std::uint32_t u;
+    std::memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+BATCH_INLINE float fromBits32(std::uint32_t u)
+{
+    float x;
+    std::memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+template <typename Real> BATCH_INLINE Real minimum(Real a, Real b) { return (a < b) ? a : b; }
+template <typename Real> BATCH_INLINE Real maximum(Real a, Real b) { return (a > b) ? a : b; }
+
+// without a round trip through double for float
+BATCH_INLINE double absolute(double x) { return __builtin_fabs(x); }
+BATCH_INLINE float absolute(float x) { return __builtin_fabsf(x); }
+BATCH_INLINE double copySign(double x, double y) { return __builtin_copysign(x, y); }
+BATCH_INLINE float copySign(float x, float y) { return __builtin_copysignf(x, y); }
+
+BATCH_INLINE double roundInt(double x)
+{
+    return (x + ROUND_MAGIC) - ROUND_MAGIC;
+}
+
+BATCH_INLINE float roundInt(float x)
+{
+    return (x + ROUND_MAGIC_F) - ROUND_MAGIC_F;
+}
+
+// 2^n for integral n in [-1022, 1023] given as double
+BATCH_INLINE double pow2(double n)
+{
+    return fromBits((toBits(n + (ROUND_MAGIC + 1023.0))) << 52);
+}
+
+// 2^n for integral n in [-126, 127] given as float
+BATCH_INLINE float pow2(float n)
+{
+    return fromBits32((toBits32(n + (ROUND_MAGIC_F + 127.0f))) << 23);
+}
+
+// e^x; below 2 ulp for results in the normal range, saturates to 0 and inf
+BATCH_INLINE double expReal(double x)
+{
+    double const LOG2E = 1.44269504088896340736;
+    double const LN2_HI = 6.93147180369123816490e-01;
+    double const LN2_LO = 1.90821492927058770002e-10;
+
+    double xc = minimum(maximum(x, -746.0), 710.0);
+    double n = roundInt(xc*LOG2E);
+    double r = (xc - n*LN2_HI) - n*LN2_LO;  // |r| <= ln(2)/2
+
+    // Taylor polynomial of degree 13, truncation error below 1e-17
+    double p = 1.0/6227020800.0;
+    p = p*r + 1.0/479001600.0;
+    p = p*r + 1.0/39916800.0;
+    p = p*r + 1.0/3628800.0;
+    p = p*r + 1.0/362880.0;
+    p = p*r + 1.0/40320.0;
+    p = p*r + 1.0/5040.0;
+    p = p*r + 1.0/720.0;
+    p = p*r + 1.0/120.0;
+    p = p*r + 1.0/24.0;
+    p = p*r + 1.0/6.0;
+    p = p*r + 0.5;
+    p = p*r + 1.0;
+    p = p*r + 1.0;
+
+    // scale in two steps so that subnormal and near-overflow results survive
+    double n1 = roundInt(0.5*n - 0.25);
+    double n2 = n - n1;
+    return p*pow2(n1)*pow2(n2);
+}
+
+BATCH_INLINE float expReal(float x)
+{
+    float const LOG2E = 1.44269504f;
+    float const LN2_HI = 0.693359375f;
+    float const LN2_LO = -2.12194440e-4f;
+
+    float xc = minimum(maximum(x, -104.0f), 89.0f);
+    float n = roundInt(xc*LOG2E);
+    float r = (xc - n*LN2_HI) - n*LN2_LO;
+
+    // Taylor polynomial of degree 7, truncation error below 1e-8
+    float p = 1.0f/5040.0f;
+    p = p*r + 1.0f/720.0f;
+    p = p*r + 1.0f/120.0f;
+    p = p*r + 1.0f/24.0f;
+    p = p*r + 1.0f/6.0f;
+    p = p*r + 0.5f;
+    p = p*r + 1.0f;
+    p = p*r + 1.0f;
+
+    float n1 = roundInt(0.5f*n - 0.25f);
+    float n2 = n - n1;
+    return p*pow2(n1)*pow2(n2);
+}
+
+// rotates sin and cos of the reduced argument by the quadrant: swap on odd
+// quadrants, negate sin in 2,3 and cos in 1,2
+template <typename Real, typename Bits>
+BATCH_INLINE void unfoldQuadrant(Bits quadrant, Real sr, Real cr, Real & s, Real & c)
+{
+    bool swap = (quadrant & 1) != 0;
+    bool negS = (quadrant & 2) != 0;
+    bool negC = ((quadrant + 1) & 2) != 0;
+
+    Real ss = swap ? cr : sr;
+    Real cc = swap ? sr : cr;
+    s = negS ? -ss : ss;
+    c = negC ? -cc : cc;
+}
+
+// past these the Cody-Waite reduction of sinCos loses the phase; the kernels
+// redo such lanes with the C library after their vector loop
+double const SIN_COS_MAX = 1073741824.0;  // 2^30
+float const SIN_COS_MAX_F = 8192.0f;  // 2^13
+
+BATCH_INLINE bool sinCosReduces(double x) { return absolute(x) <= SIN_COS_MAX; }
+BATCH_INLINE bool sinCosReduces(float x) { return absolute(x) <= SIN_COS_MAX_F; }
+
+// sin(x) and cos(x); Cody-Waite reduction, accurate to a few ulp for |x| <= SIN_COS_MAX
+BATCH_INLINE void sinCos(double x, double & s, double & c)
+{
+    double const TWO_OVER_PI = 0.63661977236758134308;
+    double const PI_2_1 = 1.57079625129699707031;
+    double const PI_2_2 = 7.54978941586159635335e-08;
+    double const PI_2_3 = 5.39030285815811905290e-15;
+
+    double q = roundInt(x*TWO_OVER_PI);
+    double r = ((x - q*PI_2_1) - q*PI_2_2) - q*PI_2_3;  // |r| <= pi/4
+    std::uint64_t quadrant = toBits(q + ROUND_MAGIC);
+
+    double z = r*r;
+
+    double ps = 1.58962301576546568060e-10;
+    ps = ps*z - 2.50507477628578072866e-08;
+    ps = ps*z + 2.75573136213857245213e-06;
+    ps = ps*z - 1.98412698295895385996e-04;
+    ps = ps*z + 8.33333333332211858878e-03;
+    ps = ps*z - 1.66666666666666307295e-01;
+    double sr = r + r*z*ps;
+
+    double pc = -1.13585365213876817300e-11;
+    pc = pc*z + 2.08757008419747316778e-09;
+    pc = pc*z - 2.75573141792967388112e-07;
+    pc = pc*z + 2.48015872888517045348e-05;
+    pc = pc*z - 1.38888888888730564116e-03;
+    pc = pc*z + 4.16666666666665929218e-02;
+    double cr = 1.0 - 0.5*z + z*z*pc;
+
+    unfoldQuadrant(quadrant, sr, cr, s, c);
+}
+
+// accurate to a few ulp for |x| <= SIN_COS_MAX_F
+BATCH_INLINE void sinCos(float x, float & s, float & c)
+{
+    float const TWO_OVER_PI = 0.636619772f;
+    float const PI_2_1 = 1.5703125f;
+    float const PI_2_2 = 4.837512969970703125e-4f;
+    float const PI_2_3 = 7.54978995489188216e-8f;
+
+    float q = roundInt(x*TWO_OVER_PI);
+    float r = ((x - q*PI_2_1) - q*PI_2_2) - q*PI_2_3;
+    std::uint32_t quadrant = toBits32(q + ROUND_MAGIC_F);
+
+    float z = r*r;
+
+    float ps = 1.0f/362880.0f;
+    ps = ps*z - 1.0f/5040.0f;
+    ps = ps*z + 1.0f/120.0f;
+    ps = ps*z - 1.0f/6.0f;
+    float sr = r + r*z*ps;
+
+    float pc = -1.0f/3628800.0f;
+    pc = pc*z + 1.0f/40320.0f;
+    pc = pc*z - 1.0f/720.0f;
+    pc = pc*z + 1.0f/24.0f;
+    float cr = 1.0f - 0.5f*z + z*z*pc;
+
+    unfoldQuadrant(quadrant, sr, cr, s, c);
+}
+
+// natural logarithm for x >= 0
+BATCH_INLINE double logReal(double x)
+{
+    double const LN2_HI = 6.93147180369123816490e-01;
+    double const LN2_LO = 1.90821492927058770002e-10;
+    double const SQRT2 = 1.41421356237309504880;
+    double const TWO_52 = 4503599627370496.0;
+
+    // bring subnormals into the normal range
+    bool subnormal = x < 2.2250738585072014e-308;
+    double xs = subnormal ? x*18014398509481984.0 : x;  // 2^54
+
+    std::uint64_t u = toBits(xs);
+    double e = (fromBits((u >> 52) | 0x4330000000000000ull) - TWO_52) - 1023.0;
+    double m = fromBits((u & 0x000fffffffffffffull) | 0x3ff0000000000000ull);  // [1, 2)
+
+    bool high = m > SQRT2;
+    m = high ? 0.5*m : m;
+    e = high ? e + 1.0 : e;
+    e = subnormal ? e - 54.0 : e;
+
+    // log(m) = 2 atanh(f), |f| <= 0.1716
+    double f = (m - 1.0)/(m + 1.0);
+    double s = f*f;
+    double p = 1.0/23.0;
+    p = p*s + 1.0/21.0;
+    p = p*s + 1.0/19.0;
+    p = p*s + 1.0/17.0;
+    p = p*s + 1.0/15.0;
+    p = p*s + 1.0/13.0;
+    p = p*s + 1.0/11.0;
+    p = p*s + 1.0/9.0;
+    p = p*s + 1.0/7.0;
+    p = p*s + 1.0/5.0;
+    p = p*s + 1.0/3.0;
+    double lm = 2.0*f + 2.0*f*s*p;
+
+    double result = (e*LN2_HI + lm) + e*LN2_LO;
+
+    result = (x == 0.0) ? -INF : result;
+    result = (x == INF) ? INF : result;
+    return (x != x) ? x : result;
+}
+
+BATCH_INLINE float logReal(float x)
+{
+    float const LN2_HI = 0.693359375f;
+    float const LN2_LO = -2.12194440e-4f;
+    float const SQRT2 = 1.41421356f;
+    float const TWO_23 = 8388608.0f;
+
+    bool subnormal = x < 1.17549435e-38f;
+    float xs = subnormal ? x*33554432.0f : x;  // 2^25
+
+    std::uint32_t u = toBits32(xs);
+    float e = (fromBits32((u >> 23) | 0x4B000000u) - TWO_23) - 127.0f;
+    float m = fromBits32((u & 0x007fffffu) | 0x3f800000u);  // [1, 2)
+
+    bool high = m > SQRT2;
+    m = high ? 0.5f*m : m;
+    e = high ? e + 1.0f : e;
+    e = subnormal ? e - 25.0f : e;
+
+    float f = (m - 1.0f)/(m + 1.0f);
+    float s = f*f;
+    float p = 1.0f/11.0f;
+    p = p*s + 1.0f/9.0f;
+    p = p*s + 1.0f/7.0f;
+    p = p*s + 1.0f/5.0f;
+    p = p*s + 1.0f/3.0f;
+    float lm = 2.0f*f + 2.0f*f*s*p;
+
+    float result = (e*LN2_HI + lm) + e*LN2_LO;
+
+    float const inf = static_cast<float>(INF);
+    result = (x == 0.0f) ? -inf : result;
+    result = (x == inf) ? inf : result;
+    return (x != x) ? x : result;
+}
+
+// log|a| without overflow for huge or underflow for tiny arguments
+template <typename Real>
+BATCH_INLINE Real logAbs(Real re, Real im)
+{
+    Real ar = absolute(re);
+    Real ai = absolute(im);
+    Real hi = maximum(ar, ai);
+    Real lo = minimum(ar, ai);
+    Real t = (hi > Real(0)) ? lo/hi : Real(0);
+    Real result = logReal(hi) + Real(0.5)*logReal(Real(1) + t*t);
+    return (hi == Real(INF)) ? Real(INF) : result;
+}
+
+// atan2(y, x) from the angle a of min(|x|, |y|)/max(|x|, |y|)
+template <typename Real>
+BATCH_INLINE Real unfoldOctant(Real a, Real y, Real x, Real ay, Real ax)
+{
+    a = (ay > ax) ? Real(PI_2) - a : a;
+    a = (x < Real(0)) ? Real(PI) - a : a;
+    a = copySign(a, y);
+
+    return (x != x || y != y) ? x + y : a;
+}
+
+// atan2(y, x); Cephes rational approximation, below 2 ulp
+BATCH_INLINE double atan2Real(double y, double x)
+{
+    double const PI_4 = 0.78539816339744830962;
+    double const MOREBITS = 6.123233995736765886130e-17;
+
+    double ax = __builtin_fabs(x);
+    double ay = __builtin_fabs(y);
+    double hi = maximum(ax, ay);
+    double lo = minimum(ax, ay);
+    double t = (hi > 0.0) ? lo/hi : 0.0;  // [0, 1]
+
+    bool reduce = t > 0.66;
+    double tr = reduce ? (t - 1.0)/(t + 1.0) : t;
+    double offset = reduce ? PI_4 : 0.0;
+    double extra = reduce ? 0.5*MOREBITS : 0.0;
+
+    double z = tr*tr;
+    double p = -8.750608600031904122785e-01;
+    p = p*z - 1.615753718733365076637e+01;
+    p = p*z - 7.500855792314704667340e+01;
+    p = p*z - 1.228866684490136173410e+02;
+    p = p*z - 6.485021904942025371773e+01;
+    double q = z + 2.485846490142306297962e+01;
+    q = q*z + 1.650270098316988542046e+02;
+    q = q*z + 4.328810604912902668951e+02;
+    q = q*z + 4.853903996359136964868e+02;
+    q = q*z + 1.945506571482613964425e+02;
+    double a = offset + (tr + tr*(z*p/q) + extra);
+
+    return unfoldOctant(a, y, x, ay, ax);
+}
+
+// Cephes atanf polynomial, reduced to |t| <= tan(pi/8)
+BATCH_INLINE float atan2Real(float y, float x)
+{
+    float const PI_4 = 0.785398163f;
+    float const TAN_PI_8 = 0.414213562f;
+
+    float ax = __builtin_fabsf(x);
+    float ay = __builtin_fabsf(y);
+    float hi = maximum(ax, ay);
+    float lo = minimum(ax, ay);
+    float t = (hi > 0.0f) ? lo/hi : 0.0f;
+
+    bool reduce = t > TAN_PI_8;
+    float tr = reduce ? (t - 1.0f)/(t + 1.0f) : t;
+    float offset = reduce ? PI_4 : 0.0f;
+
+    float z = tr*tr;
+    float p = 8.05374449538e-2f;
+    p = p*z - 1.38776856032e-1f;
+    p = p*z + 1.99777106478e-1f;
+    p = p*z - 3.33329491539e-1f;
+    float a = offset + (tr + tr*z*p);
+
+    return unfoldOctant(a, y, x, ay, ax);
+}
+
+template <typename Real>
+BATCH_INLINE void store(Real re, Real im, Real * dr, Real * di, std::size_t k)
+{
+    bool inf = (absolute(re) == Real(INF)) || (absolute(im) == Real(INF));
+    dr[k] = inf ? Real(INF) : re;
+    di[k] = inf ? copySign(Real(0), im) : im;
+}
+
+template <typename Real>
+BATCH_INLINE void divide(Real ar, Real ai, Real br, Real bi, Real & re, Real & im)
+{
+    // Smith's algorithm, both branches computed and blended
+    bool byReal = absolute(br) >= absolute(bi);
+    Real big = byReal ? br : bi;
+    Real small = byReal ? bi : br;
+    Real ratio = small/big;
+    Real den = big + small*ratio;
+    Real nr = byReal ? ar + ai*ratio : ar*ratio + ai;
+    Real ni = byReal ? ai - ar*ratio : ai*ratio - ar;
+    re = nr/den;
+    im = ni/den;
+
+    // division by zero gives infinity (or NaN for 0/0)
+    bool zero = (br == Real(0)) && (bi == Real(0));
+    Real inf = copySign(Real(INF), br);
+    re = zero ? inf*ar : re;
+    im = zero ? inf*ai : im;
+}
+
+template <typename Real>
+BATCH_INLINE void expComplex(Real ar, Real ai, Real & re, Real & im)
+{
+    Real e = expReal(ar);
+    Real s, c;
+    sinCos(ai, s, c);
+    re = e*c;
+    im = (ai == Real(0)) ? ai : e*s;
+}
+
+// sin(x) and cos(x) of any x by the C library, one lane at a time
+inline void sinCosLibrary(double x, double & s, double & c)
+{
+    s = __builtin_sin(x);
+    c = __builtin_cos(x);
+}
+
+inline void sinCosLibrary(float x, float & s, float & c)
+{
+    s = __builtin_sinf(x);
+    c = __builtin_cosf(x);
+}
+
+// redoes the lanes of expComplex whose imaginary part sinCos cannot reduce,
+// from the exponents saved by the vector loop (the outputs may alias its
+// inputs); such lanes are rare, so they are kept out of the vector loop
+template <typename Real>
+void expLibrary(Real const * wr, Real const * wi, Real * dr, Real * di)
+{
+    for (std::size_t k = 0; k < BATCH_SIZE; ++k)
+    {
+        if (sinCosReduces(wi[k]))
+            continue;
+        Real e = expReal(wr[k]);
+        Real s, c;
+        sinCosLibrary(wi[k], s, c);
+        store(e*c, e*s, dr, di, k);
+    }
+}
+
+template <typename Real>
+void kernelProj(Real const * ar, Real const * ai, Real * dr, Real * di)
+{
+    BATCH_LOOP
+        store(ar[k], ai[k], dr, di, k);
+}
+
+template <typename Real>
+void kernelNeg(Real const * ar, Real const * ai, Real * dr, Real * di)
+{
+    BATCH_LOOP
+        store(-ar[k], -ai[k], dr, di, k);
+}
+
+template <typename Real>
+void kernelExp(Real const * ar, Real const * ai, Real * dr, Real * di)
+{
+    Real wr[BATCH_SIZE], wi[BATCH_SIZE];
+
+    BATCH_LOOP
+    {
+        Real re, im;
+        wr[k] = ar[k];
+        wi[k] = ai[k];
+        expComplex(ar[k], ai[k], re, im);
+        store(re, im, dr, di, k);
+    }
+    expLibrary(wr, wi, dr, di);
+}
+
+template <typename Real>
+void kernelAdd(Real const * ar, Real const * ai, Real const * br, Real const * bi, Real * dr, Real * di)
+{
+    BATCH_LOOP
+        store(ar[k] + br[k], ai[k] + bi[k], dr, di, k);
+}
+
+template <typename Real>
+void kernelSub(Real const * ar, Real const * ai, Real const * br, Real const * bi, Real * dr, Real * di)
+{
+    BATCH_LOOP
+        store(ar[k] - br[k], ai[k] - bi[k], dr, di, k);
+}
+
+template <typename Real>
+void kernelMul(Real const * ar, Real const * ai, Real const * br, Real const * bi, Real * dr, Real * di)
+{
+    BATCH_LOOP
+        store(ar[k]*br[k] - ai[k]*bi[k], ar[k]*bi[k] + ai[k]*br[k], dr, di, k);
+}
+
+template <typename Real>
+void kernelDiv(Real const * ar, Real const * ai, Real const * br, Real const * bi, Real * dr, Real * di)
+{
+    BATCH_LOOP
+    {
+        Real re, im;
+        divide(ar[k], ai[k], br[k], bi[k], re, im);
+        store(re, im, dr, di, k);
+    }
+}
+
+template <typename Real>
+void kernelPow(Real const * ar, Real const * ai, Real const * br, Real const * bi, Real * dr, Real * di)
+{
+    Real wr[BATCH_SIZE], wi[BATCH_SIZE];
+
+    BATCH_LOOP
+    {
+        // a^b = exp(b log(a)), with the limits of powComplex at b = 0 and a = 0
+        Real lr = logAbs(ar[k], ai[k]);
+        Real li = atan2Real(ai[k], ar[k]);
+        Real xr = br[k]*lr - bi[k]*li;
+        Real xi = br[k]*li + bi[k]*lr;
+        Real re, im;
+        expComplex(xr, xi, re, im);
+        bool one = (br[k] == Real(0)) && (bi[k] == Real(0));
+        bool zero = (ar[k] == Real(0)) && (ai[k] == Real(0));
+        Real zeroPower = (br[k] > Real(0)) ? Real(0) : (br[k] < Real(0)) ? Real(INF) : Real(NOT_A_NUMBER);
+        re = zero ? zeroPower : re;
+        im = zero ? Real(0) : im;
+        store(one ? Real(1) : re, one ? Real(0) : im, dr, di, k);
+
+        // the limits are exact, so their lanes are never redone
+        wr[k] = xr;
+        wi[k] = (one || zero) ? Real(0) : xi;
+    }
+    expLibrary(wr, wi, dr, di);
+}
+
+template <typename Real>
+void kernelPowi(Real const * ar, Real const * ai, int n, Real * dr, Real * di)
+{
+    // binary exponentiation; the exponent is shared by all lanes so the
+    // control flow stays scalar
+    Real rr[BATCH_SIZE], ri[BATCH_SIZE];
+    Real xr[BATCH_SIZE], xi[BATCH_SIZE];
+
+    BATCH_LOOP
+    {
+        rr[k] = Real(1);
+        ri[k] = Real(0);
+        xr[k] = ar[k];
+        xi[k] = ai[k];
+    }
+
+    // the first factor is copied rather than multiplied into 1, which would
+    // turn an overflowed factor into NaN
+    unsigned m = (n < 0) ? 0u - static_cast<unsigned>(n) : static_cast<unsigned>(n);
+    bool first = true;
+    while (m != 0)
+    {
+        if ((m & 1) && first)
+        {
+            BATCH_LOOP
+            {
+                rr[k] = xr[k];
+                ri[k] = xi[k];
+            }
+            first = false;
+        }
+        else if (m & 1)
+        {
+            BATCH_LOOP
+            {
+                Real re = rr[k]*xr[k] - ri[k]*xi[k];
+                Real im = rr[k]*xi[k] + ri[k]*xr[k];
+                rr[k] = re;
+                ri[k] = im;
+            }
+        }
+        m >>= 1;
+        if (m != 0)
+        {
+            BATCH_LOOP
+            {
+                Real re = xr[k]*xr[k] - xi[k]*xi[k];
+                Real im = Real(2)*xr[k]*xi[k];
+                xr[k] = re;
+                xi[k] = im;
+            }
+        }
+    }
+
+    if (n < 0)
+    {
+        BATCH_LOOP
+        {
+            Real re, im;
+            divide(Real(1), Real(0), rr[k], ri[k], re, im);
+            store(re, im, dr, di, k);
+        }
+    }
+    else
+    {
+        BATCH_LOOP
+            store(rr[k], ri[k], dr, di, k);
+    }
+}
+
+template <typename Real>
+void kernelPowr(Real const * ar, Real const * ai, Real x, Real * dr, Real * di)
+{
+    Real const zeroPower = (x > Real(0)) ? Real(0) : Real(INF);
+
+    Real wr[BATCH_SIZE], wi[BATCH_SIZE];
+
+    BATCH_LOOP
+    {
+        // polar form: |a|^x (cos(x arg a) + i sin(x arg a))
+        Real lr = logAbs(ar[k], ai[k]);
+        Real li = atan2Real(ai[k], ar[k]);
+        Real re, im;
+        expComplex(x*lr, x*li, re, im);
+        bool zero = (ar[k] == Real(0)) && (ai[k] == Real(0));
+        store(zero ? zeroPower : re, zero ? Real(0) : im, dr, di, k);
+        wr[k] = x*lr;
+        wi[k] = zero ? Real(0) : x*li;
+    }
+    expLibrary(wr, wi, dr, di);
+}
+
+/*
+ *  Double-double arithmetic of the extended kernels: a lane is hi + lo with
+ *  |lo| <= ulp(hi)/2, about 106 significant bits over the exponent range of
+ *  double (Dekker; Hida, Li and Bailey). Written branch-free like the rest.
+ */
+struct DoubleDouble
+{
+    double hi;
+    double lo;
+};
+
+// beyond these the extended exp and sin/cos leave the result to the double kernels
+double const EXTENDED_EXP_MAX = 700.0;
+double const EXTENDED_TRIGONOMETRIC_MAX = 1e9;
+
+BATCH_INLINE bool isFinite(double x)
+{
+    return absolute(x) < INF;
+}
+
+BATCH_INLINE DoubleDouble load(double const * a, std::size_t k)
+{
+    return {a[k], a[k + BATCH_SIZE]};
+}
+
+BATCH_INLINE void put(DoubleDouble x, double * a, std::size_t k)
+{
+    a[k] = x.hi;
+    a[k + BATCH_SIZE] = x.lo;
+}
+
+BATCH_INLINE DoubleDouble select(bool condition, DoubleDouble a, DoubleDouble b)
+{
+    return {condition ? a.hi : b.hi, condition ? a.lo : b.lo};
+}
+
+// a + b exactly
+BATCH_INLINE DoubleDouble twoSum(double a, double b)
+{
+    double s = a + b;
+    double v = s - a;
+    return {s, (a - (s - v)) + (b - v)};
+}
+
+// a + b exactly for |a| >= |b|
+BATCH_INLINE DoubleDouble quickTwoSum(double a, double b)
+{
+    double s = a + b;
+    return {s, b - (s - a)};
+}
+
+// a*b exactly barring underflow; by Dekker's splitting where fma is no single instruction
+BATCH_INLINE DoubleDouble twoProduct(double a, double b)
+{
+    double p = a*b;
+#ifdef __FP_FAST_FMA
+    return {p, __builtin_fma(a, b, -p)};
+#else
+    double const SPLIT = 134217729.0;  // 2^27 + 1
+    double ta = SPLIT*a;
+    double tb = SPLIT*b;
+    double ah = ta - (ta - a);
+    double bh = tb - (tb - b);
+    double al = a - ah;
+    double bl = b - bh;
+    return {p, ((ah*bh - p) + ah*bl + al*bh) + al*bl};
+#endif
+}
+
+BATCH_INLINE DoubleDouble operator-(DoubleDouble a)
+{
+    return {-a.hi, -a.lo};
+}
+
+// accurate under cancellation, which the deep zooms are all about
+BATCH_INLINE DoubleDouble operator+(DoubleDouble a, DoubleDouble b)
+{
+    DoubleDouble s = twoSum(a.hi, b.hi);
+    DoubleDouble t = twoSum(a.lo, b.lo);
+    s = quickTwoSum(s.hi, s.lo + t.hi);
+    return quickTwoSum(s.hi, s.lo + t.lo);
+}
+
+BATCH_INLINE DoubleDouble operator+(DoubleDouble a, double b)
+{
+    DoubleDouble s = twoSum(a.hi, b);
+    return quickTwoSum(s.hi, s.lo + a.lo);
+}
+
+BATCH_INLINE DoubleDouble operator-(DoubleDouble a, DoubleDouble b)
+{
+    return a + -b;
+}
+
+BATCH_INLINE DoubleDouble operator*(DoubleDouble a, DoubleDouble b)
+{
+    DoubleDouble p = twoProduct(a.hi, b.hi);
+    return quickTwoSum(p.hi, p.lo + (a.hi*b.lo + a.lo*b.hi));
+}
+
+BATCH_INLINE DoubleDouble operator*(DoubleDouble a, double b)
+{
+    DoubleDouble p = twoProduct(a.hi, b);
+    return quickTwoSum(p.hi, p.lo + a.lo*b);
+}
+
+// long division by three double quotients
+BATCH_INLINE DoubleDouble operator/(DoubleDouble a, DoubleDouble b)
+{
+    double q1 = a.hi/b.hi;
+    DoubleDouble r = a - b*q1;
+    double q2 = r.hi/b.hi;
+    r = r - b*q2;
+    double q3 = r.hi/b.hi;
+    return quickTwoSum(q1, q2) + q3;
+}
+
+// a*2^n for the power of two s = 2^n, exact
+BATCH_INLINE DoubleDouble scale(DoubleDouble a, double s)
+{
+    return {a.hi*s, a.lo*s};
+}
+
+// e^x for |x| <= EXTENDED_EXP_MAX: r = x - n ln 2 is scaled down by 2^10, the
+// Taylor polynomial of e^r - 1 evaluated and squared back up as
+// e^(2r) - 1 = (e^r - 1)(e^r + 1), which keeps its relative error
+BATCH_INLINE DoubleDouble expExtended(DoubleDouble x)
+{
+    double const LOG2E = 1.44269504088896340736;
+    DoubleDouble const LN2{6.93147180559945286e-01, 2.31904681384629956e-17};
+
+    double n = roundInt(minimum(maximum(x.hi, -EXTENDED_EXP_MAX), EXTENDED_EXP_MAX)*LOG2E);
+    DoubleDouble r = scale(x - LN2*n, 1.0/1024.0);  // |r| <= 3.4e-4
+
+    // degree 9, truncation error below 1e-37
+    DoubleDouble p{2.75573192239858925e-06, -1.85839327404647208e-22};
+    p = p*r + DoubleDouble{2.48015873015873016e-05, 2.15119478667758816e-23};
+    p = p*r + DoubleDouble{1.98412698412698413e-04, 1.72095582934207053e-22};
+    p = p*r + DoubleDouble{1.38888888888888894e-03, -5.30054395437357706e-20};
+    p = p*r + DoubleDouble{8.33333333333333322e-03, 1.15648231731787138e-19};
+    p = p*r + DoubleDouble{4.16666666666666644e-02, 2.31296463463574266e-18};
+    p = p*r + DoubleDouble{1.66666666666666657e-01, 9.25185853854297066e-18};
+    p = p*r + 0.5;
+    p = p*r + 1.0;
+    p = p*r;
+
+    for (int k = 0; k < 10; ++k)
+        p = p*(p + 2.0);
+
+    return scale(p + 1.0, pow2(n));
+}
+
+// sin(x) and cos(x) for |x| <= EXTENDED_TRIGONOMETRIC_MAX: reduced by pi/2
+// given to 159 bits, Taylor polynomials of degree 29 and 28 on [-pi/4, pi/4]
+BATCH_INLINE void sinCosExtended(DoubleDouble x, DoubleDouble & s, DoubleDouble & c)
+{
+    double const TWO_OVER_PI = 0.63661977236758134308;
+    DoubleDouble const PI_2{1.57079632679489656e+00, 6.12323399573676604e-17};
+    double const PI_2_3 = -1.49738490485916983e-33;
+
+    double xc = minimum(maximum(x.hi, -EXTENDED_TRIGONOMETRIC_MAX), EXTENDED_TRIGONOMETRIC_MAX);
+    double q = roundInt(xc*TWO_OVER_PI);
+    DoubleDouble r = (x - twoProduct(q, PI_2.hi)) - twoProduct(q, PI_2.lo);
+    r = r + -q*PI_2_3;
+    std::uint64_t quadrant = toBits(q + ROUND_MAGIC);
+
+    DoubleDouble z = r*r;
+
+    DoubleDouble ps{1.13099628864477159e-31, 1.04980154129595060e-47};
+    ps = ps*z + DoubleDouble{-9.18368986379554601e-29, -1.43031503967873220e-45};
+    ps = ps*z + DoubleDouble{6.44695028438447359e-26, -1.93304042337034648e-42};
+    ps = ps*z + DoubleDouble{-3.86817017063068413e-23, 8.84317765548234385e-40};
+    ps = ps*z + DoubleDouble{1.95729410633912626e-20, -1.36435038300879085e-36};
+    ps = ps*z + DoubleDouble{-8.22063524662432950e-18, -2.21418941196042654e-34};
+    ps = ps*z + DoubleDouble{2.81145725434552060e-15, 1.65088427308614326e-31};
+    ps = ps*z + DoubleDouble{-7.64716373181981641e-13, -7.03872877733453001e-30};
+    ps = ps*z + DoubleDouble{1.60590438368216133e-10, 1.25852945887520981e-26};
+    ps = ps*z + DoubleDouble{-2.50521083854417202e-08, 1.44881407093591197e-24};
+    ps = ps*z + DoubleDouble{2.75573192239858925e-06, -1.85839327404647208e-22};
+    ps = ps*z + DoubleDouble{-1.98412698412698413e-04, -1.72095582934207053e-22};
+    ps = ps*z + DoubleDouble{8.33333333333333322e-03, 1.15648231731787138e-19};
+    ps = ps*z + DoubleDouble{-1.66666666666666657e-01, -9.25185853854297066e-18};
+    ps = ps*z + 1.0;
+    DoubleDouble sr = r*ps;
+
+    DoubleDouble pc{3.27988923706983776e-30, 1.51175427440298787e-46};
+    pc = pc*z + DoubleDouble{-2.47959626322479759e-27, 1.29537309647652288e-43};
+    pc = pc*z + DoubleDouble{1.61173757109611839e-24, -3.68465735645097660e-41};
+    pc = pc*z + DoubleDouble{-8.89679139245057408e-22, 7.91140261487237622e-38};
+    pc = pc*z + DoubleDouble{4.11031762331216484e-19, 1.44129733786595271e-36};
+    pc = pc*z + DoubleDouble{-1.56192069685862253e-16, -1.19106796602737540e-32};
+    pc = pc*z + DoubleDouble{4.77947733238738525e-14, 4.39920548583408126e-31};
+    pc = pc*z + DoubleDouble{-1.14707455977297245e-11, -2.06555127528307454e-28};
+    pc = pc*z + DoubleDouble{2.08767569878681002e-09, -1.20734505911325997e-25};
+    pc = pc*z + DoubleDouble{-2.75573192239858883e-07, -2.37677146222502973e-23};
+    pc = pc*z + DoubleDouble{2.48015873015873016e-05, 2.15119478667758816e-23};
+    pc = pc*z + DoubleDouble{-1.38888888888888894e-03, 5.30054395437357706e-20};
+    pc = pc*z + DoubleDouble{4.16666666666666644e-02, 2.31296463463574266e-18};
+    pc = pc*z + -0.5;
+    DoubleDouble cr = pc*z + 1.0;
+
+    // as unfoldQuadrant
+    bool swap = (quadrant & 1) != 0;
+    bool negS = (quadrant & 2) != 0;
+    bool negC = ((quadrant + 1) & 2) != 0;
+
+    DoubleDouble ss = select(swap, cr, sr);
+    DoubleDouble cc = select(swap, sr, cr);
+    s = select(negS, -ss, ss);
+    c = select(negC, -cc, cc);
+}
+
+// log x for x in [1, 8): one Newton step y + x e^-y - 1 from the double logarithm y
+BATCH_INLINE DoubleDouble logExtended(DoubleDouble x)
+{
+    double y = logReal(x.hi);
+    return (x*expExtended(DoubleDouble{-y, 0.0}) + -1.0) + y;
+}
+
+// log|a| for max(|re|, |im|) in [1e-300, 1e300], else valid is false:
+// a is scaled by a power of two so that |a|^2 lies in [1, 8)
+BATCH_INLINE DoubleDouble logAbsExtended(DoubleDouble re, DoubleDouble im, bool & valid)
+{
+    double const TWO_52 = 4503599627370496.0;
+    DoubleDouble const LN2{6.93147180559945286e-01, 2.31904681384629956e-17};
+
+    double m = maximum(absolute(re.hi), absolute(im.hi));
+    valid = (m >= 1e-300) && (m <= 1e300);
+    m = valid ? m : 1.0;
+
+    double e = (fromBits((toBits(m) >> 52) | 0x4330000000000000ull) - TWO_52) - 1023.0;
+    double s = pow2(-e);
+    DoubleDouble a = scale(re, s);
+    DoubleDouble b = scale(im, s);
+
+    return scale(logExtended(a*a + b*b), 0.5) + LN2*e;
+}
+
+// arg a, one Newton step from the double angle t: the rest of the angle is
+// the arctangent of (im cos t - re sin t)/(re cos t + im sin t), as small as
+// the rounding error of t, so the arctangent is the quotient itself
+BATCH_INLINE DoubleDouble argExtended(DoubleDouble re, DoubleDouble im)
+{
+    double t = atan2Real(im.hi, re.hi);
+    DoubleDouble s, c;
+    sinCosExtended(DoubleDouble{t, 0.0}, s, c);
+    DoubleDouble num = im*c - re*s;
+    double den = re.hi*c.hi + im.hi*s.hi;
+    return DoubleDouble{t, 0.0} + num.hi/den;
+}
+
+BATCH_INLINE void multiplyExtended(DoubleDouble ar, DoubleDouble ai, DoubleDouble br, DoubleDouble bi,
+                                   DoubleDouble & re, DoubleDouble & im)
+{
+    re = ar*br - ai*bi;
+    im = ar*bi + ai*br;
+}
+
+// Smith's algorithm as divide, with the operands swapped instead of both branches computed
+BATCH_INLINE void divideExtended(DoubleDouble ar, DoubleDouble ai, DoubleDouble br, DoubleDouble bi,
+                                 DoubleDouble & re, DoubleDouble & im)
+{
+    bool byReal = absolute(br.hi) >= absolute(bi.hi);
+    DoubleDouble big = select(byReal, br, bi);
+    DoubleDouble small = select(byReal, bi, br);
+    DoubleDouble u = select(byReal, ar, ai);
+    DoubleDouble v = select(byReal, ai, ar);
+
+    DoubleDouble ratio = small/big;
+    DoubleDouble inverse = DoubleDouble{1.0, 0.0}/(big + small*ratio);
+    DoubleDouble ni = (v - u*ratio)*inverse;
+    re = (u + v*ratio)*inverse;
+    im = select(byReal, ni, -ni);
+}
+
+BATCH_INLINE void expComplexExtended(DoubleDouble ar, DoubleDouble ai, DoubleDouble & re, DoubleDouble & im,
+                                     bool & valid)
+{
+    valid = (absolute(ar.hi) <= EXTENDED_EXP_MAX) && (absolute(ai.hi) <= EXTENDED_TRIGONOMETRIC_MAX);
+    DoubleDouble e = expExtended(ar);
+    DoubleDouble s, c;
+    sinCosExtended(ai, s, c);
+    re = e*c;
+    im = select(ai.hi == 0.0, ai, e*s);
+}
+
+// a^b = exp(b log a), without the special cases
+BATCH_INLINE void powExtended(DoubleDouble ar, DoubleDouble ai, DoubleDouble br, DoubleDouble bi,
+                              DoubleDouble & re, DoubleDouble & im, bool & valid)
+{
+    bool finiteLog;
+    DoubleDouble lr = logAbsExtended(ar, ai, finiteLog);
+    DoubleDouble li = argExtended(ar, ai);
+    DoubleDouble wr, wi;
+    multiplyExtended(br, bi, lr, li, wr, wi);
+    expComplexExtended(wr, wi, re, im, valid);
+    valid = valid && finiteLog;
+}
+
+/*
+ *  Stores lane k of an extended result. Where it is not finite, or outside
+ *  the range of its operation (valid false), the result (fr, fi) of the
+ *  double kernel on the high parts is stored instead, so that zeros of
+ *  pow, poles, infinities and NaN come out exactly as in double precision.
+ */
+BATCH_INLINE void storeExtended(DoubleDouble re, DoubleDouble im, bool valid, double fr, double fi,
+                                double * dr, double * di, std::size_t k)
+{
+    bool exact = valid && isFinite(re.hi) && isFinite(re.lo) && isFinite(im.hi) && isFinite(im.lo);
+    put(select(exact, re, DoubleDouble{fr, 0.0}), dr, k);
+    put(select(exact, im, DoubleDouble{fi, 0.0}), di, k);
+}
+
+void kernelProjExtended(double const * ar, double const * ai, double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelProj<double>(ar, ai, fr, fi);
+
+    BATCH_LOOP
+        storeExtended(load(ar, k), load(ai, k), true, fr[k], fi[k], dr, di, k);
+}
+
+void kernelNegExtended(double const * ar, double const * ai, double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelNeg<double>(ar, ai, fr, fi);
+
+    BATCH_LOOP
+        storeExtended(-load(ar, k), -load(ai, k), true, fr[k], fi[k], dr, di, k);
+}
+
+void kernelExpExtended(double const * ar, double const * ai, double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelExp<double>(ar, ai, fr, fi);
+
+    BATCH_LOOP
+    {
+        DoubleDouble re, im;
+        bool valid;
+        expComplexExtended(load(ar, k), load(ai, k), re, im, valid);
+        storeExtended(re, im, valid, fr[k], fi[k], dr, di, k);
+    }
+}
+
+void kernelAddExtended(double const * ar, double const * ai, double const * br, double const * bi,
+                       double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelAdd<double>(ar, ai, br, bi, fr, fi);
+
+    BATCH_LOOP
+        storeExtended(load(ar, k) + load(br, k), load(ai, k) + load(bi, k), true, fr[k], fi[k], dr, di, k);
+}
+
+void kernelSubExtended(double const * ar, double const * ai, double const * br, double const * bi,
+                       double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelSub<double>(ar, ai, br, bi, fr, fi);
+
+    BATCH_LOOP
+        storeExtended(load(ar, k) - load(br, k), load(ai, k) - load(bi, k), true, fr[k], fi[k], dr, di, k);
+}
+
+void kernelMulExtended(double const * ar, double const * ai, double const * br, double const * bi,
+                       double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelMul<double>(ar, ai, br, bi, fr, fi);
+
+    BATCH_LOOP
+    {
+        DoubleDouble re, im;
+        multiplyExtended(load(ar, k), load(ai, k), load(br, k), load(bi, k), re, im);
+        storeExtended(re, im, true, fr[k], fi[k], dr, di, k);
+    }
+}
+
+void kernelDivExtended(double const * ar, double const * ai, double const * br, double const * bi,
+                       double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelDiv<double>(ar, ai, br, bi, fr, fi);
+
+    BATCH_LOOP
+    {
+        DoubleDouble re, im;
+        divideExtended(load(ar, k), load(ai, k), load(br, k), load(bi, k), re, im);
+        storeExtended(re, im, true, fr[k], fi[k], dr, di, k);
+    }
+}
+
+void kernelPowExtended(double const * ar, double const * ai, double const * br, double const * bi,
+                       double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelPow<double>(ar, ai, br, bi, fr, fi);
+
+    BATCH_LOOP
+    {
+        DoubleDouble re, im;
+        bool valid;
+        powExtended(load(ar, k), load(ai, k), load(br, k), load(bi, k), re, im, valid);
+        storeExtended(re, im, valid, fr[k], fi[k], dr, di, k);
+    }
+}
+
+void kernelPowiExtended(double const * ar, double const * ai, int n, double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelPowi<double>(ar, ai, n, fr, fi);
+
+    // binary exponentiation as in kernelPowi
+    double rr[2*BATCH_SIZE], ri[2*BATCH_SIZE];
+    double xr[2*BATCH_SIZE], xi[2*BATCH_SIZE];
+
+    BATCH_LOOP
+    {
+        put(load(ar, k), xr, k);
+        put(load(ai, k), xi, k);
+    }
+
+    unsigned m = (n < 0) ? 0u - static_cast<unsigned>(n) : static_cast<unsigned>(n);
+    bool first = true;
+    if (m == 0)
+    {
+        BATCH_LOOP
+        {
+            put(DoubleDouble{1.0, 0.0}, rr, k);
+            put(DoubleDouble{0.0, 0.0}, ri, k);
+        }
+    }
+    while (m != 0)
+    {
+        if ((m & 1) && first)
+        {
+            std::memcpy(rr, xr, sizeof(rr));
+            std::memcpy(ri, xi, sizeof(ri));
+            first = false;
+        }
+        else if (m & 1)
+        {
+            BATCH_LOOP
+            {
+                DoubleDouble re, im;
+                multiplyExtended(load(rr, k), load(ri, k), load(xr, k), load(xi, k), re, im);
+                put(re, rr, k);
+                put(im, ri, k);
+            }
+        }
+        m >>= 1;
+        if (m != 0)
+        {
+            BATCH_LOOP
+            {
+                DoubleDouble x = load(xr, k);
+                DoubleDouble y = load(xi, k);
+                put(x*x - y*y, xr, k);
+                put(scale(x*y, 2.0), xi, k);
+            }
+        }
+    }
+
+    BATCH_LOOP
+    {
+        DoubleDouble re = load(rr, k);
+        DoubleDouble im = load(ri, k);
+        if (n < 0)
+            divideExtended(DoubleDouble{1.0, 0.0}, DoubleDouble{0.0, 0.0}, load(rr, k), load(ri, k), re, im);
+        storeExtended(re, im, true, fr[k], fi[k], dr, di, k);
+    }
+}
+
+void kernelPowrExtended(double const * ar, double const * ai, double x, double * dr, double * di)
+{
+    double fr[BATCH_SIZE], fi[BATCH_SIZE];
+    kernelPowr<double>(ar, ai, x, fr, fi);
+
+    BATCH_LOOP
+    {
+        DoubleDouble re, im;
+        bool valid;
+        powExtended(load(ar, k), load(ai, k), DoubleDouble{x, 0.0}, DoubleDouble{0.0, 0.0}, re, im, valid);
+        storeExtended(re, im, valid, fr[k], fi[k], dr, di, k);
+    }
+}
+
+// hue-p-q to component intensity for x = h + offset in [3.0, 13.0), cf. hpq2c in coloring.cpp
+template <typename Real>
+BATCH_INLINE Real hpq2c(Real x, Real p, Real q)
+{
+    x = (x >= Real(6)) ? x - Real(6) : x;
+    x = (x >= Real(6)) ? x - Real(6) : x;
+    Real w = minimum(maximum(minimum(x, Real(4) - x), Real(0)), Real(1));
+    return p + (q - p)*w;
+}
+
+template <typename Real>
+BATCH_INLINE unsigned char quantize(Real c)
+{
+    return static_cast<unsigned char>(static_cast<int>(c*Real(255.9)));
+}
+
+template <typename Real>
+BATCH_INLINE void storeRgb(Real const * cr, Real const * cg, Real const * cb, unsigned char * rgb)
+{
+    BATCH_LOOP
+    {
+        rgb[3*k + 0] = quantize(cr[k]);
+        rgb[3*k + 1] = quantize(cg[k]);
+        rgb[3*k + 2] = quantize(cb[k]);
+    }
+}
+
+template <typename Real>
+void kernelColorHL(Real const * re, Real const * im, double a, unsigned char * rgb)
+{
+    Real cr[BATCH_SIZE], cg[BATCH_SIZE], cb[BATCH_SIZE];
+    Real const slope = static_cast<Real>(a);
+
+    BATCH_LOOP
+    {
+        Real h = Real(M_3_PI)*atan2Real(im[k], re[k]);
+
+        // |z|^a = exp(a log|z|); 0*inf only happens for a = 0, and 0^0 = 1 as in std::pow
+        Real la = slope*logAbs(re[k], im[k]);
+        Real za = expReal((la == la) ? la : Real(0));
+        Real l = Real(2)/(za + Real(1));
+
+        Real q = minimum(l, Real(1));
+        Real p = l - q;
+
+        bool nan = (re[k] != re[k]) || (im[k] != im[k]);
+        cr[k] = nan ? Real(0.5) : hpq2c(h + Real( 8), p, q);
+        cg[k] = nan ? Real(0.5) : hpq2c(h + Real( 6), p, q);
+        cb[k] = nan ? Real(0.5) : hpq2c(h + Real(10), p, q);
+    }
+
+    storeRgb(cr, cg, cb, rgb);
+}
+
+void kernelPolar(double const * re, double const * im, float * arg, float * lz)
+{
+    BATCH_LOOP
+    {
+        // atan2Real is NaN exactly when re or im is
+        arg[k] = static_cast<float>(atan2Real(im[k], re[k]));
+        lz[k] = static_cast<float>(logAbs(re[k], im[k]));
+    }
+}
+
+void kernelColorPolarHL(float const * arg, float const * lz, double a, unsigned char * rgb)
+{
+    double cr[BATCH_SIZE], cg[BATCH_SIZE], cb[BATCH_SIZE];
+
+    BATCH_LOOP
+    {
+        // float(pi) is slightly above pi
+        double h = minimum(maximum(M_3_PI*arg[k], -3.0), 3.0);
+
+        // as in kernelColorHL, from the stored arg z and log|z|
+        double la = a*lz[k];
+        double za = expReal((la == la) ? la : 0.0);
+        double l = 2.0/(za + 1.0);
+
+        double q = minimum(l, 1.0);
+        double p = l - q;
+
+        bool nan = (arg[k] != arg[k]);
+        cr[k] = nan ? 0.5 : hpq2c(h +  8.0, p, q);
+        cg[k] = nan ? 0.5 : hpq2c(h +  6.0, p, q);
+        cb[k] = nan ? 0.5 : hpq2c(h + 10.0, p, q);
+    }
+
+    storeRgb(cr, cg, cb, rgb);
+}
+
+template <typename Real>
+constexpr void setComplexKernels(ComplexKernels<Real> & kernels)
+{
+    kernels.proj = &kernelProj<Real>;
+    kernels.neg = &kernelNeg<Real>;
+    kernels.exp = &kernelExp<Real>;
+    kernels.add = &kernelAdd<Real>;
+    kernels.sub = &kernelSub<Real>;
+    kernels.mul = &kernelMul<Real>;
+    kernels.div = &kernelDiv<Real>;
+    kernels.pow = &kernelPow<Real>;
+    kernels.powi = &kernelPowi<Real>;
+    kernels.powr = &kernelPowr<Real>;
+    kernels.colorHL = &kernelColorHL<Real>;
+}
+
+// the double-double kernels; colorHL colors the high parts
+constexpr void setExtendedKernels(ComplexKernels<double> & kernels)
+{
+    kernels.proj = &kernelProjExtended;
+    kernels.neg = &kernelNegExtended;
+    kernels.exp = &kernelExpExtended;
+    kernels.add = &kernelAddExtended;
+    kernels.sub = &kernelSubExtended;
+    kernels.mul = &kernelMulExtended;
+    kernels.div = &kernelDivExtended;
+    kernels.pow = &kernelPowExtended;
+    kernels.powi = &kernelPowiExtended;
+    kernels.powr = &kernelPowrExtended;
+    kernels.colorHL = &kernelColorHL<double>;
+}
+
+constexpr BatchKernels makeBatchKernels(char const * name)
+{
+    BatchKernels kernels{};
+    setComplexKernels<double>(kernels);
+    setComplexKernels<float>(kernels.single);
+    setExtendedKernels(kernels.extended);
+    kernels.name = name;
+    kernels.polar = &kernelPolar;
+    kernels.colorPolarHL = &kernelColorPolarHL;
+    return kernels;
+}
+
+} // namespace
@@ -1,6 +1,11 @@
+#include <algorithm>
 #include <cassert>
 #include <complex>
 #include <cmath>
+#include <cstring>
+
+#include "batch.hpp"
+#include "coloring.hpp"
 
 namespace {
 
@@ -59,11 +64,32 @@ inline double lightness_HL(std::complex<double> z, double a)
     return 2.0/(std::pow(std::abs(z), a) + 1.0);
 }
 
+template <typename Real>
+void colorBatches(ComplexKernels<Real> const & kernels, Real const * re, Real const * im, std::size_t n, double a,
+                  unsigned char * rgb)
+{
+    std::size_t offset = 0;
+    for (; offset + BATCH_SIZE <= n; offset += BATCH_SIZE)
+        kernels.colorHL(re + offset, im + offset, a, rgb + 3*offset);
+
+    if (offset == n)
+        return;
+
+    // pad the tail to a full batch
+    Real tailRe[BATCH_SIZE] = {}, tailIm[BATCH_SIZE] = {};
+    unsigned char tailRgb[3*BATCH_SIZE];
+    std::size_t count = n - offset;
+    std::copy(re + offset, re + n, tailRe);
+    std::copy(im + offset, im + n, tailIm);
+    kernels.colorHL(tailRe, tailIm, a, tailRgb);
+    std::memcpy(rgb + 3*offset, tailRgb, 3*count);
+}
+
 } // namespace
 
 void complex2rgb_HL(std::complex<double> z, double a, double & r, double & g, double & b)
 {
-    if (std::isnan(z.real()) || std::isnan(z.real()))
+    if (std::isnan(z.real()) || std::isnan(z.imag()))
     {
         r = g = b = 0.5;
         return;
@@ -71,3 +97,54 @@ void complex2rgb_HL(std::complex<double> z, double a, double & r, double & g, do
 
     hl2rgb(hue(z), lightness_HL(z, a), r, g, b);
 }
+
+void complex2rgb8_HL(double const * re, double const * im, std::size_t n, double a, unsigned char * rgb)
+{
+    colorBatches(batchKernels(), re, im, n, a, rgb);
+}
+
+void complex2rgb8_HL(float const * re, float const * im, std::size_t n, double a, unsigned char * rgb)
+{
+    colorBatches(batchKernels().single, re, im, n, a, rgb);
+}
+
+void complex2polar(double const * re, double const * im, std::size_t n, float * arg, float * lz)
+{
+    BatchKernels const & kernels = batchKernels();
+
+    std::size_t offset = 0;
+    for (; offset + BATCH_SIZE <= n; offset += BATCH_SIZE)
+        kernels.polar(re + offset, im + offset, arg + offset, lz + offset);
+
+    if (offset == n)
+        return;
+
+    double tailRe[BATCH_SIZE] = {}, tailIm[BATCH_SIZE] = {};
+    float tailArg[BATCH_SIZE], tailLz[BATCH_SIZE];
+    std::size_t count = n - offset;
+    std::copy(re + offset, re + n, tailRe);
+    std::copy(im + offset, im + n, tailIm);
+    kernels.polar(tailRe, tailIm, tailArg, tailLz);
+    std::copy(tailArg, tailArg + count, arg + offset);
+    std::copy(tailLz, tailLz + count, lz + offset);
+}
+
+void polar2rgb8_HL(float const * arg, float const * lz, std::size_t n, double a, unsigned char * rgb)
+{
+    BatchKernels const & kernels = batchKernels();
+
+    std::size_t offset = 0;
+    for (; offset + BATCH_SIZE <= n; offset += BATCH_SIZE)
+        kernels.colorPolarHL(arg + offset, lz + offset, a, rgb + 3*offset);
+
+    if (offset == n)
+        return;
+
+    float tailArg[BATCH_SIZE] = {}, tailLz[BATCH_SIZE] = {};
+    unsigned char tailRgb[3*BATCH_SIZE];
+    std::size_t count = n - offset;
+    std::copy(arg + offset, arg + n, tailArg);
+    std::copy(lz + offset, lz + n, tailLz);
+    kernels.colorPolarHL(tailArg, tailLz, a, tailRgb);
+    std::memcpy(rgb + 3*offset, tailRgb, 3*count);
+}
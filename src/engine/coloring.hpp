@@ -2,6 +2,7 @@
 #define COMPLEXPLOT_COLORING_HPP
 
 #include <complex>
+#include <cstddef>
 
 /*
  *  void complex2rgb_*(std::complex<double> z, double a, double & r, double & g, double & b)
@@ -13,4 +14,34 @@
 
 void complex2rgb_HL(std::complex<double>, double, double &, double &, double &);
 
+// one quantization step of the 8-bit components of complex2rgb8_HL, in [0.0, 1.0] units
+double const COLOR_STEP = 1.0/255.9;
+
+/*
+ *  void complex2rgb8_HL(double const * re, double const * im, std::size_t n, double a, unsigned char * rgb)
+ *  Vectorized complex2rgb_HL for n points given as split real and imaginary parts,
+ *  writing n packed 8-bit RGB triples to rgb.
+ *  The hue and lightness use polynomial atan2, log and exp approximations with
+ *  relative errors below 1e-15, so every component is within one quantization
+ *  step of the scalar result and equal to it unless the exact value lies
+ *  within ~1e-13 of a rounding boundary.
+ */
+
+void complex2rgb8_HL(double const *, double const *, std::size_t, double, unsigned char *);
+
+// the same for single precision values, within one quantization step of it
+void complex2rgb8_HL(float const *, float const *, std::size_t, double, unsigned char *);
+
+/*
+ *  void complex2polar(double const * re, double const * im, std::size_t n, float * arg, float * lz)
+ *  Splits complex2rgb8_HL in two for recoloring: complex2polar stores arg z and
+ *  log|z| of n points in single precision, which do not depend on the slope
+ *  (arg is NaN for NaN points), and
+ *  void polar2rgb8_HL(float const * arg, float const * lz, std::size_t n, double a, unsigned char * rgb)
+ *  colors them for slope a, within one quantization step of complex2rgb8_HL.
+ */
+
+void complex2polar(double const *, double const *, std::size_t, float *, float *);
+void polar2rgb8_HL(float const *, float const *, std::size_t, double, unsigned char *);
+
 #endif // COMPLEXPLOT_COLORING_HPP
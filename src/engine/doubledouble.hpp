@@ -0,0 +1,88 @@
+#ifndef COMPLEXPLOT_DOUBLEDOUBLE_HPP
+#define COMPLEXPLOT_DOUBLEDOUBLE_HPP
+
+#include <cmath>
+
+/*
+ *  Scalar double-double number hi + lo with |lo| <= ulp(hi)/2, about 106
+ *  significant bits, for the coordinates of Precision::EXTENDED. Only what
+ *  the coordinate mapping needs; the extended batch kernels have their own
+ *  (see batch_impl.hpp).
+ */
+struct DoubleDouble
+{
+    double hi = 0.0;
+    double lo = 0.0;
+
+    DoubleDouble() = default;
+    DoubleDouble(double x) : hi(x) {}
+    DoubleDouble(double hi, double lo) : hi(hi), lo(lo) {}
+
+    // a + b and a - b exactly
+    static DoubleDouble sum(double a, double b);
+    static DoubleDouble difference(double a, double b) { return sum(a, -b); }
+
+    // a*b exactly, barring underflow
+    static DoubleDouble product(double a, double b);
+};
+
+inline DoubleDouble DoubleDouble::sum(double a, double b)
+{
+    double s = a + b;
+    double v = s - a;
+    return {s, (a - (s - v)) + (b - v)};
+}
+
+inline DoubleDouble DoubleDouble::product(double a, double b)
+{
+    double p = a*b;
+#ifdef FP_FAST_FMA
+    return {p, std::fma(a, b, -p)};
+#else
+    // Dekker's splitting, where fma would be a slow library call
+    double const SPLIT = 134217729.0;  // 2^27 + 1
+    double ta = SPLIT*a;
+    double tb = SPLIT*b;
+    double ah = ta - (ta - a);
+    double bh = tb - (tb - b);
+    double al = a - ah;
+    double bl = b - bh;
+    return {p, ((ah*bh - p) + ah*bl + al*bh) + al*bl};
+#endif
+}
+
+// hi + lo renormalized for |hi| >= |lo|
+inline DoubleDouble renormalized(double hi, double lo)
+{
+    double s = hi + lo;
+    return {s, lo - (s - hi)};
+}
+
+inline DoubleDouble operator+(DoubleDouble const & a, DoubleDouble const & b)
+{
+    DoubleDouble s = DoubleDouble::sum(a.hi, b.hi);
+    DoubleDouble t = DoubleDouble::sum(a.lo, b.lo);
+    s = renormalized(s.hi, s.lo + t.hi);
+    return renormalized(s.hi, s.lo + t.lo);
+}
+
+inline DoubleDouble operator-(DoubleDouble const & a, DoubleDouble const & b)
+{
+    return a + DoubleDouble(-b.hi, -b.lo);
+}
+
+inline DoubleDouble operator*(DoubleDouble const & a, double b)
+{
+    DoubleDouble p = DoubleDouble::product(a.hi, b);
+    return renormalized(p.hi, p.lo + a.lo*b);
+}
+
+inline DoubleDouble operator/(DoubleDouble const & a, double b)
+{
+    double q1 = a.hi/b;
+    DoubleDouble r = a - DoubleDouble::product(q1, b);
+    double q2 = r.hi/b;
+    return renormalized(q1, q2);
+}
+
+#endif // COMPLEXPLOT_DOUBLEDOUBLE_HPP
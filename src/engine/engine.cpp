@@ -0,0 +1,1103 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <numeric>
+
+#include "coloring.hpp"
+#include "engine.hpp"
+#include "interval.hpp"
+
+namespace {
+
+// the low parts of the double-double arguments of a batch, kept only if f
+// evaluates in Precision::EXTENDED
+struct LowParts
+{
+    std::vector<double> re;
+    std::vector<double> im;
+
+    LowParts(Function const & f, std::size_t size)
+    {
+        if (f.precision() == Precision::EXTENDED)
+        {
+            re.resize(size);
+            im.resize(size);
+        }
+    }
+
+    bool empty() const { return re.empty(); }
+    double const * reData() const { return empty() ? nullptr : re.data(); }
+    double const * imData() const { return empty() ? nullptr : im.data(); }
+};
+
+// maps pixel (i, j) into lane k of re, im and, if kept, of low
+template <typename Real>
+void mapPixel(PlotData const & plotData, int i, int j, Real * re, Real * im, LowParts & low, std::size_t k)
+{
+    // the mapping is always done in double precision at least
+    double x, y;
+    if (low.empty())
+        plotData.image2complex(i, j, x, y);
+    else
+        plotData.image2complex(i, j, x, y, low.re[k], low.im[k]);
+    re[k] = static_cast<Real>(x);
+    im[k] = static_cast<Real>(y);
+}
+
+// evalBatch of n lanes with the low parts of their arguments, if kept
+void evaluate(Function const & f, double const * re, double const * im, LowParts const & low,
+              double * outRe, double * outIm, std::size_t n, OperatorProfile * profile)
+{
+    f.evalBatch(re, im, low.reData(), low.imData(), outRe, outIm, n, profile);
+}
+
+void evaluate(Function const & f, float const * re, float const * im, LowParts const &,
+              float * outRe, float * outIm, std::size_t n, OperatorProfile * profile)
+{
+    f.evalBatch(re, im, outRe, outIm, n, profile);
+}
+
+// renders one pass of renderProgressive over a tile, evaluating and coloring in Real
+template <typename Real>
+void renderTile(Function const & f, PlotData const & plotData, ImageView const & image, ValueGrid * values,
+                Tile const & tile, int step, bool refine,
+                std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    using Clock = RenderStats::Clock;
+
+    Real re[TILE_SIZE], im[TILE_SIZE];
+    Real outRe[TILE_SIZE], outIm[TILE_SIZE];
+    unsigned char rgb[3*TILE_SIZE];
+    int columns[TILE_SIZE];
+    LowParts low(f, TILE_SIZE);
+
+    RenderStats::Slot & slot = stats.slot();
+
+    for (int j = tile.y0; j < tile.y1 && !cancellationToken; j += step)
+    {
+        auto row_start_time = Clock::now();
+
+        // compute complex arguments for the samples of the tile row
+        // not rendered by the previous pass
+        bool coarseRow = refine && (j % (2*step) == 0);
+        int n = 0;
+        for (int i = tile.x0; i < tile.x1; i += step)
+        {
+            if (coarseRow && i % (2*step) == 0)
+                continue;
+            mapPixel(plotData, i, j, re, im, low, n);
+            columns[n] = i;
+            ++n;
+        }
+
+        // compute values
+        evaluate(f, re, im, low, outRe, outIm, n, &slot.operators);
+        slot.countResults(outRe, outIm, n);
+
+        if (values != nullptr)
+        {
+            for (int k = 0; k < n; ++k)
+            {
+                values->re[values->index(columns[k], j)] = outRe[k];
+                values->im[values->index(columns[k], j)] = outIm[k];
+            }
+        }
+
+        auto row_computed_time = Clock::now();
+
+        // compute colors; a full resolution row goes straight into the image
+        unsigned char * row = image.scanLine(j);
+        if (step == 1 && !coarseRow)
+        {
+            complex2rgb8_HL(outRe, outIm, n, plotData.colorSlope, row + 3*tile.x0);
+        }
+        else
+        {
+            complex2rgb8_HL(outRe, outIm, n, plotData.colorSlope, rgb);
+
+            // fill each sample's block
+            int rows = std::min(step, tile.y1 - j);
+            for (int k = 0; k < n; ++k)
+            {
+                int cols = std::min(step, tile.x1 - columns[k]);
+                for (int r = 0; r < rows; ++r)
+                {
+                    unsigned char * pixel = image.scanLine(j + r) + 3*columns[k];
+                    for (int c = 0; c < cols; ++c, pixel += 3)
+                        std::memcpy(pixel, rgb + 3*k, 3);
+                }
+            }
+        }
+
+        auto row_colored_time = Clock::now();
+
+        slot.computing += row_computed_time - row_start_time;
+        slot.coloring += row_colored_time - row_computed_time;
+    }
+}
+
+// renderTile in the precision of f
+void renderTile(Function const & f, PlotData const & plotData, ImageView const & image, ValueGrid * values,
+                Tile const & tile, int step, bool refine,
+                std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    if (f.precision() == Precision::FLOAT)
+        renderTile<float>(f, plotData, image, values, tile, step, refine, cancellationToken, stats);
+    else
+        renderTile<double>(f, plotData, image, values, tile, step, refine, cancellationToken, stats);
+}
+
+// evaluates and colors the scattered pixels (xs[k], ys[k]) in batches of TILE_SIZE
+template <typename Real>
+void renderPixels(Function const & f, PlotData const & plotData, ImageView const & image,
+                  std::vector<int> const & xs, std::vector<int> const & ys, RenderStats::Slot & slot)
+{
+    using Clock = RenderStats::Clock;
+
+    Real re[TILE_SIZE], im[TILE_SIZE];
+    Real outRe[TILE_SIZE], outIm[TILE_SIZE];
+    unsigned char rgb[3*TILE_SIZE];
+    LowParts low(f, TILE_SIZE);
+
+    for (std::size_t offset = 0; offset < xs.size(); offset += TILE_SIZE)
+    {
+        auto start_time = Clock::now();
+
+        int const n = static_cast<int>(std::min<std::size_t>(TILE_SIZE, xs.size() - offset));
+        for (int k = 0; k < n; ++k)
+            mapPixel(plotData, xs[offset + k], ys[offset + k], re, im, low, k);
+        evaluate(f, re, im, low, outRe, outIm, n, &slot.operators);
+        slot.countResults(outRe, outIm, n);
+
+        auto computed_time = Clock::now();
+
+        complex2rgb8_HL(outRe, outIm, n, plotData.colorSlope, rgb);
+        for (int k = 0; k < n; ++k)
+            std::memcpy(image.scanLine(ys[offset + k]) + 3*xs[offset + k], rgb + 3*k, 3);
+
+        slot.computing += computed_time - start_time;
+        slot.coloring += Clock::now() - computed_time;
+    }
+}
+
+// fills a region of at least 2x2 pixels by bilinear interpolation of its corner pixels, already rendered
+void interpolateRegion(ImageView const & image, Tile const & tile)
+{
+    unsigned char const * c00 = image.scanLine(tile.y0) + 3*tile.x0;
+    unsigned char const * c10 = image.scanLine(tile.y0) + 3*(tile.x1 - 1);
+    unsigned char const * c01 = image.scanLine(tile.y1 - 1) + 3*tile.x0;
+    unsigned char const * c11 = image.scanLine(tile.y1 - 1) + 3*(tile.x1 - 1);
+
+    // copied first, as the corners are overwritten along with the other pixels
+    int corners[4][3];
+    for (int c = 0; c < 3; ++c)
+    {
+        corners[0][c] = c00[c];
+        corners[1][c] = c10[c];
+        corners[2][c] = c01[c];
+        corners[3][c] = c11[c];
+    }
+
+    float const du = 1.0f/(tile.x1 - tile.x0 - 1);
+    float const dv = 1.0f/(tile.y1 - tile.y0 - 1);
+    for (int j = tile.y0; j < tile.y1; ++j)
+    {
+        // interpolate down the left and right edges, then along the row
+        float v = (j - tile.y0)*dv;
+        float left[3], step[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            float l = corners[0][c] + v*(corners[2][c] - corners[0][c]);
+            float r = corners[1][c] + v*(corners[3][c] - corners[1][c]);
+            left[c] = l + 0.5f;
+            step[c] = (r - l)*du;
+        }
+
+        unsigned char * pixel = image.scanLine(j) + 3*tile.x0;
+        for (int i = 0; i < tile.x1 - tile.x0; ++i, pixel += 3)
+        {
+            pixel[0] = static_cast<unsigned char>(left[0] + i*step[0]);
+            pixel[1] = static_cast<unsigned char>(left[1] + i*step[1]);
+            pixel[2] = static_cast<unsigned char>(left[2] + i*step[2]);
+        }
+    }
+}
+
+// splits a region of renderRegions into smooth parts, to be interpolated, and parts to be evaluated pixel by pixel
+void classifyRegion(Function const & f, PlotData const & plotData, Tile const & tile,
+                    std::vector<Tile> & smooth, std::vector<Tile> & evaluated)
+{
+    int const width = tile.x1 - tile.x0;
+    int const height = tile.y1 - tile.y0;
+
+    // factor by which the bound still has to shrink for the region to pass
+    double shrink = std::numeric_limits<double>::infinity();
+    bool bounded = false;
+    if (width >= 2 && height >= 2)
+    {
+        // pixel centres of the region, widened for the rounding of image2complex
+        double re0, im0, re1, im1;
+        plotData.image2complex(tile.x0, tile.y0, re0, im0);
+        plotData.image2complex(tile.x1 - 1, tile.y1 - 1, re1, im1);
+        double extent = std::max(std::max(std::abs(re0), std::abs(re1)), std::max(std::abs(im0), std::abs(im1)));
+        double widen = 4.0*std::numeric_limits<double>::epsilon()*extent;
+        ComplexInterval z{{std::min(re0, re1) - widen, std::max(re0, re1) + widen},
+                          {std::min(im0, im1) - widen, std::max(im0, im1) + widen}};
+
+        ComplexInterval w;
+        bounded = f.bound(z, w);
+        if (bounded && !w.containsZero())
+        {
+            double variation = colorVariation_HL(w, plotData.colorSlope);
+            if (variation < COLOR_STEP)
+            {
+                smooth.push_back(tile);
+                return;
+            }
+            shrink = variation/COLOR_STEP;
+        }
+        else if (bounded)
+        {
+            // around a zero the values must first move off 0: their spread relative to their centre
+            double spread = std::max(w.re.width(), w.im.width());
+            shrink = spread/std::hypot(0.5*(w.re.lo + w.re.hi), 0.5*(w.im.lo + w.im.hi));
+        }
+    }
+
+    // the bound shrinks about in proportion to the size, so only split if the
+    // smallest parts could pass; unbounded regions are split anyway, as the
+    // pole or branch cut may lie in one part only
+    int const size = std::max(width, height);
+    if (size <= MIN_REGION_SIZE || (bounded && shrink*MIN_REGION_SIZE >= size))
+    {
+        evaluated.push_back(tile);
+        return;
+    }
+
+    // split the sides longer than MIN_REGION_SIZE in half
+    int const xm = (width > MIN_REGION_SIZE) ? tile.x0 + width/2 : tile.x1;
+    int const ym = (height > MIN_REGION_SIZE) ? tile.y0 + height/2 : tile.y1;
+    Tile const parts[4] = {
+        {tile.x0, tile.y0, xm, ym}, {xm, tile.y0, tile.x1, ym},
+        {tile.x0, ym, xm, tile.y1}, {xm, ym, tile.x1, tile.y1}
+    };
+    for (Tile const & part : parts)
+    {
+        if (part.x0 < part.x1 && part.y0 < part.y1)
+            classifyRegion(f, plotData, part, smooth, evaluated);
+    }
+}
+
+template <typename Real>
+void renderRegions(Function const & f, PlotData const & plotData, ImageView const & image, Tile const & tile,
+                   std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    using Clock = RenderStats::Clock;
+
+    if (cancellationToken)
+        return;
+
+    RenderStats::Slot & slot = stats.slot();
+
+    auto start_time = Clock::now();
+    std::vector<Tile> smooth, evaluated;
+    classifyRegion(f, plotData, tile, smooth, evaluated);
+    slot.computing += Clock::now() - start_time;
+
+    // nothing to interpolate: the plain row by row path
+    if (smooth.empty())
+    {
+        renderTile<Real>(f, plotData, image, nullptr, tile, 1, false, cancellationToken, stats);
+        return;
+    }
+
+    // the corners of smooth regions and the pixels of the others, in full batches
+    std::vector<int> xs, ys;
+    for (Tile const & region : smooth)
+    {
+        for (int k = 0; k < 4; ++k)
+        {
+            xs.push_back((k & 1) ? region.x1 - 1 : region.x0);
+            ys.push_back((k & 2) ? region.y1 - 1 : region.y0);
+        }
+    }
+    for (Tile const & region : evaluated)
+    {
+        for (int j = region.y0; j < region.y1; ++j)
+        {
+            for (int i = region.x0; i < region.x1; ++i)
+            {
+                xs.push_back(i);
+                ys.push_back(j);
+            }
+        }
+    }
+    renderPixels<Real>(f, plotData, image, xs, ys, slot);
+
+    start_time = Clock::now();
+    for (Tile const & region : smooth)
+    {
+        interpolateRegion(image, region);
+        slot.interpolated += std::size_t(region.x1 - region.x0)*(region.y1 - region.y0) - 4;
+    }
+    slot.coloring += Clock::now() - start_time;
+}
+
+// evaluates a tile into values without coloring it
+void evaluateTile(Function const & f, PlotData const & plotData, ValueGrid & values, Tile const & tile,
+                  std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    using Clock = RenderStats::Clock;
+
+    double re[TILE_SIZE], im[TILE_SIZE];
+    int const width = tile.x1 - tile.x0;
+    LowParts low(f, TILE_SIZE);
+    RenderStats::Slot & slot = stats.slot();
+
+    auto start_time = Clock::now();
+
+    for (int j = tile.y0; j < tile.y1 && !cancellationToken; ++j)
+    {
+        for (int i = tile.x0; i < tile.x1; ++i)
+            mapPixel(plotData, i, j, re, im, low, i - tile.x0);
+
+        std::size_t offset = values.index(tile.x0, j);
+        evaluate(f, re, im, low, &values.re[offset], &values.im[offset], width, &slot.operators);
+        slot.countResults(&values.re[offset], &values.im[offset], width);
+    }
+
+    slot.computing += Clock::now() - start_time;
+}
+
+// colors a tile of the image from values
+void colorTile(PlotData const & plotData, ValueGrid const & values, ImageView const & image, Tile const & tile,
+               std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    using Clock = RenderStats::Clock;
+
+    int const width = tile.x1 - tile.x0;
+
+    auto start_time = Clock::now();
+
+    for (int j = tile.y0; j < tile.y1 && !cancellationToken; ++j)
+    {
+        std::size_t offset = values.index(tile.x0, j);
+        complex2rgb8_HL(&values.re[offset], &values.im[offset], width, plotData.colorSlope,
+                        image.scanLine(j) + 3*tile.x0);
+    }
+
+    stats.slot().coloring += Clock::now() - start_time;
+}
+
+// converts a tile of values to polar form
+void polarTile(ValueGrid const & values, PolarGrid & polar, Tile const & tile,
+               std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    using Clock = RenderStats::Clock;
+
+    int const width = tile.x1 - tile.x0;
+
+    auto start_time = Clock::now();
+
+    for (int j = tile.y0; j < tile.y1 && !cancellationToken; ++j)
+    {
+        std::size_t offset = values.index(tile.x0, j);
+        complex2polar(&values.re[offset], &values.im[offset], width, &polar.arg[offset], &polar.lz[offset]);
+    }
+
+    stats.slot().coloring += Clock::now() - start_time;
+}
+
+// colors a tile of the image from values in polar form
+void colorPolarTile(PlotData const & plotData, PolarGrid const & polar, ImageView const & image, Tile const & tile,
+                    std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    using Clock = RenderStats::Clock;
+
+    int const width = tile.x1 - tile.x0;
+
+    auto start_time = Clock::now();
+
+    for (int j = tile.y0; j < tile.y1 && !cancellationToken; ++j)
+    {
+        std::size_t offset = polar.index(tile.x0, j);
+        polar2rgb8_HL(&polar.arg[offset], &polar.lz[offset], width, plotData.colorSlope,
+                      image.scanLine(j) + 3*tile.x0);
+    }
+
+    stats.slot().coloring += Clock::now() - start_time;
+}
+
+// bands of whole rows read full-frame planes sequentially, which colors
+// about twice as fast as square tiles striding through them
+std::vector<Tile> rowBands(int width, int height)
+{
+    int const bandRows = TILE_SIZE/8;
+    std::vector<Tile> bands;
+    for (int y = 0; y < height; y += bandRows)
+        bands.push_back(Tile{0, y, width, std::min(y + bandRows, height)});
+    return bands;
+}
+
+// marks the pixels of a tile whose 3x3 neighbourhood (edge pixels repeated at the
+// border of the view) varies in lightness or in the chroma plane, whose angle is
+// the hue, by more than threshold; mask starts at row maskTop; returns their number
+std::size_t markTile(ImageView const & image, Tile const & tile, double threshold,
+                     std::vector<unsigned char> & mask, int maskTop)
+{
+    int const N = TILE_SIZE + 2;
+    int const width = tile.x1 - tile.x0;
+    float const t = static_cast<float>(threshold);
+
+    // horizontal 3-pixel sums of lightness, chroma plane coordinates and their
+    // squares, for the last three rows
+    struct Sums
+    {
+        float l[N], a[N], b[N], ll[N], cc[N];
+    };
+    Sums sums[3];
+
+    std::size_t marked = 0;
+    for (int y = tile.y0 - 1; y <= tile.y1; ++y)
+    {
+        int j = std::min(std::max(y, image.top), image.top + image.height - 1);
+        unsigned char const * row = image.scanLine(j);
+
+        // the tile row with a one pixel border, split into planes for vectorization
+        float red[N], green[N], blue[N];
+        int const first = (tile.x0 > 0) ? 0 : 1;
+        int const last = (tile.x1 < image.width) ? width + 2 : width + 1;
+        for (int x = first; x < last; ++x)
+        {
+            unsigned char const * pixel = row + 3*(tile.x0 + x - 1);
+            red[x] = pixel[0];
+            green[x] = pixel[1];
+            blue[x] = pixel[2];
+        }
+
+        // repeat the edge pixels at the image border
+        if (first == 1)
+        {
+            red[0] = red[1];
+            green[0] = green[1];
+            blue[0] = blue[1];
+        }
+        if (last == width + 1)
+        {
+            red[last] = red[last - 1];
+            green[last] = green[last - 1];
+            blue[last] = blue[last - 1];
+        }
+
+        float l[N], a[N], b[N], ll[N], cc[N];
+        for (int x = 0; x < width + 2; ++x)
+        {
+            float r = red[x]*(1.0f/255), g = green[x]*(1.0f/255), bl = blue[x]*(1.0f/255);
+            l[x] = 0.5f*(std::max(r, std::max(g, bl)) + std::min(r, std::min(g, bl)));
+            a[x] = r - 0.5f*(g + bl);
+            b[x] = 0.8660254f*(g - bl);
+            ll[x] = l[x]*l[x];
+            cc[x] = a[x]*a[x] + b[x]*b[x];
+        }
+
+        Sums & s2 = sums[(y + 3) % 3];
+        for (int x = 0; x < width; ++x)
+        {
+            s2.l[x] = l[x] + l[x + 1] + l[x + 2];
+            s2.a[x] = a[x] + a[x + 1] + a[x + 2];
+            s2.b[x] = b[x] + b[x + 1] + b[x + 2];
+            s2.ll[x] = ll[x] + ll[x + 1] + ll[x + 2];
+            s2.cc[x] = cc[x] + cc[x + 1] + cc[x + 2];
+        }
+
+        if (y < tile.y0 + 1)
+            continue;
+
+        // row y - 1 is complete
+        Sums const & s0 = sums[(y + 1) % 3];
+        Sums const & s1 = sums[(y + 2) % 3];
+        unsigned char * flags = &mask[std::size_t(y - 1 - maskTop)*image.width + tile.x0];
+        int count = 0;
+        for (int x = 0; x < width; ++x)
+        {
+            float ml = (s0.l[x] + s1.l[x] + s2.l[x])*(1.0f/9);
+            float ma = (s0.a[x] + s1.a[x] + s2.a[x])*(1.0f/9);
+            float mb = (s0.b[x] + s1.b[x] + s2.b[x])*(1.0f/9);
+            float lightness = (s0.ll[x] + s1.ll[x] + s2.ll[x])*(1.0f/9) - ml*ml;
+            float hue = (s0.cc[x] + s1.cc[x] + s2.cc[x])*(1.0f/9) - ma*ma - mb*mb;
+            unsigned char refine = (lightness > t) | (hue > t);
+            flags[x] = refine;
+            count += refine;
+        }
+        marked += count;
+    }
+
+    return marked;
+}
+
+// supersamples the marked pixels of a tile, one tile row at a time
+void refineTile(Function const & f, PlotData const & plotData, ImageView const & image,
+                std::vector<unsigned char> const & mask, int maskTop, Tile const & tile, int samples,
+                std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    using Clock = RenderStats::Clock;
+
+    // sample offsets in pixels, without the centre which is already computed
+    std::vector<double> dx, dy;
+    for (int q = 0; q < samples; ++q)
+    for (int p = 0; p < samples; ++p)
+    {
+        if (2*p + 1 == samples && 2*q + 1 == samples)
+            continue;
+        dx.push_back((p + 0.5)/samples - 0.5);
+        dy.push_back((q + 0.5)/samples - 0.5);
+    }
+    std::size_t const extra = dx.size();
+
+    double const pixelWidth = (plotData.reMax - plotData.reMin)/plotData.imageWidth;
+    double const pixelHeight = (plotData.imMax - plotData.imMin)/plotData.imageHeight;
+
+    std::vector<double> re(TILE_SIZE*extra), im(TILE_SIZE*extra);
+    std::vector<double> outRe(TILE_SIZE*extra), outIm(TILE_SIZE*extra);
+    std::vector<unsigned char> rgb(3*TILE_SIZE*extra);
+    int columns[TILE_SIZE];
+    LowParts low(f, TILE_SIZE*extra);
+
+    RenderStats::Slot & slot = stats.slot();
+
+    for (int j = tile.y0; j < tile.y1 && !cancellationToken; ++j)
+    {
+        auto row_start_time = Clock::now();
+
+        int n = 0;
+        for (int i = tile.x0; i < tile.x1; ++i)
+        {
+            if (!mask[std::size_t(j - maskTop)*image.width + i])
+                continue;
+
+            double centreRe, centreIm;
+            if (low.empty())
+            {
+                plotData.image2complex(i, j, centreRe, centreIm);
+                for (std::size_t k = 0; k < extra; ++k)
+                {
+                    re[n*extra + k] = centreRe + dx[k]*pixelWidth;
+                    im[n*extra + k] = centreIm - dy[k]*pixelHeight;
+                }
+            }
+            else
+            {
+                double centreReLo, centreImLo;
+                plotData.image2complex(i, j, centreRe, centreIm, centreReLo, centreImLo);
+                for (std::size_t k = 0; k < extra; ++k)
+                {
+                    DoubleDouble x = DoubleDouble(centreRe, centreReLo) + dx[k]*pixelWidth;
+                    DoubleDouble y = DoubleDouble(centreIm, centreImLo) - dy[k]*pixelHeight;
+                    re[n*extra + k] = x.hi;
+                    low.re[n*extra + k] = x.lo;
+                    im[n*extra + k] = y.hi;
+                    low.im[n*extra + k] = y.lo;
+                }
+            }
+            columns[n++] = i;
+        }
+
+        if (n == 0)
+            continue;
+
+        evaluate(f, re.data(), im.data(), low, outRe.data(), outIm.data(), n*extra, &slot.operators);
+        slot.countResults(outRe.data(), outIm.data(), n*extra);
+
+        auto row_computed_time = Clock::now();
+
+        complex2rgb8_HL(outRe.data(), outIm.data(), n*extra, plotData.colorSlope, rgb.data());
+
+        // average the colors of all samples, the centre one included
+        unsigned char * row = image.scanLine(j);
+        int const total = samples*samples;
+        for (int k = 0; k < n; ++k)
+        {
+            unsigned char * pixel = row + 3*columns[k];
+            for (int c = 0; c < 3; ++c)
+            {
+                int sum = pixel[c];
+                for (std::size_t e = 0; e < extra; ++e)
+                    sum += rgb[3*(k*extra + e) + c];
+                pixel[c] = static_cast<unsigned char>((sum + total/2)/total);
+            }
+        }
+
+        auto row_colored_time = Clock::now();
+
+        slot.computing += row_computed_time - row_start_time;
+        slot.coloring += row_colored_time - row_computed_time;
+    }
+}
+
+} // namespace
+
+void renderRegions(Function const & f, PlotData const & plotData, ImageView const & image, Tile const & tile,
+                   std::atomic_bool const & cancellationToken, RenderStats & stats)
+{
+    if (f.precision() == Precision::FLOAT)
+        renderRegions<float>(f, plotData, image, tile, cancellationToken, stats);
+    else
+        renderRegions<double>(f, plotData, image, tile, cancellationToken, stats);
+}
+
+std::vector<Tile> makeTiles(int x0, int y0, int x1, int y1, int tileSize)
+{
+    std::vector<Tile> tiles;
+    for (int y = y0; y < y1; y += tileSize)
+    for (int x = x0; x < x1; x += tileSize)
+        tiles.push_back(Tile{x, y, std::min(x + tileSize, x1), std::min(y + tileSize, y1)});
+    return tiles;
+}
+
+RenderStats::RenderStats(std::size_t threads) :
+    slots(threads + 1)
+{
+}
+
+RenderStats::Slot & RenderStats::slot()
+{
+    return slots[std::min(ThreadPool::currentWorker(), slots.size() - 1)];
+}
+
+void RenderStats::addRefined(std::size_t pixels)
+{
+    refinedPixels += pixels;
+}
+
+void RenderStats::report(RedrawInfo::DurationType rendering, std::size_t pixels, RedrawInfo & info)
+{
+    RenderProfile & profile = info.profile;
+    profile = RenderProfile();
+    profile.renderingDuration = rendering;
+    profile.framePixels = pixels;
+    profile.pixelsPerSecond = (rendering.count() > 0.0) ? pixels/rendering.count() : 0.0;
+
+    Clock::duration computing(0);
+    Clock::duration coloring(0);
+    OperatorProfile operators;
+    for (std::size_t k = 0; k < slots.size(); ++k)
+    {
+        Slot const & slot = slots[k];
+        computing += slot.computing;
+        coloring += slot.coloring;
+        operators.merge(slot.operators);
+        profile.tiles += slot.tiles;
+        profile.points += slot.points;
+        profile.interpolatedPixels += slot.interpolated;
+        profile.nanResults += slot.nan;
+        profile.infResults += slot.inf;
+
+        // the last slot is the driving thread, which runs no tiles
+        if (k + 1 < slots.size())
+        {
+            RenderProfile::Thread thread;
+            thread.busy = slot.busy;
+            thread.idle = std::max(rendering - thread.busy, RedrawInfo::DurationType(0));
+            thread.tiles = slot.tiles;
+            thread.points = slot.points;
+            profile.threads.push_back(thread);
+        }
+    }
+
+    profile.batches = operators.batches;
+    profile.sampledBatches = operators.sampled;
+    double const scale = (operators.sampled > 0) ? double(operators.batches)/operators.sampled : 0.0;
+    for (std::size_t op = 0; op < OPCODE_COUNT; ++op)
+    {
+        if (operators.count[op] == 0)
+            continue;
+        RenderProfile::Operator entry;
+        entry.name = opCodeName(static_cast<OpCode>(op));
+        entry.time = operators.time[op]*scale;
+        entry.sampledInstructions = operators.count[op];
+        profile.operators.push_back(entry);
+    }
+    std::sort(profile.operators.begin(), profile.operators.end(),
+              [](RenderProfile::Operator const & a, RenderProfile::Operator const & b) { return a.time > b.time; });
+
+    profile.peakMemory = peakMemoryBytes();
+
+    double computing_share = (computing + coloring).count() > 0 ?
+        double(computing.count())/(computing + coloring).count() : 1.0;
+
+    info.computingDuration = rendering*computing_share;
+    info.coloringDuration = rendering - info.computingDuration;
+    info.refinedFraction = (pixels > 0) ? double(refinedPixels)/pixels : 0.0;
+}
+
+void antialias(Function const & f, PlotData const & plotData, ImageView const & image, int y0, int y1,
+               std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    // an odd number of samples per axis puts one of them at the pixel centre
+    int const samples = plotData.antialiasing | 1;
+    if (samples <= 1)
+        return;
+
+    std::vector<Tile> const tiles = makeTiles(0, y0, plotData.imageWidth, y1);
+
+    // every pixel is classified from the unrefined image before any is changed
+    std::vector<unsigned char> mask(std::size_t(image.width)*(y1 - y0));
+    std::vector<std::size_t> marked(tiles.size());
+    runTiles(pool, tiles.size(), stats, [&](std::size_t t)
+    {
+        marked[t] = markTile(image, tiles[t], plotData.antialiasingThreshold, mask, y0);
+    });
+
+    stats.addRefined(std::accumulate(marked.begin(), marked.end(), std::size_t(0)));
+
+    runTiles(pool, tiles.size(), stats, [&](std::size_t t)
+    {
+        if (marked[t] > 0)
+            refineTile(f, plotData, image, mask, y0, tiles[t], samples, cancellationToken, stats);
+    });
+}
+
+void renderProgressive(Function const & f, PlotData const & plotData, ImageView const & image,
+                       int coarsestStep, ValueGrid * values, std::function<void(int)> const & notifyPass,
+                       std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    // tile origins are multiples of every step, so samples line up across tiles
+    std::vector<Tile> const tiles = makeTiles(plotData.imageWidth, plotData.imageHeight);
+
+    int step = 1;
+    while (2*step <= coarsestStep && 2*step <= TILE_SIZE/2)
+        step *= 2;
+
+    for (bool refine = false; step >= 1 && !cancellationToken; step /= 2, refine = true)
+    {
+        bool const regions = (step == 1 && values == nullptr && plotData.interpolation);
+        runTiles(pool, tiles.size(), stats, [&](std::size_t t)
+        {
+            if (regions)
+                renderRegions(f, plotData, image, tiles[t], cancellationToken, stats);
+            else
+                renderTile(f, plotData, image, values, tiles[t], step, refine, cancellationToken, stats);
+        });
+
+        if (!cancellationToken)
+            notifyPass(step);
+    }
+
+    if (plotData.antialiasing > 1 && !cancellationToken)
+    {
+        antialias(f, plotData, image, 0, plotData.imageHeight, cancellationToken, pool, stats);
+        if (!cancellationToken)
+            notifyPass(0);
+    }
+}
+
+void renderTranslated(Function const & f, PlotData const & plotData, ImageView const & image,
+                      ValueGrid & values, int dx, int dy,
+                      std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    int const width = plotData.imageWidth;
+    int const height = plotData.imageHeight;
+
+    values.shift(dx, dy);
+
+    // exposed rows span the full width, exposed columns the remaining rows
+    int const keptY0 = std::max(0, -dy);
+    int const keptY1 = height - std::max(0, dy);
+    int const keptX0 = std::max(0, -dx);
+    int const keptX1 = width - std::max(0, dx);
+
+    std::vector<Tile> exposed = makeTiles(0, 0, width, keptY0);
+    for (Tile const & tile : makeTiles(0, keptY1, width, height))
+        exposed.push_back(tile);
+    for (Tile const & tile : makeTiles(0, keptY0, keptX0, keptY1))
+        exposed.push_back(tile);
+    for (Tile const & tile : makeTiles(keptX1, keptY0, width, keptY1))
+        exposed.push_back(tile);
+
+    runTiles(pool, exposed.size(), stats, [&](std::size_t t)
+    {
+        evaluateTile(f, plotData, values, exposed[t], cancellationToken, stats);
+    });
+
+    if (!cancellationToken)
+        renderFromValues(f, plotData, image, values, cancellationToken, pool, stats);
+}
+
+void renderFromValues(Function const & f, PlotData const & plotData, ImageView const & image, ValueGrid const & values,
+                      std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    std::vector<Tile> const bands = rowBands(plotData.imageWidth, plotData.imageHeight);
+    runTiles(pool, bands.size(), stats, [&](std::size_t b)
+    {
+        colorTile(plotData, values, image, bands[b], cancellationToken, stats);
+    });
+
+    if (!cancellationToken)
+        antialias(f, plotData, image, 0, plotData.imageHeight, cancellationToken, pool, stats);
+}
+
+void renderRecolored(Function const & f, PlotData const & plotData, ImageView const & image, FrameCache & cache,
+                     std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    std::vector<Tile> const bands = rowBands(plotData.imageWidth, plotData.imageHeight);
+
+    if (!cache.polarValid)
+    {
+        cache.polar.resize(plotData.imageWidth, plotData.imageHeight);
+        runTiles(pool, bands.size(), stats, [&](std::size_t b)
+        {
+            polarTile(cache.values, cache.polar, bands[b], cancellationToken, stats);
+        });
+
+        if (cancellationToken)
+            return;
+        cache.polarValid = true;
+    }
+
+    runTiles(pool, bands.size(), stats, [&](std::size_t b)
+    {
+        colorPolarTile(plotData, cache.polar, image, bands[b], cancellationToken, stats);
+    });
+
+    // the values are unchanged, so the cache stays valid even if cancelled
+    cache.plotData = plotData;
+
+    if (!cancellationToken)
+        antialias(f, plotData, image, 0, plotData.imageHeight, cancellationToken, pool, stats);
+}
+
+void renderIncremental(Function const & f, PlotData const & plotData, ImageView const & image, FrameCache & cache,
+                       int coarsestStep, std::function<void(int)> const & notifyPass,
+                       std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    if (cache.recolorable(plotData))
+    {
+        renderRecolored(f, plotData, image, cache, cancellationToken, pool, stats);
+        if (!cancellationToken)
+            notifyPass(1);
+        return;
+    }
+
+    int dx, dy;
+    bool translated = cache.translation(plotData, dx, dy);
+
+    cache.valid = false;
+    cache.polarValid = false;
+    cache.values.resize(plotData.imageWidth, plotData.imageHeight);
+
+    if (translated)
+    {
+        renderTranslated(f, plotData, image, cache.values, dx, dy, cancellationToken, pool, stats);
+        if (!cancellationToken)
+            notifyPass(1);
+    }
+    else
+    {
+        renderProgressive(f, plotData, image, coarsestStep, &cache.values, notifyPass, cancellationToken, pool, stats);
+    }
+
+    cache.plotData = plotData;
+    cache.valid = !cancellationToken;
+}
+
+void renderCached(Function const & f, PlotData const & plotData, ImageView const & image, FrameCache & cache,
+                  RenderCache & results, int coarsestStep, std::function<void(int)> const & notifyPass,
+                  std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    // the values of a recolored frame are cached already
+    bool const recolored = cache.recolorable(plotData);
+    if (!recolored)
+    {
+        std::shared_ptr<ValueGrid const> values = results.findValues(plotData);
+        bool const imageCached = results.findImage(plotData, image);
+        if (values || imageCached)
+        {
+            // the values do not depend on the coloring, only the image needs redoing
+            cache.valid = false;
+            cache.polarValid = false;
+            if (values)
+                cache.values = *values;
+            if (!imageCached)
+            {
+                renderFromValues(f, plotData, image, cache.values, cancellationToken, pool, stats);
+                if (cancellationToken)
+                    return;
+                results.insertImage(plotData, image);
+            }
+
+            // without values, a following translation is rendered in full
+            cache.plotData = plotData;
+            cache.valid = (values != nullptr);
+            notifyPass(1);
+            return;
+        }
+    }
+
+    renderIncremental(f, plotData, image, cache, coarsestStep, notifyPass, cancellationToken, pool, stats);
+    if (cancellationToken)
+        return;
+
+    if (!recolored)
+        results.insertValues(plotData, cache.values);
+    results.insertImage(plotData, image);
+}
+
+void renderBands(Function const & f, PlotData const & plotData, std::function<void(ImageView const &)> const & writeBand,
+                 std::function<void(int)> const & notifyProgress,
+                 std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    int const width = plotData.imageWidth;
+    int const height = plotData.imageHeight;
+    std::ptrdiff_t const stride = 3*std::ptrdiff_t(width);
+
+    // one row above and below every band for the neighbourhoods of anti-aliasing
+    int const halo = (plotData.antialiasing > 1) ? 1 : 0;
+    int const bandRows = int(std::max<std::ptrdiff_t>(1, std::min<std::ptrdiff_t>(TILE_SIZE, MAX_BAND_BYTES/stride)));
+
+    // a band is written while the next one is rendered into the other buffer
+    std::vector<unsigned char> buffers[2];
+    std::future<void> writing;
+
+    for (int y0 = 0, b = 0; y0 < height && !cancellationToken; y0 += bandRows, b ^= 1)
+    {
+        int const y1 = std::min(y0 + bandRows, height);
+        int const top = std::max(y0 - halo, 0);
+        int const bottom = std::min(y1 + halo, height);
+
+        // only the previous band, in the other buffer, may still be written
+        buffers[b].resize(stride*(bottom - top));
+        ImageView band{buffers[b].data(), stride, width, bottom - top, top};
+
+        std::vector<Tile> const tiles = makeTiles(0, top, width, bottom);
+        runTiles(pool, tiles.size(), stats, [&](std::size_t t)
+        {
+            if (plotData.interpolation)
+                renderRegions(f, plotData, band, tiles[t], cancellationToken, stats);
+            else
+                renderTile(f, plotData, band, nullptr, tiles[t], 1, false, cancellationToken, stats);
+        });
+
+        if (halo > 0 && !cancellationToken)
+            antialias(f, plotData, band, y0, y1, cancellationToken, pool, stats);
+
+        if (cancellationToken)
+            break;
+
+        if (writing.valid())
+            writing.get();
+        ImageView rows{band.scanLine(y0), stride, width, y1 - y0, y0};
+        writing = std::async(std::launch::async, [&writeBand, rows]() { writeBand(rows); });
+
+        notifyProgress(y1);
+    }
+
+    if (writing.valid())
+        writing.get();
+}
+
+void renderSweep(Function & f, PlotData const & plotData, double t0, double t1, int frames,
+                 std::function<void(int, ImageView const &)> const & writeFrame,
+                 std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats)
+{
+    int const width = plotData.imageWidth;
+    int const height = plotData.imageHeight;
+
+    std::vector<Tile> const tiles = makeTiles(width, height);
+    std::vector<Tile> const bands = rowBands(width, height);
+
+    // a frame is colored and written from one grid while the next is evaluated into the other
+    ValueGrid values[2];
+    values[0].resize(width, height);
+    values[1].resize(width, height);
+    std::vector<unsigned char> pixels(3*std::size_t(width)*height);
+    ImageView const image{pixels.data(), 3*std::ptrdiff_t(width), width, height};
+    std::future<void> writing;
+
+    for (int k = 0; k < frames && !cancellationToken; ++k)
+    {
+        double const t = (frames > 1) ? t0 + (t1 - t0)*k/(frames - 1) : t0;
+        f.setParameter(t);
+
+        ValueGrid & frame = values[k & 1];
+        runTiles(pool, tiles.size(), stats, [&](std::size_t n)
+        {
+            evaluateTile(f, plotData, frame, tiles[n], cancellationToken, stats);
+        });
+
+        if (writing.valid())
+            writing.get();
+        if (cancellationToken)
+            break;
+
+        writing = std::async(std::launch::async, [&, k, &frame = frame]()
+        {
+            for (Tile const & band : bands)
+                colorTile(plotData, frame, image, band, cancellationToken, stats);
+            if (!cancellationToken)
+                writeFrame(k, image);
+        });
+    }
+
+    if (writing.valid())
+        writing.get();
+}
+
+RenderSlices::RenderSlices(PlotData const & plotData, ImageView const & image) :
+    plotData(plotData),
+    image(image),
+    tiles(makeTiles(plotData.imageWidth, plotData.imageHeight)),
+    columns(std::size_t(plotData.imageWidth + TILE_SIZE - 1)/TILE_SIZE),
+    bands((plotData.imageHeight + TILE_SIZE - 1)/TILE_SIZE)
+{
+    count = (plotData.antialiasing > 1) ? 2*bands + 1 : bands;
+}
+
+void RenderSlices::next(Function const & f, std::atomic_bool const & cancellationToken, ThreadPool & pool,
+                        RenderStats & stats)
+{
+    if (done())
+        return;
+    if (cancellationToken)
+    {
+        slice = count;
+        return;
+    }
+
+    int const k = slice++;
+
+    // makeTiles deals the tiles row by row, columns of them per band
+    if (k < bands)
+    {
+        runTiles(pool, columns, stats, [&](std::size_t t)
+        {
+            Tile const & tile = tiles[k*columns + t];
+            if (plotData.interpolation)
+                renderRegions(f, plotData, image, tile, cancellationToken, stats);
+            else
+                renderTile(f, plotData, image, nullptr, tile, 1, false, cancellationToken, stats);
+        });
+        return;
+    }
+
+    // as antialias, but with every band refined in a slice of its own
+    if (k == bands)
+    {
+        mask.assign(std::size_t(image.width)*plotData.imageHeight, 0);
+        marked.assign(tiles.size(), 0);
+        runTiles(pool, tiles.size(), stats, [&](std::size_t t)
+        {
+            marked[t] = markTile(image, tiles[t], plotData.antialiasingThreshold, mask, 0);
+        });
+        stats.addRefined(std::accumulate(marked.begin(), marked.end(), std::size_t(0)));
+        return;
+    }
+
+    int const b = k - bands - 1;
+    int const samples = plotData.antialiasing | 1;
+    runTiles(pool, columns, stats, [&](std::size_t t)
+    {
+        if (marked[b*columns + t] > 0)
+            refineTile(f, plotData, image, mask, 0, tiles[b*columns + t], samples, cancellationToken, stats);
+    });
+}
@@ -3,18 +3,279 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
 #include <vector>
 
-#include "coloring.hpp"
+#include "framecache.hpp"
 #include "function.hpp"
+#include "image.hpp"
 #include "plotdata.hpp"
+#include "rendercache.hpp"
+#include "threadpool.hpp"
 
-template <typename UpdateFunc, typename NotifyExitFunc>
-RedrawInfo redraw(PlotData const & plotData, UpdateFunc update, NotifyExitFunc notifyExit, std::atomic_bool const & cancellationToken)
+int const TILE_SIZE = 64;
+
+// rectangular block of pixels [x0, x1) x [y0, y1) processed as one unit of work
+struct Tile
+{
+    int x0, y0;
+    int x1, y1;
+};
+
+// tiles covering [x0, x1) x [y0, y1)
+std::vector<Tile> makeTiles(int x0, int y0, int x1, int y1, int tileSize = TILE_SIZE);
+
+inline std::vector<Tile> makeTiles(int width, int height)
+{
+    return makeTiles(0, 0, width, height);
+}
+
+/*
+ *  Counters of a render, collected without locking: every pool worker
+ *  updates its own slot (see slot()), the thread driving the render a last
+ *  one. report() sums them up into RedrawInfo and its profile.
+ */
+struct RenderStats
+{
+    using Clock = std::chrono::steady_clock;
+
+    // padded to a cache line so that workers never share one
+    struct alignas(64) Slot
+    {
+        Clock::duration computing{0};
+        Clock::duration coloring{0};
+        Clock::duration busy{0};
+        std::size_t tiles = 0;
+        std::size_t points = 0;  // evaluated
+        std::size_t interpolated = 0;
+        std::size_t nan = 0;
+        std::size_t inf = 0;
+        OperatorProfile operators;
+
+        // counts the non-finite results of n evaluated points
+        template <typename Real>
+        void countResults(Real const * re, Real const * im, std::size_t n);
+    };
+
+    explicit RenderStats(std::size_t threads);
+
+    // the slot of the calling thread
+    Slot & slot();
+
+    void addRefined(std::size_t pixels);
+
+    // split the wall time of the rendering in proportion to the summed phase
+    // times; pixels is the size of the frame
+    void report(RedrawInfo::DurationType rendering, std::size_t pixels, RedrawInfo & info);
+
+private:
+    std::vector<Slot> slots;
+    std::atomic<std::size_t> refinedPixels{0};
+};
+
+template <typename Real>
+void RenderStats::Slot::countResults(Real const * re, Real const * im, std::size_t n)
 {
+    std::size_t nans = 0, infs = 0;
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        // results are projected: an infinite one is (inf, +-0)
+        nans += (re[k] != re[k]) || (im[k] != im[k]);
+        infs += (re[k] == std::numeric_limits<Real>::infinity());
+    }
+    points += n;
+    nan += nans;
+    inf += infs;
+}
+
+/*
+ *  pool.run, recording the busy time and the tiles of every worker in stats;
+ *  all tile work of a render goes through it.
+ */
+template <typename Task>
+void runTiles(ThreadPool & pool, std::size_t count, RenderStats & stats, Task const & task)
+{
+    pool.run(count, [&](std::size_t index)
+    {
+        auto start_time = RenderStats::Clock::now();
+        task(index);
+        RenderStats::Slot & slot = stats.slot();
+        slot.busy += RenderStats::Clock::now() - start_time;
+        ++slot.tiles;
+    });
+}
+
+/*
+ *  Adaptive anti-aliasing of rows [y0, y1) of a rendered image: pixels whose
+ *  3x3 neighbourhood varies in lightness or hue by more than
+ *  plotData.antialiasingThreshold are supersampled on a grid of
+ *  plotData.antialiasing x plotData.antialiasing samples, the centre one
+ *  being the existing pixel. Other pixels are left as they are, so the cost
+ *  grows with the number of edges rather than with the image area.
+ *  Neighbours are taken from all rows of image, which may extend beyond y0, y1.
+ */
+void antialias(Function const & f, PlotData const & plotData, ImageView const & image, int y0, int y1,
+               std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+// regions of renderRegions up to this size in both directions are not split further
+int const MIN_REGION_SIZE = 8;
+
+/*
+ *  Renders a tile at full resolution region by region: the values over a
+ *  region are enclosed by interval arithmetic (Function::bound), and if the
+ *  colors over the enclosure vary by less than COLOR_STEP, only the corners
+ *  are evaluated and the rest is interpolated from them; otherwise the
+ *  region is split in four, down to MIN_REGION_SIZE, if its parts may pass.
+ *  The other pixels are evaluated in full batches. Every pixel is within
+ *  one quantization step of a full render.
+ */
+void renderRegions(Function const & f, PlotData const & plotData, ImageView const & image, Tile const & tile,
+                   std::atomic_bool const & cancellationToken, RenderStats & stats);
+
+/*
+ *  Renders in passes of increasing resolution: the first pass samples every
+ *  coarsestStep-th pixel in both directions and upscales, every following
+ *  pass halves the step and only computes the pixels not sampled before.
+ *  notifyPass(step) is called after each pass, and notifyPass(0) after the
+ *  anti-aliasing pass if enabled. If values is given, every computed value
+ *  is stored in it as well (one sample per pixel); otherwise, with
+ *  plotData.interpolation, the last pass uses renderRegions.
+ */
+void renderProgressive(Function const & f, PlotData const & plotData, ImageView const & image,
+                       int coarsestStep, ValueGrid * values, std::function<void(int)> const & notifyPass,
+                       std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+/*
+ *  Renders a viewport translated by (dx, dy) pixels relative to the one
+ *  values were computed for: values are shifted, only the exposed strips
+ *  are evaluated, and the whole image is recolored from values (and
+ *  anti-aliased again if enabled).
+ */
+void renderTranslated(Function const & f, PlotData const & plotData, ImageView const & image,
+                      ValueGrid & values, int dx, int dy,
+                      std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+// colors the whole image from values and anti-aliases it if enabled
+void renderFromValues(Function const & f, PlotData const & plotData, ImageView const & image, ValueGrid const & values,
+                      std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+/*
+ *  Recolors the frame kept in cache for plotData, which must be recolorable
+ *  from it: nothing is evaluated but the anti-aliasing samples. The image is
+ *  colored from the values in polar form, built on first use, which skips
+ *  the slope independent part of the coloring; the colors are within one
+ *  quantization step of a full render.
+ */
+void renderRecolored(Function const & f, PlotData const & plotData, ImageView const & image, FrameCache & cache,
+                     std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+/*
+ *  Renders the frame of plotData keeping its values in cache: with
+ *  renderRecolored if only the coloring changed, with renderTranslated if
+ *  plotData is a translation of the cached frame, otherwise with
+ *  renderProgressive.
+ */
+void renderIncremental(Function const & f, PlotData const & plotData, ImageView const & image, FrameCache & cache,
+                       int coarsestStep, std::function<void(int)> const & notifyPass,
+                       std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+/*
+ *  Like renderIncremental, but looks the frame up in results first: a cached
+ *  image is copied, cached values are only recolored. Completed frames are
+ *  added to results.
+ */
+void renderCached(Function const & f, PlotData const & plotData, ImageView const & image, FrameCache & cache,
+                  RenderCache & results, int coarsestStep, std::function<void(int)> const & notifyPass,
+                  std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+// upper bound of the pixel bytes of one band of renderBands
+std::ptrdiff_t const MAX_BAND_BYTES = std::ptrdiff_t(64) << 20;
+
+/*
+ *  Renders the image top to bottom in bands of whole rows, for images too
+ *  large to be held in memory: only two bands are allocated (plus a row
+ *  above and below each for anti-aliasing), whatever the image height, and
+ *  a band has at most TILE_SIZE rows and MAX_BAND_BYTES bytes. Every finished
+ *  band is passed to writeBand in order, on another thread so that writing
+ *  overlaps with rendering the next band; band.top is its first image row.
+ *  notifyProgress(rows) reports the number of rows rendered so far.
+ *  The pixels are the same as those of redraw, tiles going through
+ *  renderRegions with plotData.interpolation. Exceptions thrown by
+ *  writeBand are passed on.
+ */
+void renderBands(Function const & f, PlotData const & plotData, std::function<void(ImageView const &)> const & writeBand,
+                 std::function<void(int)> const & notifyProgress,
+                 std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+/*
+ *  Renders frames images of plotData with the parameter t of the formula
+ *  going from t0 to t1 in equal steps (t0 alone for a single frame), for
+ *  animations. The formula is compiled once; frame k is evaluated on the
+ *  pool while frame k - 1 is colored and passed to writeFrame(k - 1, image)
+ *  on another thread, so only two value planes and one image are allocated.
+ *  Frames are neither anti-aliased nor interpolated. Exceptions thrown by
+ *  writeFrame are passed on.
+ */
+void renderSweep(Function & f, PlotData const & plotData, double t0, double t1, int frames,
+                 std::function<void(int, ImageView const &)> const & writeFrame,
+                 std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+/*
+ *  A full resolution render of plotData into image, with the pixels of
+ *  redraw, cut into slices that run one after the other: one per band of
+ *  TILE_SIZE rows and, with anti-aliasing, one classifying all pixels and
+ *  one per band refining them. Callers can interleave several renders on
+ *  one pool by switching between them after any slice.
+ */
+class RenderSlices
+{
+public:
+    RenderSlices(PlotData const & plotData, ImageView const & image);
+
+    bool done() const { return slice == count; }
+
+    // runs the next slice; once cancelled, the image is left incomplete
+    void next(Function const & f, std::atomic_bool const & cancellationToken, ThreadPool & pool, RenderStats & stats);
+
+private:
+    PlotData plotData;
+    ImageView image;
+    std::vector<Tile> tiles;  // of the whole image, band by band
+    std::size_t columns;      // tiles per band
+    int bands;
+    int slice = 0;
+    int count;
+
+    // pixels to anti-alias and their number per tile
+    std::vector<unsigned char> mask;
+    std::vector<std::size_t> marked;
+};
+
+/*
+ *  Parses the formula, runs render(f, stats) on pool and fills in RedrawInfo
+ *  and its profile; frames is the number of images render produces, which
+ *  the throughput counts. notifyExit is called on return and before
+ *  exceptions of render are passed on. Shared driver of the redraw functions
+ *  below.
+ */
+template <typename RenderFunc, typename NotifyExitFunc>
+RedrawInfo runRedraw(PlotData const & plotData, RenderFunc render, NotifyExitFunc notifyExit,
+                     std::atomic_bool const & cancellationToken, ThreadPool & pool, std::size_t frames = 1)
+{
+    using Clock = RenderStats::Clock;
+
+    // calls notifyExit on every way out, exceptions of render included
+    struct ExitNotifier
+    {
+        NotifyExitFunc & notifyExit;
+        ~ExitNotifier() { notifyExit(); }
+    } exitNotifier{notifyExit};
+
     RedrawInfo info;
 
-    auto start_time = std::chrono::system_clock::now();
+    auto start_time = Clock::now();
     Function f;
     try
     {
@@ -24,47 +285,117 @@ RedrawInfo redraw(PlotData const & plotData, UpdateFunc update, NotifyExitFunc n
     {
         info.status = RedrawInfo::Status::ERROR;
         info.message = std::string("Formula error: ") + e.what() + ".";
-        notifyExit();
         return info;
     }
 
-    auto parsing_done_time = std::chrono::system_clock::now();
+    f.setParameter(plotData.parameter);
+    info.precision = plotData.effectivePrecision();
+    f.setPrecision(info.precision);
+    info.backend = f.setBackend(plotData.backend);
+
+    auto parsing_done_time = Clock::now();
+
+    RenderStats stats(pool.size());
+    render(f, stats);
 
-    std::vector<complex> values(plotData.imageWidth*plotData.imageHeight, 0.0);
+    auto rendering_done_time = Clock::now();
 
-    for (int j = 0; j < plotData.imageHeight && !cancellationToken; ++j)
-    for (int i = 0; i < plotData.imageWidth && !cancellationToken; ++i)
+    info.parsingDuration = parsing_done_time - start_time;
+    stats.report(rendering_done_time - parsing_done_time,
+                 frames*plotData.imageWidth*plotData.imageHeight, info);
+
+    info.status = cancellationToken ? RedrawInfo::Status::CANCELLED : RedrawInfo::Status::FINISHED;
+    return info;
+}
+
+/*
+ *  Renders plotData into image, progressively starting at coarsestStep (see
+ *  renderProgressive). The image must be plotData.imageWidth x
+ *  plotData.imageHeight; every tile is owned by a single pool thread which
+ *  writes its pixels straight into the image rows.
+ */
+template <typename NotifyPassFunc, typename NotifyExitFunc>
+RedrawInfo redrawProgressive(PlotData const & plotData, ImageView const & image, int coarsestStep,
+                             NotifyPassFunc notifyPass, NotifyExitFunc notifyExit,
+                             std::atomic_bool const & cancellationToken,
+                             ThreadPool & pool = ThreadPool::shared())
+{
+    auto render = [&](Function const & f, RenderStats & stats)
     {
-        // compute complex argument for the pixel at (i, j)
-        double re, im;
-        plotData.image2complex(i, j, re, im);
-        complex z(re, im);
+        renderProgressive(f, plotData, image, coarsestStep, nullptr, notifyPass, cancellationToken, pool, stats);
+    };
 
-        // compute value
-        values[j*plotData.imageWidth + i] = f(z);
-    }
+    return runRedraw(plotData, render, notifyExit, cancellationToken, pool);
+}
 
-    auto computing_done_time = std::chrono::system_clock::now();
+// renders plotData into image in a single full resolution pass
+template <typename NotifyExitFunc>
+RedrawInfo redraw(PlotData const & plotData, ImageView const & image, NotifyExitFunc notifyExit, std::atomic_bool const & cancellationToken,
+                  ThreadPool & pool = ThreadPool::shared())
+{
+    return redrawProgressive(plotData, image, 1, [](int) {}, notifyExit, cancellationToken, pool);
+}
 
-    for (int j = 0; j < plotData.imageHeight && !cancellationToken; ++j)
-    for (int i = 0; i < plotData.imageWidth && !cancellationToken; ++i)
+// renders plotData band by band into writeBand (see renderBands)
+template <typename WriteBandFunc, typename NotifyProgressFunc, typename NotifyExitFunc>
+RedrawInfo redrawBands(PlotData const & plotData, WriteBandFunc writeBand, NotifyProgressFunc notifyProgress,
+                       NotifyExitFunc notifyExit, std::atomic_bool const & cancellationToken,
+                       ThreadPool & pool = ThreadPool::shared())
+{
+    auto render = [&](Function const & f, RenderStats & stats)
     {
-        // compute color
-        double r, g, b;
-        complex2rgb_HL(values[j*plotData.imageWidth + i], plotData.colorSlope, r, g, b);
-        update(i, j, r, g, b);
-    }
+        renderBands(f, plotData, writeBand, notifyProgress, cancellationToken, pool, stats);
+    };
 
-    auto coloring_done_time = std::chrono::system_clock::now();
+    return runRedraw(plotData, render, notifyExit, cancellationToken, pool);
+}
 
-    info.parsingDuration = parsing_done_time - start_time;
-    info.computingDuration = computing_done_time - parsing_done_time;
-    info.coloringDuration = coloring_done_time - computing_done_time;
+// renders a parameter sweep of plotData into writeFrame (see renderSweep)
+template <typename WriteFrameFunc, typename NotifyExitFunc>
+RedrawInfo redrawSweep(PlotData const & plotData, double t0, double t1, int frames, WriteFrameFunc writeFrame,
+                       NotifyExitFunc notifyExit, std::atomic_bool const & cancellationToken,
+                       ThreadPool & pool = ThreadPool::shared())
+{
+    auto render = [&](Function & f, RenderStats & stats)
+    {
+        renderSweep(f, plotData, t0, t1, frames, writeFrame, cancellationToken, pool, stats);
+    };
 
-    info.status = cancellationToken ? RedrawInfo::Status::CANCELLED : RedrawInfo::Status::FINISHED;
+    return runRedraw(plotData, render, notifyExit, cancellationToken, pool, std::size_t(frames));
+}
 
-    notifyExit();
-    return info;
+/*
+ *  Like redrawProgressive, but keeps the function values of the frame in
+ *  cache. If plotData is an integer pixel translation of the cached frame,
+ *  only the newly exposed pixels are evaluated.
+ */
+template <typename NotifyPassFunc, typename NotifyExitFunc>
+RedrawInfo redrawIncremental(PlotData const & plotData, ImageView const & image, FrameCache & cache, int coarsestStep,
+                             NotifyPassFunc notifyPass, NotifyExitFunc notifyExit,
+                             std::atomic_bool const & cancellationToken,
+                             ThreadPool & pool = ThreadPool::shared())
+{
+    auto render = [&](Function const & f, RenderStats & stats)
+    {
+        renderIncremental(f, plotData, image, cache, coarsestStep, notifyPass, cancellationToken, pool, stats);
+    };
+
+    return runRedraw(plotData, render, notifyExit, cancellationToken, pool);
+}
+
+// like redrawIncremental, reusing the frames kept in results (see renderCached)
+template <typename NotifyPassFunc, typename NotifyExitFunc>
+RedrawInfo redrawCached(PlotData const & plotData, ImageView const & image, FrameCache & cache, RenderCache & results,
+                        int coarsestStep, NotifyPassFunc notifyPass, NotifyExitFunc notifyExit,
+                        std::atomic_bool const & cancellationToken,
+                        ThreadPool & pool = ThreadPool::shared())
+{
+    auto render = [&](Function const & f, RenderStats & stats)
+    {
+        renderCached(f, plotData, image, cache, results, coarsestStep, notifyPass, cancellationToken, pool, stats);
+    };
+
+    return runRedraw(plotData, render, notifyExit, cancellationToken, pool);
 }
 
 #endif // COMPLEXPLOT_ENGINE_HPP
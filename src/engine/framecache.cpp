@@ -0,0 +1,102 @@
+#include <cmath>
+#include <cstring>
+
+#include "framecache.hpp"
+
+namespace {
+
+// tolerated deviation from an exact pixel translation, in pixels
+double const TRANSLATION_TOLERANCE = 1e-6;
+
+void shiftPlane(std::vector<double> & plane, int width, int height, int dx, int dy)
+{
+    int const columns = width - std::abs(dx);
+    int const srcX = (dx > 0) ? dx : 0;
+    int const dstX = (dx > 0) ? 0 : -dx;
+
+    // walk rows in the direction that never overwrites a row still to be read
+    auto moveRow = [&](int j)
+    {
+        double * dst = plane.data() + std::size_t(j)*width + dstX;
+        double const * src = plane.data() + std::size_t(j + dy)*width + srcX;
+        std::memmove(dst, src, columns*sizeof(double));
+    };
+
+    if (dy >= 0)
+        for (int j = 0; j + dy < height; ++j)
+            moveRow(j);
+    else
+        for (int j = height - 1; j + dy >= 0; --j)
+            moveRow(j);
+}
+
+} // namespace
+
+void ValueGrid::resize(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    re.resize(std::size_t(width)*height);
+    im.resize(std::size_t(width)*height);
+}
+
+void ValueGrid::shift(int dx, int dy)
+{
+    if (std::abs(dx) >= width || std::abs(dy) >= height)
+        return;
+
+    shiftPlane(re, width, height, dx, dy);
+    shiftPlane(im, width, height, dx, dy);
+}
+
+void PolarGrid::resize(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    arg.resize(std::size_t(width)*height);
+    lz.resize(std::size_t(width)*height);
+}
+
+bool FrameCache::recolorable(PlotData const & next) const
+{
+    PlotData const & prev = plotData;
+
+    return valid && next.formula == prev.formula && next.parameter == prev.parameter && next.backend == prev.backend &&
+           next.effectivePrecision() == prev.effectivePrecision() &&
+           next.reMin == prev.reMin && next.reMax == prev.reMax &&
+           next.imMin == prev.imMin && next.imMax == prev.imMax &&
+           next.imageWidth == prev.imageWidth && next.imageHeight == prev.imageHeight;
+}
+
+bool FrameCache::translation(PlotData const & next, int & dx, int & dy) const
+{
+    PlotData const & prev = plotData;
+
+    if (!valid || next.formula != prev.formula || next.parameter != prev.parameter || next.backend != prev.backend ||
+        next.effectivePrecision() != prev.effectivePrecision() ||
+        next.imageWidth != prev.imageWidth || next.imageHeight != prev.imageHeight)
+        return false;
+
+    double pixelWidth = (prev.reMax - prev.reMin)/prev.imageWidth;
+    double pixelHeight = (prev.imMax - prev.imMin)/prev.imageHeight;
+
+    // same scale
+    double widthError = std::abs((next.reMax - next.reMin)/next.imageWidth - pixelWidth)/pixelWidth;
+    double heightError = std::abs((next.imMax - next.imMin)/next.imageHeight - pixelHeight)/pixelHeight;
+    if (!(widthError*prev.imageWidth < TRANSLATION_TOLERANCE && heightError*prev.imageHeight < TRANSLATION_TOLERANCE))
+        return false;
+
+    // whole pixel offset; image rows grow downwards
+    double x = (next.reMin - prev.reMin)/pixelWidth;
+    double y = (prev.imMax - next.imMax)/pixelHeight;
+    double rx = std::round(x);
+    double ry = std::round(y);
+    if (!(std::abs(x - rx) < TRANSLATION_TOLERANCE && std::abs(y - ry) < TRANSLATION_TOLERANCE))
+        return false;
+    if (!(std::abs(rx) < prev.imageWidth && std::abs(ry) < prev.imageHeight))
+        return false;
+
+    dx = static_cast<int>(rx);
+    dy = static_cast<int>(ry);
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef COMPLEXPLOT_FRAMECACHE_HPP
+#define COMPLEXPLOT_FRAMECACHE_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "plotdata.hpp"
+
+// full-frame function values in split real/imaginary form, row by row
+struct ValueGrid
+{
+    int width = 0;
+    int height = 0;
+    std::vector<double> re;
+    std::vector<double> im;
+
+    void resize(int width, int height);
+
+    // moves the contents so that (i, j) holds the former value at (i + dx, j + dy);
+    // values shifted in from outside are left unspecified
+    void shift(int dx, int dy);
+
+    std::size_t index(int x, int y) const { return std::size_t(y)*width + x; }
+};
+
+// arg and log modulus of full-frame function values in single precision,
+// all that recoloring needs (see complex2polar)
+struct PolarGrid
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float> arg;
+    std::vector<float> lz;
+
+    void resize(int width, int height);
+
+    std::size_t index(int x, int y) const { return std::size_t(y)*width + x; }
+};
+
+/*
+ *  Function values and viewport of the last completed frame, kept so that
+ *  a translated viewport only needs the newly exposed pixels evaluated and
+ *  a new color slope none at all.
+ */
+struct FrameCache
+{
+    PlotData plotData;
+    ValueGrid values;
+    bool valid = false;
+
+    // values in polar form, built by the first recoloring of the frame
+    PolarGrid polar;
+    bool polarValid = false;
+
+    // true if next differs from the cached frame only in coloring or anti-aliasing
+    bool recolorable(PlotData const & next) const;
+
+    // true if next shows the same function, evaluated alike, on a viewport
+    // translated by a whole number of pixels (dx, dy) that still overlaps the
+    // cached one
+    bool translation(PlotData const & next, int & dx, int & dy) const;
+};
+
+#endif // COMPLEXPLOT_FRAMECACHE_HPP
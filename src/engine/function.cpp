@@ -1,14 +1,25 @@
+#include <algorithm>
 #include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include "function.hpp"
+#include "interval.hpp"
 
 // functions
-std::map<std::string, Expression::NodeFunction> Expression::fun
+std::map<std::string, OpCode> Expression::fun
 {
-    {"exp", [](complex const & a, complex const &) { return std::exp(a); }}
+    {"exp", OpCode::EXP}
 };
 
 namespace {
@@ -57,6 +68,7 @@ enum class Lexer::Token::Type
     LP, RP,
     ID,
     Z,
+    T,
     I,
     REAL,
     EOD,
@@ -117,7 +129,7 @@ void Lexer::tokenize()
             continue;
         }
 
-        // ID, Z, I
+        // ID, Z, T, I
         if (std::isalpha(*head))
         {
             ++head;
@@ -133,6 +145,11 @@ void Lexer::tokenize()
                     tokens.emplace_back(Token::Type::Z, value);
                     continue;
                 }
+                if (value[0] == 't')
+                {
+                    tokens.emplace_back(Token::Type::T, value);
+                    continue;
+                }
                 if (value[0] == 'i')
                 {
                     tokens.emplace_back(Token::Type::I, value);
@@ -160,6 +177,9 @@ public:
     {
         lexer.tokenize();
         head = lexer.begin();
+
+        // every node stems from a token
+        expression.reserve(lexer.end() - lexer.begin());
         auto node = parseExpression(expression);
         expect(Lexer::Token::Type::EOD);
         expression.set_root(node);
@@ -189,58 +209,52 @@ private:
     //  F -> A ( '^' A )?
     //  A -> id? '(' E ')'
     //  A -> 'z'
+    //  A -> 't'
     //  A -> real
     //  A -> 'i'
 
-    Expression::Node * parseExpression(Expression & expression)
+    Expression::Index parseExpression(Expression & expression)
     {
         bool neg = accept(Lexer::Token::Type::ADD) && (current->value[0] == '-');
         auto node = parseSummand(expression);
         if (neg)
-            node = expression.new_Node(node, nullptr,
-                    [](complex const & a, complex const &) { return -a; });
+            node = expression.new_Node(OpCode::NEG, node);
         while (accept(Lexer::Token::Type::ADD))
         {
             char op = current->value[0];
             auto node2 = parseSummand(expression);
-            node = expression.new_Node(node, node2,
-                    (op == '+') ?
-                        [](complex const & a, complex const & b) { return a + b; } :
-                        [](complex const & a, complex const & b) { return a - b; });
+            node = expression.new_Node((op == '+') ? OpCode::ADD : OpCode::SUB, node, node2);
         }
 
         return node;
     }
 
-    Expression::Node * parseSummand(Expression & expression)
+    Expression::Index parseSummand(Expression & expression)
     {
         auto node = parseFactor(expression);
         while (accept(Lexer::Token::Type::MUL))
         {
             char op = current->value[0];
             auto node2 = parseFactor(expression);
-            node = expression.new_Node(node, node2,
-                    (op == '*') ?
-                        [](complex const & a, complex const & b) { return a*b; } :
-                        [](complex const & a, complex const & b) { return a/b; });
+            node = expression.new_Node((op == '*') ? OpCode::MUL : OpCode::DIV, node, node2);
         }
 
         return node;
     }
 
-    Expression::Node * parseFactor(Expression & expression)
+    Expression::Index parseFactor(Expression & expression)
     {
         auto node = parseAtomic(expression);
         if (accept(Lexer::Token::Type::POW))
         {
             auto node2 = parseAtomic(expression);
-            node = expression.new_Node(node, node2, [](complex const & a, complex const & b) { return std::pow(a, b); });
+            node = expression.new_Node(OpCode::POW, node, node2);
         }
 
         return node;
     }
 
-    Expression::Node * parseAtomic(Expression & expression)
+    Expression::Index parseAtomic(Expression & expression)
     {
         if (accept(Lexer::Token::Type::ID))
         {
@@ -251,7 +265,7 @@ private:
             auto node = parseExpression(expression);
             expect(Lexer::Token::Type::RP);
 
-            return expression.new_Node(node, nullptr, it->second);
+            return expression.new_Node(it->second, node);
         }
 
         if (accept(Lexer::Token::Type::LP))
@@ -263,31 +277,565 @@ private:
 
         if (accept(Lexer::Token::Type::REAL))
         {
-            complex c(std::stod(current->value));
-            return expression.new_Node(nullptr, nullptr, [c](complex const &, complex const &) { return c; });
+            // not std::stod, which throws std::out_of_range past the range of
+            // double, underflow included; the lexer reads no exponents
+            double value = std::strtod(current->value.c_str(), nullptr);
+            if (std::isinf(value))
+                throw std::invalid_argument("number too large");
+            return expression.new_Node(OpCode::CONST, Expression::NONE, Expression::NONE, value);
         }
 
         if (accept(Lexer::Token::Type::I))
+            return expression.new_Node(OpCode::CONST, Expression::NONE, Expression::NONE, complex(0.0, 1.0));
+
+        if (accept(Lexer::Token::Type::Z))
+            return expression.new_Node(OpCode::Z);
+
+        if (accept(Lexer::Token::Type::T))
+            return expression.new_Parameter();
+
+        throw std::invalid_argument("syntax error");
+    }
+};
+
+} // namespace
+
+namespace {
+
+using Node = Expression::Node;
+using Index = Expression::Index;
+
+Index const NONE = Expression::NONE;
+
+// expressions up to this size are evaluated without allocating
+std::size_t const INLINE_NODES = 32;
+
+// builds the optimized expression into a new arena
+class Optimizer
+{
+public:
+    Optimizer(Expression const & source, Expression & target) : source(source), target(target) {}
+
+    Index optimize(Index index);
+
+private:
+    // op, operands and, for constants, the bits of the value
+    using Key = std::tuple<OpCode, Index, Index, std::uint64_t, std::uint64_t>;
+
+    Expression const & source;
+    Expression & target;
+    std::map<Key, Index> nodes;
+    Index parameter = NONE;  // the one node of t, shared by all its uses
+
+    bool isLiteral(Index index) const;
+    bool isConstant(Index index, complex const & c) const;
+    Index intern(OpCode op, Index left, Index right, complex value = 0.0);
+    Index constant(complex const & c);
+    Index power(Index base, double x);
+};
+
+std::uint64_t bits(double d)
+{
+    std::uint64_t u;
+    std::memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+Index Optimizer::optimize(Index index)
+{
+    Node const node = source.node(index);
+    if (node.parameter)
+    {
+        if (parameter == NONE)
+            parameter = target.new_Parameter(node.value);
+        return parameter;
+    }
+    if (node.op == OpCode::CONST)
+        return constant(node.value);
+    if (node.left == NONE)
+        return intern(node.op, NONE, NONE, node.value);
+
+    Index left = optimize(node.left);
+    Index right = (node.right != NONE) ? optimize(node.right) : NONE;
+
+    // fold, exactly as the value would be computed for every pixel
+    Node const & l = target.node(left);
+    if (isLiteral(left) && (right == NONE || isLiteral(right)))
+    {
+        complex b = (right != NONE) ? target.node(right).value : complex();
+        return constant(std::proj(Expression::apply(node.op, l.value, b, node.value)));
+    }
+
+    switch (node.op)
+    {
+    case OpCode::ADD:
+        if (isConstant(left, 0.0))
+            return right;
+        if (isConstant(right, 0.0))
+            return left;
+        break;
+    case OpCode::SUB:
+        if (isConstant(right, 0.0))
+            return left;
+        break;
+    case OpCode::MUL:
+        if (isConstant(left, 1.0))
+            return right;
+        if (isConstant(right, 1.0))
+            return left;
+        break;
+    case OpCode::DIV:
+        if (isConstant(right, 1.0))
+            return left;
+        break;
+    case OpCode::POW:
+        // exact, as powComplex, powInt and powReal agree at a = 0 (and a^0 = 1 everywhere)
+        if (isConstant(right, 1.0))
+            return left;
+        if (isLiteral(right) && target.node(right).value.imag() == 0.0)
+            return power(left, target.node(right).value.real());
+        break;
+    default:
+        break;
+    }
+
+    return intern(node.op, left, right, node.value);
+}
+
+// a constant that stays one, unlike t
+bool Optimizer::isLiteral(Index index) const
+{
+    return target.node(index).op == OpCode::CONST && !target.node(index).parameter;
+}
+
+bool Optimizer::isConstant(Index index, complex const & c) const
+{
+    return isLiteral(index) && target.node(index).value == c;
+}
+
+Index Optimizer::intern(OpCode op, Index left, Index right, complex value)
+{
+    Key key(op, left, right, bits(value.real()), bits(value.imag()));
+    auto it = nodes.find(key);
+    if (it != nodes.end())
+        return it->second;
+
+    Index index = target.new_Node(op, left, right, value);
+    nodes.emplace(key, index);
+    return index;
+}
+
+Index Optimizer::constant(complex const & c)
+{
+    return intern(OpCode::CONST, NONE, NONE, std::proj(c));
+}
+
+// a^x for constant real x, avoiding the complex logarithm of std::pow
+Index Optimizer::power(Index base, double x)
+{
+    if (x == std::floor(x) && std::abs(x) <= MAX_INTEGER_EXPONENT)
+        return intern(OpCode::POWI, base, NONE, x);
+
+    return intern(OpCode::POWR, base, NONE, x);
+}
+
+// number of registers needed to evaluate a subtree on its own (Sethi-Ullman
+// numbering); operands come first in the arena, so one forward pass suffices
+std::vector<std::size_t> registersNeeded(Expression const & expression)
+{
+    std::vector<std::size_t> count(expression.size());
+    for (std::size_t k = 0; k < expression.size(); ++k)
+    {
+        Node const & node = expression.node(k);
+        if (node.left == NONE)
+        {
+            count[k] = 1;
+        }
+        else if (node.right == NONE)
+        {
+            count[k] = count[node.left];
+        }
+        else
         {
-            complex c(0.0, 1.0);
-            return expression.new_Node(nullptr, nullptr, [c](complex const &, complex const &) { return c; });
+            std::size_t l = count[node.left];
+            std::size_t r = count[node.right];
+            count[k] = (l == r) ? l + 1 : std::max(l, r);
         }
+    }
+    return count;
+}
 
-        if (accept(Lexer::Token::Type::Z))
+// nodes in evaluation order, each shared node once, operands before their users;
+// the more demanding operand goes first so that it can use all free registers
+struct Schedule
+{
+    Expression const & expression;
+    std::vector<std::size_t> const registers;
+
+    std::vector<Index> order;
+    std::vector<std::size_t> position;  // in order, by node index
+
+    Schedule(Expression const & expression, Index root) :
+        expression(expression),
+        registers(registersNeeded(expression)),
+        position(expression.size(), NOT_SCHEDULED)
+    {
+        visit(root);
+    }
+
+    static constexpr std::size_t NOT_SCHEDULED = std::numeric_limits<std::size_t>::max();
+
+    void visit(Index index)
+    {
+        if (position[index] != NOT_SCHEDULED)
+            return;
+
+        Node const & node = expression.node(index);
+        if (node.left != NONE && node.right != NONE && registers[node.left] < registers[node.right])
         {
-            return expression.new_Node(nullptr, nullptr, [](complex const & a, complex const &) { return a; });
+            visit(node.right);
+            visit(node.left);
+        }
+        else
+        {
+            if (node.left != NONE)
+                visit(node.left);
+            if (node.right != NONE)
+                visit(node.right);
         }
 
-        throw std::invalid_argument("syntax error");
+        position[index] = order.size();
+        order.push_back(index);
     }
 };
 
 } // namespace
 
-void Function::fromFormula(std::string const & formula)
+Expression::Index Expression::new_Node(OpCode op, Index left, Index right, complex value)
+{
+    if (nodes.size() >= NONE)
+        throw std::invalid_argument("formula too complex");
+
+    nodes.push_back(Node{value, left, right, op, false});
+    return static_cast<Index>(nodes.size() - 1);
+}
+
+Expression::Index Expression::new_Parameter(complex const & t)
+{
+    Index index = new_Node(OpCode::CONST, NONE, NONE, t);
+    nodes[index].parameter = true;
+    return index;
+}
+
+complex Expression::apply(OpCode op, complex const & a, complex const & b, complex const & value)
+{
+    switch (op)
+    {
+    case OpCode::CONST:
+        return value;
+    case OpCode::Z:
+        return a;
+    case OpCode::NEG:
+        return -a;
+    case OpCode::ADD:
+        return a + b;
+    case OpCode::SUB:
+        return a - b;
+    case OpCode::MUL:
+        return a*b;
+    case OpCode::DIV:
+        return a/b;
+    case OpCode::POW:
+        return powComplex(a, b);
+    case OpCode::POWI:
+        return powInt(a, static_cast<int>(value.real()));
+    case OpCode::POWR:
+        return powReal(a, value.real());
+    case OpCode::EXP:
+        return std::exp(a);
+    }
+    return a;
+}
+
+complex Expression::eval(complex const & z) const
+{
+    if (root == NONE)
+        return z;
+
+    if (nodes.size() <= INLINE_NODES)
+    {
+        // left uninitialized on purpose: every node is written before it is read
+        std::aligned_storage<sizeof(complex), alignof(complex)>::type storage[INLINE_NODES];
+        return run(z, reinterpret_cast<complex *>(storage));
+    }
+
+    std::vector<complex> values(nodes.size());
+    return run(z, values.data());
+}
+
+complex Expression::run(complex const & z, complex * values) const
+{
+    // operands precede their users, so one pass in arena order computes every node
+    for (std::size_t k = 0; k < nodes.size(); ++k)
+    {
+        Node const & node = nodes[k];
+        complex const & a = (node.left != NONE) ? values[node.left] : z;
+        complex const & b = (node.right != NONE) ? values[node.right] : z;
+        values[k] = std::proj(apply(node.op, a, b, node.value));
+    }
+
+    return values[root];
+}
+
+bool Expression::bound(ComplexInterval const & z, double slack, ComplexInterval & w) const
+{
+    if (root == NONE)
+    {
+        w = z;
+        return true;
+    }
+
+    // called per region of a tile, so small trees are kept off the heap
+    ComplexInterval storage[INLINE_NODES];
+    std::vector<ComplexInterval> heap;
+    ComplexInterval * values = storage;
+    if (nodes.size() > INLINE_NODES)
+    {
+        heap.resize(nodes.size());
+        values = heap.data();
+    }
+
+    for (std::size_t k = 0; k < nodes.size(); ++k)
+    {
+        Node const & node = nodes[k];
+        ComplexInterval const & a = (node.left != NONE) ? values[node.left] : z;
+        ComplexInterval const & b = (node.right != NONE) ? values[node.right] : z;
+        if (!applyInterval(node.op, a, b, node.value, slack, values[k]))
+            return false;
+    }
+
+    w = values[root];
+    return true;
+}
+
+void Expression::setParameter(complex const & t)
+{
+    for (Node & node : nodes)
+    {
+        if (node.parameter)
+            node.value = std::proj(t);
+    }
+}
+
+void Expression::optimize()
+{
+    Expression optimized;
+    Optimizer optimizer(*this, optimized);
+    Index top = optimizer.optimize(root);
+
+    // keep the nodes reachable from the root, in the same order
+    std::vector<char> live(top + 1, 0);
+    live[top] = 1;
+    for (Index k = top + 1; k-- > 0;)
+    {
+        if (!live[k])
+            continue;
+        Node const & node = optimized.nodes[k];
+        if (node.left != NONE)
+            live[node.left] = 1;
+        if (node.right != NONE)
+            live[node.right] = 1;
+    }
+
+    std::vector<Index> renumbered(top + 1, NONE);
+    nodes.clear();
+    for (Index k = 0; k <= top; ++k)
+    {
+        if (!live[k])
+            continue;
+        Node node = optimized.nodes[k];
+        if (node.left != NONE)
+            node.left = renumbered[node.left];
+        if (node.right != NONE)
+            node.right = renumbered[node.right];
+        renumbered[k] = static_cast<Index>(nodes.size());
+        nodes.push_back(node);
+    }
+    root = renumbered[top];
+}
+
+void Expression::compile(Program & program) const
+{
+    program.clear();
+
+    Schedule schedule(*this, root);
+    std::vector<Index> const & order = schedule.order;
+
+    // last instruction reading each value
+    std::vector<std::size_t> lastUse(order.size(), 0);
+    for (std::size_t k = 0; k < order.size(); ++k)
+    {
+        Node const & node = nodes[order[k]];
+        if (node.left != NONE)
+            lastUse[schedule.position[node.left]] = k;
+        if (node.right != NONE)
+            lastUse[schedule.position[node.right]] = k;
+    }
+
+    // linear scan allocation: registers of operands read for the last time are
+    // released before the result is assigned the lowest free one; everything
+    // but the root is dead at the end, so the result lands in register 0
+    std::vector<std::uint16_t> reg(order.size());
+    std::set<std::uint16_t> free;
+    std::size_t registerCount = 0;
+
+    for (std::size_t k = 0; k < order.size(); ++k)
+    {
+        Node const & node = nodes[order[k]];
+
+        std::uint16_t a = 0, b = 0;
+        if (node.left != NONE)
+        {
+            std::size_t p = schedule.position[node.left];
+            a = reg[p];
+            if (lastUse[p] == k)
+                free.insert(a);
+        }
+        if (node.right != NONE)
+        {
+            std::size_t p = schedule.position[node.right];
+            b = reg[p];
+            if (lastUse[p] == k)
+                free.insert(b);
+        }
+
+        if (free.empty())
+        {
+            if (registerCount > std::numeric_limits<std::uint16_t>::max())
+                throw std::invalid_argument("formula too complex");
+            free.insert(static_cast<std::uint16_t>(registerCount++));
+        }
+        std::uint16_t dst = *free.begin();
+        free.erase(free.begin());
+        reg[k] = dst;
+
+        if (node.parameter)
+            program.emit(OpCode::CONST, dst, program.addParameter(node.value));
+        else if (node.op == OpCode::CONST)
+            program.emit(OpCode::CONST, dst, program.addConstant(node.value));
+        else if (node.op == OpCode::POWI || node.op == OpCode::POWR)
+            program.emit(node.op, dst, a, program.addConstant(node.value));
+        else
+            program.emit(node.op, dst, a, b);
+    }
+
+    program.setRegisterCount(registerCount);
+}
+
+std::size_t tokenizeFormula(std::string const & formula)
+{
+    Lexer lexer(formula);
+    lexer.tokenize();
+    return static_cast<std::size_t>(lexer.end() - lexer.begin());
+}
+
+std::string canonicalFormula(std::string const & formula)
+{
+    Lexer lexer(formula);
+    lexer.tokenize();
+
+    std::string canonical;
+    bool word = false;
+    for (auto token = lexer.begin(); token != lexer.end(); ++token)
+    {
+        using Type = Lexer::Token::Type;
+
+        if (token->type == Type::NONE)
+            return formula;
+
+        // keep adjacent names and numbers apart
+        bool const nextWord = (token->type == Type::ID || token->type == Type::Z || token->type == Type::T ||
+                               token->type == Type::I || token->type == Type::REAL);
+        if (word && nextWord)
+            canonical += ' ';
+        word = nextWord;
+
+        if (token->type == Type::REAL)
+        {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.17g", std::strtod(token->value.c_str(), nullptr));
+            canonical += buffer;
+        }
+        else
+        {
+            canonical += token->value;
+        }
+    }
+
+    return canonical;
+}
+
+bool formulaUsesParameter(std::string const & formula)
+{
+    Lexer lexer(formula);
+    lexer.tokenize();
+
+    for (auto token = lexer.begin(); token != lexer.end(); ++token)
+    {
+        if (token->type == Lexer::Token::Type::T || token->type == Lexer::Token::Type::NONE)
+            return true;
+    }
+    return false;
+}
+
+bool formulaUsesExponential(std::string const & formula)
+{
+    Lexer lexer(formula);
+    lexer.tokenize();
+
+    // exp is the only function; a number after ^, bare or as (-n), makes
+    // POWI or POWR (EOD ends every formula, so the look-ahead stays in it)
+    using Type = Lexer::Token::Type;
+    for (auto token = lexer.begin(); token != lexer.end(); ++token)
+    {
+        if (token->type == Type::ID || token->type == Type::NONE)
+            return true;
+        if (token->type != Type::POW)
+            continue;
+
+        auto exponent = token + 1;
+        bool parenthesized = exponent->type == Type::LP;
+        if (parenthesized)
+            ++exponent;
+        if (parenthesized && exponent->type == Type::ADD)
+            ++exponent;
+        if (exponent->type != Type::REAL || (parenthesized && (exponent + 1)->type != Type::RP))
+            return true;
+    }
+    return false;
+}
+
+void parseFormula(std::string const & formula, Expression & expression)
 {
     Parser parser(formula);
+    parser.parse(expression);
+}
+
+bool Function::bound(ComplexInterval const & z, ComplexInterval & w) const
+{
+    // relative errors of the batch kernels are a few ulp, with ample margin
+    double const slack = (precision() == Precision::FLOAT) ? 1e-5 : 1e-13;
+    return expression.bound(z, slack, w);
+}
+
+void Function::fromFormula(std::string const & formula, bool optimize)
+{
     Expression new_expression;
-    parser.parse(new_expression);
+    parseFormula(formula, new_expression);
+    if (optimize)
+        new_expression.optimize();
+    Program new_program;
+    new_expression.compile(new_program);
     expression = std::move(new_expression);
+    program = std::move(new_program);
 }
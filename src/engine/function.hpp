@@ -2,67 +2,166 @@
 #define COMPLEXPLOT_FUNCTION_HPP
 
 #include <complex>
-#include <deque>
-#include <functional>
-#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <map>
 #include <string>
+#include <vector>
 
-using complex = std::complex<double>;
+#include "program.hpp"
 
+struct ComplexInterval;
+
+/*
+ *  Expression tree stored in a contiguous arena in post-order: every node
+ *  comes after its operands, which it refers to by 32-bit index, and the
+ *  root is the last node. Nodes are plain data (no per-node allocation), so
+ *  evaluating the whole tree is one linear pass over the arena.
+ */
 class Expression
 {
 public:
-    Expression() : root(nullptr) {}
-
-    using NodeFunction = std::function<complex(complex const &, complex const &)>;
+    using Index = std::uint32_t;
+    static constexpr Index NONE = std::numeric_limits<Index>::max();
 
     struct Node
     {
-        Node * left;
-        Node * right;
+        complex value;   // constant, parameter, or exponent of OpCode::POWI and OpCode::POWR
+        Index left;      // NONE for leaves
+        Index right;     // NONE for leaves and unary operators
+        OpCode op;
+        bool parameter;  // the free parameter t, an OpCode::CONST whose value setParameter changes
+    };
 
-        NodeFunction fun;
+    // appends a node; its operands must already be in the arena
+    Index new_Node(OpCode op, Index left = NONE, Index right = NONE, complex value = 0.0);
 
-        template <typename F>
-        Node(Node * left, Node * right, F && fun) :
-            left(left), right(right), fun(fun)
-        {}
-    };
+    // appends a leaf for the free parameter t with the value t
+    Index new_Parameter(complex const & t = 0.0);
 
-    void set_root(Node * root) { this->root = root; }
+    void set_root(Index root) { this->root = root; }
+    void reserve(std::size_t count) { nodes.reserve(count); }
 
-    complex eval(complex const & z) const { return eval(root, z); }
+    Node const & node(Index index) const { return nodes[index]; }
+    std::size_t size() const { return nodes.size(); }
 
-    template <typename ... Args>
-    Node * new_Node(Args && ... args)
-    {
-        memory.emplace_back(std::forward<Args>(args)...);
-        return &memory.back();
-    }
+    // operation of a node with operand values a and b (z for missing operands)
+    static complex apply(OpCode op, complex const & a, complex const & b, complex const & value);
+
+    // value of every parameter node, the free parameter t of the formula
+    void setParameter(complex const & t);
+
+    // reference evaluator
+    complex eval(complex const & z) const;
+
+    /*
+     *  Encloses the values of the expression over the rectangle z in w, each
+     *  node widened by slack relative to its magnitude for rounding (see
+     *  applyInterval). Returns false if some node has no finite enclosure.
+     */
+    bool bound(ComplexInterval const & z, double slack, ComplexInterval & w) const;
 
-    static std::map<std::string, NodeFunction> fun;
+    /*
+     *  Folds constant subtrees, drops identities (x*1, x/1, x+0, x-0, x^1)
+     *  and merges equal subtrees, turning the tree into a DAG. Nodes no
+     *  longer reachable from the root are removed.
+     */
+    void optimize();
+
+    // lower the expression into a flat register program; shared nodes are evaluated once
+    void compile(Program & program) const;
+
+    // builtin functions by name
+    static std::map<std::string, OpCode> fun;
 
 private:
-    static complex eval(Node * const node, complex const & z)
-    {
-        return (node == nullptr) ? z : std::proj(node->fun(eval(node->left, z), eval(node->right, z)));
-    }
+    std::vector<Node> nodes;
+    Index root = NONE;
 
-    std::deque<Node> memory;
-    Node * root;
+    complex run(complex const & z, complex * values) const;
 };
 
 
+/*
+ *  Front end stages of Function::fromFormula, exposed for benchmarking.
+ *  tokenizeFormula returns the number of tokens (including the end marker);
+ *  parseFormula builds the tree as parsed, before optimization.
+ *  parseFormula throws std::invalid_argument on syntax errors.
+ */
+std::size_t tokenizeFormula(std::string const & formula);
+void parseFormula(std::string const & formula, Expression & expression);
+
+/*
+ *  Formula text that is equal for formulas differing only in whitespace and
+ *  in the spelling of numbers (2, 2.0, 02), used as a cache key.
+ *  Formulas with unknown characters are returned as they are.
+ */
+std::string canonicalFormula(std::string const & formula);
+
+// true if the formula names the free parameter t, or cannot be read
+bool formulaUsesParameter(std::string const & formula);
+
+
 class Function
 {
 public:
-    void fromFormula(std::string const & formula);
+    // optimize = false keeps the parsed tree as is (generic operators only), for comparison
+    void fromFormula(std::string const & formula, bool optimize = true);
+
+    // backend of evalBatch; returns the one in use (JIT may be unavailable)
+    Backend setBackend(Backend backend) { return program.setBackend(backend); }
+    Backend backend() const { return program.getBackend(); }
+
+    // value of the free parameter t of the formula, 0 after fromFormula; cheap
+    // to change between frames, as the formula stays compiled
+    void setParameter(complex const & t)
+    {
+        expression.setParameter(t);
+        program.setParameter(t);
+    }
+
+    // arithmetic of evalBatch, DOUBLE, FLOAT or EXTENDED; set after fromFormula and
+    // before the backend, as native code is double only
+    void setPrecision(Precision precision) { program.setPrecision(precision); }
+    Precision precision() const { return program.getPrecision(); }
+
+    complex operator()(complex const & z) const { return program.eval(z); }
+
+    // vectorized evaluation of n points in split real/imaginary form;
+    // approximates operator() to a few ulp of the precision set (see batch.hpp);
+    // profile, if given, samples the time spent per operator
+    void evalBatch(double const * re, double const * im, double * outRe, double * outIm, std::size_t n,
+                   OperatorProfile * profile = nullptr) const
+    {
+        program.evalBatch(re, im, outRe, outIm, n, profile);
+    }
+
+    // the same at the double-double points re + reLo, im + imLo of a deep
+    // zoom; the low parts are only used in EXTENDED precision
+    void evalBatch(double const * re, double const * im, double const * reLo, double const * imLo,
+                   double * outRe, double * outIm, std::size_t n, OperatorProfile * profile = nullptr) const
+    {
+        program.evalBatch(re, im, reLo, imLo, outRe, outIm, n, profile);
+    }
+
+    // single precision evaluation, ~1e-7 relative error on well conditioned formulas
+    void evalBatch(float const * re, float const * im, float * outRe, float * outIm, std::size_t n,
+                   OperatorProfile * profile = nullptr) const
+    {
+        program.evalBatch(re, im, outRe, outIm, n, profile);
+    }
+
+    // evaluate by walking the parsed tree; bit-identical to operator()
+    complex evalReference(complex const & z) const { return expression.eval(z); }
 
-    complex operator()(complex const & z) const { return expression.eval(z); }
+    // encloses the values over the rectangle z, allowing for the rounding
+    // errors of evalBatch in the precision set; false if unbounded
+    bool bound(ComplexInterval const & z, ComplexInterval & w) const;
 
 private:
     Expression expression;
+    Program program;
 };
 
 #endif // COMPLEXPLOT_FUNCTION_HPP
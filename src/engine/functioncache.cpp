@@ -0,0 +1,70 @@
+#include <sstream>
+
+#include "functioncache.hpp"
+
+FunctionCache::FunctionCache(std::size_t capacity) :
+    capacity(capacity)
+{
+}
+
+std::shared_ptr<Function const> FunctionCache::get(PlotData const & plotData)
+{
+    std::string const k = key(plotData);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = index.find(k);
+        if (found != index.end())
+        {
+            entries.splice(entries.begin(), entries, found->second);
+            return entries.front().function;
+        }
+    }
+
+    // compiled outside of the lock; a concurrent miss of the same key compiles it twice
+    auto function = std::make_shared<Function>();
+    function->fromFormula(plotData.formula);
+    function->setParameter(plotData.parameter);
+    function->setPrecision(plotData.effectivePrecision());
+    function->setBackend(plotData.backend);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index.find(k) == index.end() && capacity > 0)
+    {
+        entries.push_front(Entry{k, function});
+        index[k] = entries.begin();
+        while (entries.size() > capacity)
+        {
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+    return function;
+}
+
+std::size_t FunctionCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return entries.size();
+}
+
+void FunctionCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+}
+
+std::string FunctionCache::key(PlotData const & plotData)
+{
+    // hexadecimal floats are exact
+    std::ostringstream key;
+    key << std::hexfloat
+        << canonicalFormula(plotData.formula)
+        << '|' << static_cast<int>(plotData.backend) << ' ' << static_cast<int>(plotData.effectivePrecision());
+
+    // as for the render cache, a parameter the formula does not use is left out
+    if (formulaUsesParameter(plotData.formula))
+        key << '|' << plotData.parameter;
+    return key.str();
+}
@@ -0,0 +1,54 @@
+#ifndef COMPLEXPLOT_FUNCTIONCACHE_HPP
+#define COMPLEXPLOT_FUNCTIONCACHE_HPP
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "function.hpp"
+#include "plotdata.hpp"
+
+/*
+ *  Least recently used cache of compiled functions, keyed by the canonical
+ *  formula, the parameter, the effective precision and the backend of a
+ *  plot, so that rendering a formula again skips parsing and native code
+ *  generation. The functions are shared and must not be changed; evaluating
+ *  one from several threads is fine. All methods are thread safe.
+ */
+class FunctionCache
+{
+public:
+    static std::size_t const DEFAULT_CAPACITY = 64;
+
+    explicit FunctionCache(std::size_t capacity = DEFAULT_CAPACITY);
+
+    /*
+     *  The function of plotData, set up as runRedraw does, compiled on a miss.
+     *  Throws std::invalid_argument on formula errors, which are not cached.
+     */
+    std::shared_ptr<Function const> get(PlotData const & plotData);
+
+    std::size_t size() const;
+    void clear();
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::shared_ptr<Function const> function;
+    };
+
+    static std::string key(PlotData const & plotData);
+
+    mutable std::mutex mutex;
+    std::size_t capacity;
+
+    // most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+#endif // COMPLEXPLOT_FUNCTIONCACHE_HPP
@@ -0,0 +1,27 @@
+#ifndef COMPLEXPLOT_IMAGE_HPP
+#define COMPLEXPLOT_IMAGE_HPP
+
+#include <cstddef>
+
+/*
+ *  Non-owning view of a packed 8-bit RGB (RGB888) image, e.g. the pixel
+ *  buffer of a QImage. Rows are 'stride' bytes apart.
+ *
+ *  A view may hold a band of a larger image: rows [top, top + height) of it,
+ *  with row top at data. Rows are always addressed by their image row.
+ *
+ *  The engine writes each tile's rectangle from exactly one thread and
+ *  never touches pixels outside of it, so concurrent tiles never share bytes.
+ */
+struct ImageView
+{
+    unsigned char * data;
+    std::ptrdiff_t stride;
+    int width;
+    int height;
+    int top = 0;
+
+    unsigned char * scanLine(int y) const { return data + (y - top)*stride; }
+};
+
+#endif // COMPLEXPLOT_IMAGE_HPP
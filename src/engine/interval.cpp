@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "interval.hpp"
+
+namespace {
+
+double const PI = 3.14159265358979323846;
+
+// 3/pi constant, hue per radian
+double const M_3_PI = 0.954929658551372015;
+
+// beyond this the argument reduction of cos and sin is not trusted
+double const MAX_TRIGONOMETRIC_ARGUMENT = 1e6;
+
+double magnitude(Interval const & x)
+{
+    return std::max(std::abs(x.lo), std::abs(x.hi));
+}
+
+double magnitude(ComplexInterval const & z)
+{
+    return std::max(magnitude(z.re), magnitude(z.im));
+}
+
+bool isFinite(Interval const & x)
+{
+    return std::isfinite(x.lo) && std::isfinite(x.hi);
+}
+
+Interval operator+(Interval const & x, Interval const & y)
+{
+    return {x.lo + y.lo, x.hi + y.hi};
+}
+
+Interval operator-(Interval const & x, Interval const & y)
+{
+    return {x.lo - y.hi, x.hi - y.lo};
+}
+
+Interval operator-(Interval const & x)
+{
+    return {-x.hi, -x.lo};
+}
+
+Interval operator*(Interval const & x, Interval const & y)
+{
+    double a = x.lo*y.lo, b = x.lo*y.hi, c = x.hi*y.lo, d = x.hi*y.hi;
+
+    // an overflowed bound times 0 must not be dropped by min and max
+    if (std::isnan(a + b + c + d))
+        return {-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity()};
+    return {std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d))};
+}
+
+Interval operator*(double s, Interval const & x)
+{
+    return (s >= 0.0) ? Interval{s*x.lo, s*x.hi} : Interval{s*x.hi, s*x.lo};
+}
+
+// x*x, tighter than x*x for intervals containing 0
+Interval square(Interval const & x)
+{
+    double a = x.lo*x.lo, b = x.hi*x.hi;
+    if (x.contains(0.0))
+        return {0.0, std::max(a, b)};
+    return {std::min(a, b), std::max(a, b)};
+}
+
+// 1/x for x not containing 0
+Interval reciprocal(Interval const & x)
+{
+    return {1.0/x.hi, 1.0/x.lo};
+}
+
+Interval cosine(Interval const & x)
+{
+    if (x.width() >= 2.0*PI || magnitude(x) > MAX_TRIGONOMETRIC_ARGUMENT)
+        return {-1.0, 1.0};
+
+    double a = std::cos(x.lo), b = std::cos(x.hi);
+    Interval result{std::min(a, b), std::max(a, b)};
+
+    // extrema at the multiples of pi inside
+    for (double k = std::ceil(x.lo/PI); k*PI <= x.hi; ++k)
+    {
+        if (std::fmod(k, 2.0) == 0.0)
+            result.hi = 1.0;
+        else
+            result.lo = -1.0;
+    }
+    return result;
+}
+
+Interval sine(Interval const & x)
+{
+    return cosine(x - Interval{0.5*PI, 0.5*PI});
+}
+
+ComplexInterval operator*(ComplexInterval const & a, ComplexInterval const & b)
+{
+    return {a.re*b.re - a.im*b.im, a.re*b.im + a.im*b.re};
+}
+
+ComplexInterval square(ComplexInterval const & a)
+{
+    return {square(a.re) - square(a.im), 2.0*(a.re*a.im)};
+}
+
+// 1/a = conj(a)/|a|^2 for a not containing 0
+ComplexInterval reciprocal(ComplexInterval const & a)
+{
+    Interval inverseNorm = reciprocal(square(a.re) + square(a.im));
+    return {a.re*inverseNorm, -(a.im*inverseNorm)};
+}
+
+// range of |z| over a rectangle
+Interval modulus(ComplexInterval const & z)
+{
+    double dx = (z.re.lo > 0.0) ? z.re.lo : (z.re.hi < 0.0) ? -z.re.hi : 0.0;
+    double dy = (z.im.lo > 0.0) ? z.im.lo : (z.im.hi < 0.0) ? -z.im.hi : 0.0;
+    return {std::hypot(dx, dy), std::hypot(magnitude(z.re), magnitude(z.im))};
+}
+
+// true if z meets the branch cut of arg, the non-positive real axis
+bool crossesCut(ComplexInterval const & z)
+{
+    return z.re.lo <= 0.0 && z.im.contains(0.0);
+}
+
+// range of arg z over a rectangle not crossing the cut: the extreme rays touch corners
+Interval argument(ComplexInterval const & z)
+{
+    double a = std::atan2(z.im.lo, z.re.lo), b = std::atan2(z.im.lo, z.re.hi);
+    double c = std::atan2(z.im.hi, z.re.lo), d = std::atan2(z.im.hi, z.re.hi);
+    return {std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d))};
+}
+
+ComplexInterval exponential(ComplexInterval const & a)
+{
+    Interval m{std::exp(a.re.lo), std::exp(a.re.hi)};
+    return {m*cosine(a.im), m*sine(a.im)};
+}
+
+// principal logarithm of a rectangle not crossing the cut
+ComplexInterval logarithm(ComplexInterval const & a)
+{
+    Interval r = modulus(a);
+    return {{std::log(r.lo), std::log(r.hi)}, argument(a)};
+}
+
+// a^n by repeated squaring, as powInt
+ComplexInterval power(ComplexInterval const & a, int n)
+{
+    unsigned m = (n < 0) ? 0u - static_cast<unsigned>(n) : static_cast<unsigned>(n);
+    ComplexInterval result{{1.0, 1.0}, {0.0, 0.0}};
+    ComplexInterval x = a;
+    bool first = true;
+    while (m != 0)
+    {
+        if ((m & 1) && first)
+        {
+            result = x;
+            first = false;
+        }
+        else if (m & 1)
+        {
+            result = result*x;
+        }
+        m >>= 1;
+        if (m != 0)
+            x = square(x);
+    }
+    return result;
+}
+
+} // namespace
+
+bool applyInterval(OpCode op, ComplexInterval const & a, ComplexInterval const & b, complex const & value,
+                   double slack, ComplexInterval & result)
+{
+    // scale of the rounding errors of the operation, in both evaluations
+    double scale = 0.0;
+
+    switch (op)
+    {
+    case OpCode::CONST:
+        result = {{value.real(), value.real()}, {value.imag(), value.imag()}};
+        return std::isfinite(value.real()) && std::isfinite(value.imag());
+    case OpCode::Z:
+        result = a;
+        return true;
+    case OpCode::NEG:
+        result = {-a.re, -a.im};
+        return true;
+    case OpCode::ADD:
+        result = {a.re + b.re, a.im + b.im};
+        scale = magnitude(a) + magnitude(b);
+        break;
+    case OpCode::SUB:
+        result = {a.re - b.re, a.im - b.im};
+        scale = magnitude(a) + magnitude(b);
+        break;
+    case OpCode::MUL:
+        result = a*b;
+        scale = 2.0*magnitude(a)*magnitude(b);
+        break;
+    case OpCode::DIV:
+        if (b.containsZero())
+            return false;
+        result = a*reciprocal(b);
+        scale = 2.0*magnitude(a)/modulus(b).lo;
+        break;
+    case OpCode::POW:
+    {
+        if (crossesCut(a))
+            return false;
+        ComplexInterval exponent = b*logarithm(a);
+        result = exponential(exponent);
+        scale = magnitude(result)*(1.0 + magnitude(exponent));
+        break;
+    }
+    case OpCode::POWI:
+    {
+        int n = static_cast<int>(value.real());
+        if (n < 0 && a.containsZero())
+            return false;
+        result = power(a, n);
+        if (n < 0)
+        {
+            if (result.containsZero())
+                return false;
+            result = reciprocal(result);
+        }
+        scale = std::abs(n)*magnitude(result);
+        break;
+    }
+    case OpCode::POWR:
+    {
+        if (crossesCut(a))
+            return false;
+        ComplexInterval l = logarithm(a);
+        ComplexInterval exponent{value.real()*l.re, value.real()*l.im};
+        result = exponential(exponent);
+        scale = magnitude(result)*(1.0 + magnitude(exponent));
+        break;
+    }
+    case OpCode::EXP:
+        result = exponential(a);
+        scale = magnitude(result)*(1.0 + magnitude(a));
+        break;
+    }
+
+    // widened for the rounding and approximation errors of both evaluations
+    double widen = slack*scale + std::numeric_limits<double>::min();
+    result.re.lo -= widen;
+    result.re.hi += widen;
+    result.im.lo -= widen;
+    result.im.hi += widen;
+
+    return isFinite(result.re) && isFinite(result.im);
+}
+
+double colorVariation_HL(ComplexInterval const & w, double a)
+{
+    if (w.containsZero() || !isFinite(w.re) || !isFinite(w.im))
+        return std::numeric_limits<double>::infinity();
+
+    // hue is 3/pi arg w; across the cut, where hue wraps around, -w has the same spread of arg
+    Interval arg = crossesCut(w) ? argument({-w.re, -w.im}) : argument(w);
+    double hueVariation = M_3_PI*arg.width();
+
+    // lightness 2/(|w|^a + 1) is monotonic in |w|
+    Interval r = modulus(w);
+    double l0 = 2.0/(std::pow(r.lo, a) + 1.0), l1 = 2.0/(std::pow(r.hi, a) + 1.0);
+    Interval l{std::min(l0, l1), std::max(l0, l1)};
+
+    // every component changes by at most the change of lightness plus the
+    // change of hue times the saturation q - p = 1 - |1 - l|
+    double saturation = l.contains(1.0) ? 1.0 : 1.0 - std::min(std::abs(1.0 - l.lo), std::abs(1.0 - l.hi));
+    return l.width() + saturation*hueVariation;
+}
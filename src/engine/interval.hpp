@@ -0,0 +1,41 @@
+#ifndef COMPLEXPLOT_INTERVAL_HPP
+#define COMPLEXPLOT_INTERVAL_HPP
+
+#include "program.hpp"
+
+// closed interval of reals, lo <= hi
+struct Interval
+{
+    double lo;
+    double hi;
+
+    double width() const { return hi - lo; }
+    bool contains(double x) const { return lo <= x && x <= hi; }
+};
+
+// axis-aligned rectangle of the complex plane
+struct ComplexInterval
+{
+    Interval re;
+    Interval im;
+
+    bool containsZero() const { return re.contains(0.0) && im.contains(0.0); }
+};
+
+/*
+ *  Encloses Expression::apply(op, a, b, value) over all a and b in the
+ *  operand rectangles, widened by slack relative to the magnitudes involved
+ *  for the rounding of both the interval and the point evaluation.
+ *  Returns false if no finite enclosure is found: an operand reaches a pole
+ *  or the branch cut of the logarithm (POW, POWR), or a bound overflows.
+ */
+bool applyInterval(OpCode op, ComplexInterval const & a, ComplexInterval const & b, complex const & value,
+                   double slack, ComplexInterval & result);
+
+/*
+ *  Upper bound of the change of any component of complex2rgb_HL (in [0.0, 1.0])
+ *  between two points of w, for lightness slope a; infinity if w contains 0.
+ */
+double colorVariation_HL(ComplexInterval const & w, double a);
+
+#endif // COMPLEXPLOT_INTERVAL_HPP
@@ -0,0 +1,853 @@
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <vector>
+
+#ifdef COMPLEXPLOT_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "batch.hpp"
+#include "jit.hpp"
+#include "program.hpp"
+
+#ifdef COMPLEXPLOT_JIT
+
+namespace {
+
+// general purpose registers
+int const RCX = 1;
+int const RDX = 2;
+int const RSI = 6;
+int const RDI = 7;
+int const R8 = 8;
+int const R9 = 9;
+
+// vcmppd predicates
+int const CMP_EQ = 0x00;  // EQ_OQ
+int const CMP_GE = 0x1D;  // GE_OQ
+
+// register file layout of Program::evalBatch, in bytes
+std::int32_t const REGISTER_STRIDE = 2*BATCH_SIZE*sizeof(double);
+std::int32_t const IMAG_OFFSET = BATCH_SIZE*sizeof(double);
+
+std::uint64_t const ABS_MASK = 0x7FFFFFFFFFFFFFFFull;
+
+std::size_t const NONE = std::numeric_limits<std::size_t>::max();
+
+// [rbx + rax + disp]: the current lanes of the register file, or
+// [rip + ...]: a pool constant (disp is the pool entry)
+struct Mem
+{
+    bool pool;
+    std::int32_t disp;
+};
+
+Mem lanes(std::int32_t offset) { return Mem{false, offset}; }
+Mem entry(std::int32_t e) { return Mem{true, e}; }
+
+/*
+ *  Encoder for the few instructions the compiler needs. Vector instructions
+ *  are emitted as AVX2 (VEX, ymm) or, when wide, as AVX-512 (EVEX, zmm).
+ *  Masks are vector registers with AVX2 and opmask registers with AVX-512.
+ */
+class Assembler
+{
+public:
+    explicit Assembler(bool wide) : wide(wide) {}
+
+    bool const wide;
+    std::vector<std::uint8_t> code;
+
+    void load(int dst, Mem const & m) { vector(1, false, 0x10, dst, 0, m); }
+    void store(Mem const & m, int src) { vector(1, false, 0x11, src, 0, m); }
+    void mov(int dst, int src) { vector(1, false, 0x28, dst, 0, src); }
+
+    template <typename Src> void andpd(int dst, int a, Src b) { vector(1, false, 0x54, dst, a, b); }
+    template <typename Src> void orpd(int dst, int a, Src b) { vector(1, false, 0x56, dst, a, b); }
+    template <typename Src> void xorpd(int dst, int a, Src b) { vector(1, false, 0x57, dst, a, b); }
+    template <typename Src> void addpd(int dst, int a, Src b) { vector(1, false, 0x58, dst, a, b); }
+    template <typename Src> void mulpd(int dst, int a, Src b) { vector(1, false, 0x59, dst, a, b); }
+    template <typename Src> void subpd(int dst, int a, Src b) { vector(1, false, 0x5C, dst, a, b); }
+    template <typename Src> void divpd(int dst, int a, Src b) { vector(1, false, 0x5E, dst, a, b); }
+
+    // dst = a*b + dst, dst = a*b - dst, dst = -(a*b) + dst
+    void fmadd231pd(int dst, int a, int b) { vector(2, true, 0xB8, dst, a, b); }
+    void fmsub231pd(int dst, int a, int b) { vector(2, true, 0xBA, dst, a, b); }
+    void fnmadd231pd(int dst, int a, int b) { vector(2, true, 0xBC, dst, a, b); }
+
+    // mask = a <predicate> b
+    template <typename Src>
+    void compare(int mask, int a, Src b, int predicate)
+    {
+        vector(1, false, 0xC2, mask, a, b, predicate);
+    }
+
+    // mask = a is infinite
+    void isInf(int mask, int a, Mem const & absMask, Mem const & inf)
+    {
+        if (wide)
+        {
+            evex(3, 0x66, mask, 0, a, 0x18);  // vfpclasspd: +inf or -inf
+            return;
+        }
+        andpd(mask, a, absMask);
+        compare(mask, mask, inf, CMP_EQ);
+    }
+
+    // dst = mask ? b : a
+    template <typename Src>
+    void blend(int dst, int a, Src b, int mask)
+    {
+        if (wide)
+            evex(2, 0x65, dst, a, b, -1, mask);  // vblendmpd
+        else
+            vex(3, false, 0x4B, dst, a, b, mask << 4);  // vblendvpd
+    }
+
+    void maskAnd(int dst, int a, int b)
+    {
+        if (wide)
+            maskOp(0x41, dst, a, b);  // kandb
+        else
+            andpd(dst, a, b);
+    }
+
+    void maskOr(int dst, int a, int b)
+    {
+        if (wide)
+            maskOp(0x45, dst, a, b);  // korb
+        else
+            orpd(dst, a, b);
+    }
+
+    void vzeroupper() { byte(0xC5); byte(0xF8); byte(0x77); }
+
+    void pushRbx() { byte(0x53); }
+    void popRbx() { byte(0x5B); }
+    void ret() { byte(0xC3); }
+    void movRbxRdi() { byte(0x48); byte(0x89); byte(0xFB); }
+    void xorEaxEax() { byte(0x31); byte(0xC0); }
+    void addRax(std::int8_t imm) { byte(0x48); byte(0x83); byte(0xC0); byte(imm); }
+    void cmpRax(std::int32_t imm) { byte(0x48); byte(0x3D); dword(imm); }
+
+    void jne(std::size_t target)
+    {
+        byte(0x0F);
+        byte(0x85);
+        dword(static_cast<std::int32_t>(target - (code.size() + 4)));
+    }
+
+    // lea reg, [rbx + disp]
+    void lea(int reg, std::int32_t disp)
+    {
+        byte((reg >= 8) ? 0x4C : 0x48);
+        byte(0x8D);
+        byte(0x80 | (reg & 7) << 3 | 3);
+        dword(disp);
+    }
+
+    // mov rax, address; call rax
+    void call(void const * function)
+    {
+        std::uint64_t address = reinterpret_cast<std::uintptr_t>(function);
+        byte(0x48);
+        byte(0xB8);
+        for (int k = 0; k < 8; ++k)
+            byte(static_cast<std::uint8_t>(address >> 8*k));
+        byte(0xFF);
+        byte(0xD0);
+    }
+
+    // resolve pool references; entry e lives at poolOffset + e*entrySize
+    void link(std::size_t poolOffset, std::size_t entrySize)
+    {
+        for (Fixup const & fixup : fixups)
+        {
+            std::size_t target = poolOffset + entrySize*fixup.entry;
+            auto disp = static_cast<std::int32_t>(target - (fixup.position + fixup.length));
+            std::memcpy(&code[fixup.position], &disp, sizeof(disp));
+        }
+    }
+
+private:
+    // a RIP-relative displacement at position, followed by length - 4 more bytes
+    struct Fixup
+    {
+        std::size_t position;
+        unsigned length;
+        std::int32_t entry;
+    };
+
+    std::vector<Fixup> fixups;
+
+    void byte(int b) { code.push_back(static_cast<std::uint8_t>(b)); }
+
+    void dword(std::int32_t d)
+    {
+        for (int k = 0; k < 4; ++k)
+            byte(static_cast<std::uint8_t>(static_cast<std::uint32_t>(d) >> 8*k));
+    }
+
+    // packed double instruction in the width of the target; map 1 = 0F, 2 = 0F38, 3 = 0F3A;
+    // the EVEX forms of all instructions used here have W1
+    template <typename Src>
+    void vector(int map, bool w, int opcode, int reg, int vvvv, Src const & rm, int imm = -1)
+    {
+        if (wide)
+            evex(map, opcode, reg, vvvv, rm, imm);
+        else
+            vex(map, w, opcode, reg, vvvv, rm, imm);
+    }
+
+    // VEX.256.66
+    template <typename Src>
+    void vex(int map, bool w, int opcode, int reg, int vvvv, Src const & rm, int imm = -1)
+    {
+        byte(0xC4);
+        byte(((reg & 8) ? 0 : 0x80) | 0x40 | (extended(rm) ? 0 : 0x20) | map);
+        byte((w ? 0x80 : 0) | (~vvvv & 15) << 3 | 0x04 | 0x01);
+        byte(opcode);
+        operand(reg, rm, imm);
+    }
+
+    // EVEX.512.66.W1, with opmask register aaa
+    template <typename Src>
+    void evex(int map, int opcode, int reg, int vvvv, Src const & rm, int imm = -1, int aaa = 0)
+    {
+        byte(0x62);
+        byte(((reg & 8) ? 0 : 0x80) | (high(rm) ? 0 : 0x40) | (extended(rm) ? 0 : 0x20) |
+             ((reg & 16) ? 0 : 0x10) | map);
+        byte(0x80 | (~vvvv & 15) << 3 | 0x04 | 0x01);
+        byte(0x40 | ((vvvv & 16) ? 0 : 0x08) | aaa);
+        byte(opcode);
+        operand(reg, rm, imm);
+    }
+
+    // VEX.L1.66.0F.W0 opmask instruction
+    void maskOp(int opcode, int dst, int a, int b)
+    {
+        byte(0xC4);
+        byte(0xE1);
+        byte((~a & 15) << 3 | 0x04 | 0x01);
+        byte(opcode);
+        byte(0xC0 | dst << 3 | b);
+    }
+
+    static bool extended(int rm) { return (rm & 8) != 0; }
+    static bool extended(Mem const &) { return false; }
+    static bool high(int rm) { return (rm & 16) != 0; }
+    static bool high(Mem const &) { return false; }
+
+    // ModRM (and SIB, displacement) and immediate
+    void operand(int reg, int rm, int imm)
+    {
+        byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+        if (imm >= 0)
+            byte(imm);
+    }
+
+    void operand(int reg, Mem const & m, int imm)
+    {
+        if (m.pool)
+        {
+            byte((reg & 7) << 3 | 5);
+            fixups.push_back(Fixup{code.size(), (imm >= 0) ? 5u : 4u, m.disp});
+            dword(0);
+        }
+        else
+        {
+            byte(0x80 | (reg & 7) << 3 | 4);
+            byte(0x03);  // SIB: rbx + rax
+            dword(m.disp);
+        }
+        if (imm >= 0)
+            byte(imm);
+    }
+};
+
+// exp and the general powers call the batch kernels, everything else is inlined
+bool isCall(OpCode op)
+{
+    return op == OpCode::EXP || op == OpCode::POW || op == OpCode::POWR;
+}
+
+int operandCount(OpCode op)
+{
+    switch (op)
+    {
+    case OpCode::CONST:
+    case OpCode::Z:
+        return 0;
+    case OpCode::NEG:
+    case OpCode::EXP:
+    case OpCode::POWI:
+    case OpCode::POWR:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+class Compiler
+{
+public:
+    Compiler(std::vector<Program::Instruction> const & code, std::vector<complex> const & constants,
+             std::size_t registerCount, bool wide);
+
+    // machine code followed by its constant pool
+    std::vector<std::uint8_t> generate();
+
+private:
+    // value cached in a register pair; values are named by their defining instruction
+    struct Slot
+    {
+        std::size_t value = NONE;
+        bool dirty = false;  // not yet stored to the register file
+    };
+
+    std::vector<Program::Instruction> const & code;
+    std::vector<complex> const & constants;
+    std::size_t const registerCount;  // the projected input z follows the last register
+
+    Assembler as;
+
+    // register pairs caching values, then scratch registers; every inline
+    // instruction leaves its result in (OUT_RE, OUT_IM)
+    int const PAIRS;
+    int const M0, M1;
+    int const T2, T3, T4, T5;
+    int const OUT_RE, OUT_IM;
+    std::int8_t const LANE_BYTES;
+
+    std::vector<double> pool;
+    std::map<std::uint64_t, std::int32_t> poolEntries;
+
+    // per instruction: readers of its value, and whether a later loop needs it in memory
+    std::vector<std::vector<std::size_t>> uses;
+    std::vector<bool> liveOut;
+
+    std::vector<std::size_t> currentDef;
+    std::vector<Slot> slots;
+
+    Mem constant(double d);
+    Mem constantBits(std::uint64_t bits);
+
+    static std::int32_t re(std::size_t r) { return static_cast<std::int32_t>(r)*REGISTER_STRIDE; }
+    static std::int32_t im(std::size_t r) { return re(r) + IMAG_OFFSET; }
+
+    void analyze();
+    void inlineSegment(std::size_t begin, std::size_t end);
+    void callInstruction(std::size_t j);
+
+    std::size_t nextUse(std::size_t value, std::size_t from) const;
+    int operand(std::uint16_t reg, unsigned & locked, std::size_t j);
+    int allocate(unsigned locked, std::size_t from);
+    void define(std::size_t j);
+
+    void multiply(int ar, int ai, int br, int bi);
+    void divide(int ar, int ai, int br, int bi);
+    void power(int ar, int ai, int n, unsigned locked, std::size_t j);
+    void project();
+};
+
+Compiler::Compiler(std::vector<Program::Instruction> const & code, std::vector<complex> const & constants,
+                   std::size_t registerCount, bool wide) :
+    code(code),
+    constants(constants),
+    registerCount(registerCount),
+    as(wide),
+    // AVX2: ymm0 - ymm7 cache, masks in ymm8 and ymm9;
+    // AVX-512: zmm0 - zmm23 cache, masks in k1 and k2
+    PAIRS(wide ? 12 : 4),
+    M0(wide ? 1 : 8), M1(wide ? 2 : 9),
+    T2(wide ? 26 : 10), T3(wide ? 27 : 11), T4(wide ? 28 : 12), T5(wide ? 29 : 13),
+    OUT_RE(wide ? 30 : 14), OUT_IM(wide ? 31 : 15),
+    LANE_BYTES(wide ? 64 : 32),
+    slots(PAIRS)
+{
+}
+
+Mem Compiler::constant(double d)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    return constantBits(bits);
+}
+
+// pool entries fill a whole vector register
+Mem Compiler::constantBits(std::uint64_t bits)
+{
+    auto it = poolEntries.find(bits);
+    if (it != poolEntries.end())
+        return entry(it->second);
+
+    double d;
+    std::memcpy(&d, &bits, sizeof(d));
+    std::size_t const lanes = LANE_BYTES/sizeof(double);
+    auto e = static_cast<std::int32_t>(pool.size()/lanes);
+    pool.insert(pool.end(), lanes, d);
+    poolEntries.emplace(bits, e);
+    return entry(e);
+}
+
+void Compiler::analyze()
+{
+    // loops: maximal runs of inline instructions; each call is a loop of its own
+    std::vector<std::size_t> segment(code.size());
+    for (std::size_t j = 0; j < code.size(); ++j)
+    {
+        bool fresh = (j == 0) || isCall(code[j].op) || isCall(code[j - 1].op);
+        segment[j] = (j == 0) ? 0 : segment[j - 1] + (fresh ? 1 : 0);
+    }
+
+    uses.assign(code.size(), std::vector<std::size_t>());
+    liveOut.assign(code.size(), false);
+    currentDef.assign(registerCount, NONE);
+
+    for (std::size_t j = 0; j < code.size(); ++j)
+    {
+        Program::Instruction const & in = code[j];
+        int count = operandCount(in.op);
+        for (int k = 0; k < count; ++k)
+        {
+            std::size_t def = currentDef[(k == 0) ? in.a : in.b];
+            if (uses[def].empty() || uses[def].back() != j)
+                uses[def].push_back(j);
+            if (segment[def] != segment[j])
+                liveOut[def] = true;
+        }
+        currentDef[in.dst] = j;
+    }
+
+    // the result
+    liveOut[currentDef[0]] = true;
+}
+
+std::vector<std::uint8_t> Compiler::generate()
+{
+    analyze();
+    currentDef.assign(registerCount, NONE);
+
+    as.pushRbx();
+    as.movRbxRdi();
+
+    std::size_t begin = 0;
+    while (begin < code.size())
+    {
+        if (isCall(code[begin].op))
+        {
+            callInstruction(begin);
+            ++begin;
+            continue;
+        }
+
+        std::size_t end = begin;
+        while (end < code.size() && !isCall(code[end].op))
+            ++end;
+        inlineSegment(begin, end);
+        begin = end;
+    }
+
+    as.vzeroupper();
+    as.popRbx();
+    as.ret();
+
+    // pool after the code, aligned to its entries
+    std::size_t poolOffset = (as.code.size() + LANE_BYTES - 1)/LANE_BYTES*LANE_BYTES;
+    as.link(poolOffset, LANE_BYTES);
+
+    std::vector<std::uint8_t> bytes = as.code;
+    bytes.resize(poolOffset, 0xCC);
+    bytes.resize(poolOffset + pool.size()*sizeof(double));
+    if (!pool.empty())
+        std::memcpy(&bytes[poolOffset], pool.data(), pool.size()*sizeof(double));
+
+    return bytes;
+}
+
+void Compiler::callInstruction(std::size_t j)
+{
+    Program::Instruction const & in = code[j];
+    BatchKernels const & kernels = batchKernels();
+
+    // operands were stored by the loops that computed them
+    as.lea(RDI, re(in.a));
+    as.lea(RSI, im(in.a));
+
+    switch (in.op)
+    {
+    case OpCode::EXP:
+        as.lea(RDX, re(in.dst));
+        as.lea(RCX, im(in.dst));
+        as.vzeroupper();
+        as.call(reinterpret_cast<void const *>(kernels.exp));
+        break;
+    case OpCode::POW:
+        as.lea(RDX, re(in.b));
+        as.lea(RCX, im(in.b));
+        as.lea(R8, re(in.dst));
+        as.lea(R9, im(in.dst));
+        as.vzeroupper();
+        as.call(reinterpret_cast<void const *>(kernels.pow));
+        break;
+    case OpCode::POWR:
+        as.lea(RDX, re(in.dst));
+        as.lea(RCX, im(in.dst));
+        as.load(0, constant(constants[in.b].real()));  // the exponent goes in xmm0
+        as.vzeroupper();
+        as.call(reinterpret_cast<void const *>(kernels.powr));
+        break;
+    default:
+        break;
+    }
+
+    currentDef[in.dst] = j;
+}
+
+void Compiler::inlineSegment(std::size_t begin, std::size_t end)
+{
+    for (Slot & slot : slots)
+        slot = Slot();
+
+    as.xorEaxEax();
+    std::size_t top = as.code.size();
+
+    for (std::size_t j = begin; j < end; ++j)
+    {
+        Program::Instruction const & in = code[j];
+
+        unsigned locked = 0;
+        int a = 0, b = 0;
+        if (operandCount(in.op) >= 1)
+            a = operand(in.a, locked, j);
+        if (operandCount(in.op) >= 2)
+            b = operand(in.b, locked, j);
+
+        int const ar = 2*a, ai = 2*a + 1;
+        int const br = 2*b, bi = 2*b + 1;
+
+        switch (in.op)
+        {
+        case OpCode::CONST:
+            as.load(OUT_RE, constant(constants[in.a].real()));
+            as.load(OUT_IM, constant(constants[in.a].imag()));
+            break;
+        case OpCode::Z:
+            as.load(OUT_RE, lanes(re(registerCount)));
+            as.load(OUT_IM, lanes(im(registerCount)));
+            break;
+        case OpCode::NEG:
+            as.xorpd(OUT_RE, ar, constant(-0.0));
+            as.xorpd(OUT_IM, ai, constant(-0.0));
+            break;
+        case OpCode::ADD:
+            as.addpd(OUT_RE, ar, br);
+            as.addpd(OUT_IM, ai, bi);
+            break;
+        case OpCode::SUB:
+            as.subpd(OUT_RE, ar, br);
+            as.subpd(OUT_IM, ai, bi);
+            break;
+        case OpCode::MUL:
+            multiply(ar, ai, br, bi);
+            break;
+        case OpCode::DIV:
+            divide(ar, ai, br, bi);
+            break;
+        case OpCode::POWI:
+            power(ar, ai, static_cast<int>(constants[in.b].real()), locked, j);
+            break;
+        default:
+            break;
+        }
+
+        // constants and z are stored projected already
+        if (in.op != OpCode::CONST && in.op != OpCode::Z)
+            project();
+
+        define(j);
+    }
+
+    // values needed by later loops
+    for (int p = 0; p < PAIRS; ++p)
+    {
+        if (slots[p].value != NONE && slots[p].dirty && liveOut[slots[p].value])
+        {
+            as.store(lanes(re(code[slots[p].value].dst)), 2*p);
+            as.store(lanes(im(code[slots[p].value].dst)), 2*p + 1);
+        }
+    }
+
+    as.addRax(LANE_BYTES);
+    as.cmpRax(IMAG_OFFSET);
+    as.jne(top);
+}
+
+std::size_t Compiler::nextUse(std::size_t value, std::size_t from) const
+{
+    for (std::size_t use : uses[value])
+        if (use >= from)
+            return use;
+    return NONE;
+}
+
+int Compiler::operand(std::uint16_t reg, unsigned & locked, std::size_t j)
+{
+    std::size_t value = currentDef[reg];
+
+    int p = 0;
+    while (p < PAIRS && slots[p].value != value)
+        ++p;
+
+    if (p == PAIRS)
+    {
+        p = allocate(locked, j);
+        as.load(2*p, lanes(re(reg)));
+        as.load(2*p + 1, lanes(im(reg)));
+        slots[p].value = value;
+        slots[p].dirty = false;
+    }
+
+    locked |= 1u << p;
+    return p;
+}
+
+// a free pair, or the one whose value is needed last; values still needed are written back
+int Compiler::allocate(unsigned locked, std::size_t from)
+{
+    int best = -1;
+    std::size_t bestUse = 0;
+    for (int p = 0; p < PAIRS; ++p)
+    {
+        if (locked & (1u << p))
+            continue;
+        if (slots[p].value == NONE)
+            return p;
+
+        std::size_t use = nextUse(slots[p].value, from);
+        if (best < 0 || use > bestUse)
+        {
+            best = p;
+            bestUse = use;
+        }
+        if (use == NONE)
+            break;
+    }
+
+    Slot & slot = slots[best];
+    if (slot.dirty && (bestUse != NONE || liveOut[slot.value]))
+    {
+        as.store(lanes(re(code[slot.value].dst)), 2*best);
+        as.store(lanes(im(code[slot.value].dst)), 2*best + 1);
+    }
+    slot = Slot();
+    return best;
+}
+
+void Compiler::define(std::size_t j)
+{
+    int p = allocate(0, j + 1);
+    as.mov(2*p, OUT_RE);
+    as.mov(2*p + 1, OUT_IM);
+    slots[p].value = j;
+    slots[p].dirty = true;
+    currentDef[code[j].dst] = j;
+}
+
+void Compiler::multiply(int ar, int ai, int br, int bi)
+{
+    as.mulpd(OUT_RE, ai, bi);
+    as.fmsub231pd(OUT_RE, ar, br);
+    as.mulpd(OUT_IM, ai, br);
+    as.fmadd231pd(OUT_IM, ar, bi);
+}
+
+// Smith's algorithm as in the batch kernels; operands must be cached pairs
+void Compiler::divide(int ar, int ai, int br, int bi)
+{
+    int const big = T2, ratio = T3, t = T4;
+
+    as.andpd(big, br, constantBits(ABS_MASK));
+    as.andpd(t, bi, constantBits(ABS_MASK));
+    as.compare(M0, big, t, CMP_GE);          // |br| >= |bi|
+    as.blend(big, bi, br, M0);
+    as.blend(t, br, bi, M0);                 // small
+    as.divpd(ratio, t, big);
+    as.fmadd231pd(big, t, ratio);            // denominator
+
+    as.mov(OUT_RE, ar);
+    as.fmadd231pd(OUT_RE, ai, ratio);        // ar + ai*ratio
+    as.mov(t, ai);
+    as.fmadd231pd(t, ar, ratio);             // ar*ratio + ai
+    as.blend(OUT_RE, t, OUT_RE, M0);
+
+    as.mov(OUT_IM, ai);
+    as.fnmadd231pd(OUT_IM, ar, ratio);       // ai - ar*ratio
+    as.mov(t, ar);
+    as.fmsub231pd(t, ai, ratio);             // ai*ratio - ar
+    as.blend(OUT_IM, t, OUT_IM, M0);
+
+    as.divpd(OUT_RE, OUT_RE, big);
+    as.divpd(OUT_IM, OUT_IM, big);
+
+    // division by zero gives infinity (or NaN for 0/0)
+    as.compare(M0, br, constant(0.0), CMP_EQ);
+    as.compare(M1, bi, constant(0.0), CMP_EQ);
+    as.maskAnd(M0, M0, M1);
+    as.andpd(ratio, br, constant(-0.0));
+    as.orpd(ratio, ratio, constant(std::numeric_limits<double>::infinity()));
+    as.mulpd(t, ratio, ar);
+    as.blend(OUT_RE, OUT_RE, t, M0);
+    as.mulpd(t, ratio, ai);
+    as.blend(OUT_IM, OUT_IM, t, M0);
+}
+
+// a^n unrolled into squarings and multiplications, for n < 0 followed by a division
+void Compiler::power(int ar, int ai, int n, unsigned locked, std::size_t j)
+{
+    // x in OUT, result in (T4, T5)
+    as.mov(OUT_RE, ar);
+    as.mov(OUT_IM, ai);
+    as.load(T4, constant(1.0));
+    as.load(T5, constant(0.0));
+
+    unsigned m = (n < 0) ? 0u - static_cast<unsigned>(n) : static_cast<unsigned>(n);
+    bool first = true;
+    while (m != 0)
+    {
+        if (m & 1)
+        {
+            if (first)
+            {
+                as.mov(T4, OUT_RE);
+                as.mov(T5, OUT_IM);
+                first = false;
+            }
+            else
+            {
+                as.mulpd(T2, T5, OUT_IM);
+                as.mulpd(T3, T5, OUT_RE);
+                as.fmadd231pd(T3, T4, OUT_IM);
+                as.fmsub231pd(T2, T4, OUT_RE);
+                as.mov(T4, T2);
+                as.mov(T5, T3);
+            }
+        }
+        m >>= 1;
+        if (m != 0)
+        {
+            as.mulpd(T2, OUT_IM, OUT_IM);
+            as.mulpd(T3, OUT_RE, OUT_IM);
+            as.fmsub231pd(T2, OUT_RE, OUT_RE);
+            as.mov(OUT_RE, T2);
+            as.addpd(OUT_IM, T3, T3);
+        }
+    }
+
+    if (n >= 0)
+    {
+        as.mov(OUT_RE, T4);
+        as.mov(OUT_IM, T5);
+        return;
+    }
+
+    // 1/result; divide() takes its operands from cached pairs, which are borrowed here
+    int p = allocate(locked, j + 1);
+    int q = allocate(locked | 1u << p, j + 1);
+    as.load(2*p, constant(1.0));
+    as.load(2*p + 1, constant(0.0));
+    as.mov(2*q, T4);
+    as.mov(2*q + 1, T5);
+    divide(2*p, 2*p + 1, 2*q, 2*q + 1);
+}
+
+// std::proj of OUT, as done by the store of the batch kernels
+void Compiler::project()
+{
+    Mem const inf = constant(std::numeric_limits<double>::infinity());
+
+    as.isInf(M0, OUT_RE, constantBits(ABS_MASK), inf);
+    as.isInf(M1, OUT_IM, constantBits(ABS_MASK), inf);
+    as.maskOr(M0, M0, M1);
+    as.blend(OUT_RE, OUT_RE, inf, M0);
+    as.andpd(T2, OUT_IM, constant(-0.0));
+    as.blend(OUT_IM, OUT_IM, T2, M0);
+}
+
+bool wideAvailable()
+{
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+}
+
+} // namespace
+
+NativeCode::NativeCode(void * memory, std::size_t size) :
+    memory(memory),
+    size(size),
+    entry(reinterpret_cast<Entry>(memory))
+{
+}
+
+NativeCode::~NativeCode()
+{
+    munmap(memory, size);
+}
+
+std::unique_ptr<NativeCode> NativeCode::compile(Program const & program)
+{
+    if (!available() || program.code.empty())
+        return nullptr;
+
+    Compiler compiler(program.code, program.constants, program.registerCount, wideAvailable());
+    std::vector<std::uint8_t> bytes = compiler.generate();
+
+    // written while writable, then flipped to executable
+    std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    std::size_t size = (bytes.size() + page - 1)/page*page;
+    void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+
+    std::memcpy(memory, bytes.data(), bytes.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        return nullptr;
+    }
+
+    return std::unique_ptr<NativeCode>(new NativeCode(memory, size));
+}
+
+bool NativeCode::available()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+#else // COMPLEXPLOT_JIT
+
+NativeCode::NativeCode(void * memory, std::size_t size) :
+    memory(memory),
+    size(size),
+    entry(nullptr)
+{
+}
+
+NativeCode::~NativeCode()
+{
+}
+
+std::unique_ptr<NativeCode> NativeCode::compile(Program const &)
+{
+    return nullptr;
+}
+
+bool NativeCode::available()
+{
+    return false;
+}
+
+#endif // COMPLEXPLOT_JIT
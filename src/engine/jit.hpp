@@ -0,0 +1,45 @@
+#ifndef COMPLEXPLOT_JIT_HPP
+#define COMPLEXPLOT_JIT_HPP
+
+#include <cstddef>
+#include <memory>
+
+class Program;
+
+/*
+ *  x86-64 machine code for the batch evaluation of a Program.
+ *
+ *  The generated function evaluates the program over one batch of
+ *  BATCH_SIZE lanes, reading and writing the register file laid out as in
+ *  Program::evalBatch. Runs of arithmetic instructions (including division
+ *  and integer powers) are fused into a single loop over groups of lanes
+ *  kept in AVX-512 or AVX2 registers; exp and the general powers call the
+ *  batch kernels. Results agree with the batch kernels to a few ulp.
+ */
+class NativeCode
+{
+public:
+    using Entry = void (*)(double * registers);
+
+    ~NativeCode();
+
+    NativeCode(NativeCode const &) = delete;
+    NativeCode & operator=(NativeCode const &) = delete;
+
+    // nullptr if no native code can be generated here
+    static std::unique_ptr<NativeCode> compile(Program const & program);
+
+    // built for x86-64 and running on a CPU with AVX2 and FMA (AVX-512 is used if present)
+    static bool available();
+
+    void run(double * registers) const { entry(registers); }
+
+private:
+    NativeCode(void * memory, std::size_t size);
+
+    void * memory;
+    std::size_t size;
+    Entry entry;
+};
+
+#endif // COMPLEXPLOT_JIT_HPP
@@ -3,11 +3,38 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <string>
 
+#include "doubledouble.hpp"
+#include "profile.hpp"
+
+// evaluator of the formula for whole rows of pixels
+enum class Backend { INTERPRETER, JIT };
+
+// arithmetic of the evaluation and coloring. EXTENDED is double-double, from
+// the coordinates of the pixels on; DOUBLE turns into it where the viewport
+// is too narrow for double, and AUTO is FLOAT unless the viewport is too
+// narrow for that. FLOAT and AUTO are DOUBLE for formulas with exponentials
+// (see PlotData::effectivePrecision)
+enum class Precision { DOUBLE, FLOAT, EXTENDED, AUTO };
+
+// true if the formula takes exp or a power with an exponent other than a
+// number, or cannot be read (in function.cpp, with the lexer)
+bool formulaUsesExponential(std::string const & formula);
+
+// smallest pixel spacing, relative to the largest coordinate of the viewport,
+// rendered in single precision by Precision::AUTO (about 80 float ulps)
+double const FLOAT_MIN_PIXEL_SPACING = 1e-5;
+
+// the same for double precision (about 90 double ulps), below which DOUBLE
+// and AUTO render in EXTENDED precision
+double const DOUBLE_MIN_PIXEL_SPACING = 2e-14;
+
 struct PlotData
 {
     std::string formula;
+    double parameter = 0.0;  // value of the free parameter t of the formula
 
     double reMin;
     double reMax;
@@ -20,8 +47,27 @@ struct PlotData
     int coloringMethod;
     double colorSlope;
 
+    Backend backend = Backend::INTERPRETER;  // JIT falls back to the interpreter where unavailable
+    Precision precision = Precision::DOUBLE;  // native code is double only
+
+    // adaptive anti-aliasing: samples per axis of refined pixels (odd, 1: off)
+    // and the neighbourhood variance of lightness or hue that triggers it
+    int antialiasing = 1;
+    double antialiasingThreshold = 0.002;
+
+    // fill regions whose colors provably vary by less than one quantization
+    // step by interpolation from their corners (see renderRegions)
+    bool interpolation = false;
+
     void image2complex(int x, int y, double & re, double & im) const;
     void complex2image(double re, double im, int & x, int & y) const;
+
+    // image2complex in double-double precision, re + reLo and im + imLo, for
+    // Precision::EXTENDED; re and im are those of image2complex within rounding
+    void image2complex(int x, int y, double & re, double & im, double & reLo, double & imLo) const;
+
+    // DOUBLE, FLOAT or EXTENDED, resolving AUTO and the depth of the zoom
+    Precision effectivePrecision() const;
 };
 
 inline void PlotData::image2complex(int x, int y, double & re, double & im) const
@@ -30,6 +76,17 @@ inline void PlotData::image2complex(int x, int y, double & re, double & im) cons
     im = (imMin*(y + 0.5) + imMax*(imageHeight - y - 0.5))/imageHeight;
 }
 
+inline void PlotData::image2complex(int x, int y, double & re, double & im, double & reLo, double & imLo) const
+{
+    // the bounds are exact, their difference and the fraction of it are not
+    DoubleDouble r = DoubleDouble(reMin) + ((DoubleDouble::difference(reMax, reMin)*(x + 0.5))/imageWidth);
+    DoubleDouble i = DoubleDouble(imMax) - ((DoubleDouble::difference(imMax, imMin)*(y + 0.5))/imageHeight);
+    re = r.hi;
+    reLo = r.lo;
+    im = i.hi;
+    imLo = i.lo;
+}
+
 inline void PlotData::complex2image(double re, double im, int & x, int & y) const
 {
     int xx = (re - reMin)/(reMax - reMin)*imageWidth;
@@ -38,6 +95,28 @@ inline void PlotData::complex2image(double re, double im, int & x, int & y) cons
     y = std::min(std::max(yy, 0), imageHeight - 1);
 }
 
+inline Precision PlotData::effectivePrecision() const
+{
+    if (precision == Precision::EXTENDED)
+        return precision;
+
+    // exp(w) in single precision is off in its phase by about |Im w| float
+    // ulps, whole color cycles for exp(exp(z)) or exp(z^6); such formulas
+    // are rendered like DOUBLE
+    bool exponential = (precision != Precision::DOUBLE) && formulaUsesExponential(formula);
+    if (precision == Precision::FLOAT && !exponential)
+        return precision;
+
+    // on deep zooms neighbouring pixels would collapse onto the same float,
+    // and on deeper ones onto the same double
+    double spacing = std::min(std::abs(reMax - reMin)/imageWidth, std::abs(imMax - imMin)/imageHeight);
+    double extent = std::max(std::max(std::abs(reMin), std::abs(reMax)), std::max(std::abs(imMin), std::abs(imMax)));
+    if (spacing < DOUBLE_MIN_PIXEL_SPACING*extent)
+        return Precision::EXTENDED;
+    return (precision == Precision::AUTO && !exponential && spacing >= FLOAT_MIN_PIXEL_SPACING*extent) ?
+        Precision::FLOAT : Precision::DOUBLE;
+}
+
 struct RedrawInfo
 {
     enum class Status { FINISHED, CANCELLED, ERROR };
@@ -45,9 +124,15 @@ struct RedrawInfo
 
     using DurationType = std::chrono::duration<double>;
 
-    DurationType parsingDuration;
-    DurationType computingDuration;
-    DurationType coloringDuration;
+    DurationType parsingDuration{0};
+    DurationType computingDuration{0};
+    DurationType coloringDuration{0};
+
+    Backend backend = Backend::INTERPRETER;  // the one actually used
+    Precision precision = Precision::DOUBLE;  // DOUBLE, FLOAT or EXTENDED, the one actually used
+    double refinedFraction = 0.0;             // of the pixels, by anti-aliasing
+
+    RenderProfile profile;
 
     std::string message;
 };
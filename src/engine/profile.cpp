@@ -0,0 +1,185 @@
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+#ifdef COMPLEXPLOT_HAVE_GETRUSAGE
+#include <sys/resource.h>
+#endif
+
+#include "plotdata.hpp"
+#include "profile.hpp"
+
+namespace {
+
+std::string jsonString(std::string const & s)
+{
+    std::ostringstream out;
+    out << '"';
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+        else
+            out << c;
+    }
+    out << '"';
+    return out.str();
+}
+
+char const * statusName(RedrawInfo::Status status)
+{
+    switch (status)
+    {
+    case RedrawInfo::Status::FINISHED:
+        return "finished";
+    case RedrawInfo::Status::CANCELLED:
+        return "cancelled";
+    case RedrawInfo::Status::ERROR:
+        break;
+    }
+    return "error";
+}
+
+char const * backendName(Backend backend)
+{
+    return (backend == Backend::JIT) ? "jit" : "interpreter";
+}
+
+char const * precisionName(Precision precision)
+{
+    switch (precision)
+    {
+    case Precision::FLOAT:
+        return "float";
+    case Precision::EXTENDED:
+        return "extended";
+    default:
+        break;
+    }
+    return "double";
+}
+
+} // namespace
+
+std::size_t peakMemoryBytes()
+{
+#ifdef COMPLEXPLOT_HAVE_GETRUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+    return static_cast<std::size_t>(usage.ru_maxrss)*1024;  // kilobytes
+#endif
+#else
+    return 0;
+#endif
+}
+
+void writeProfileJson(std::ostream & out, RedrawInfo const & info, std::string const & name, int indent)
+{
+    RenderProfile const & profile = info.profile;
+    std::string const pad(indent, ' ');
+    std::string const field = pad + "  ";
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::defaultfloat << std::setprecision(9);
+
+    out << "{\n";
+    if (!name.empty())
+        out << field << "\"name\": " << jsonString(name) << ",\n";
+    out << field << "\"status\": \"" << statusName(info.status) << "\",\n";
+    if (!info.message.empty())
+        out << field << "\"message\": " << jsonString(info.message) << ",\n";
+    out << field << "\"backend\": \"" << backendName(info.backend) << "\",\n"
+        << field << "\"precision\": \"" << precisionName(info.precision) << "\",\n"
+        << field << "\"parsing_seconds\": " << info.parsingDuration.count() << ",\n"
+        << field << "\"computing_seconds\": " << info.computingDuration.count() << ",\n"
+        << field << "\"coloring_seconds\": " << info.coloringDuration.count() << ",\n"
+        << field << "\"rendering_seconds\": " << profile.renderingDuration.count() << ",\n"
+        << field << "\"frame_pixels\": " << profile.framePixels << ",\n"
+        << field << "\"evaluated_points\": " << profile.points << ",\n"
+        << field << "\"interpolated_pixels\": " << profile.interpolatedPixels << ",\n"
+        << field << "\"pixels_per_second\": " << profile.pixelsPerSecond << ",\n"
+        << field << "\"refined_fraction\": " << info.refinedFraction << ",\n"
+        << field << "\"nan_results\": " << profile.nanResults << ",\n"
+        << field << "\"inf_results\": " << profile.infResults << ",\n"
+        << field << "\"tiles\": " << profile.tiles << ",\n"
+        << field << "\"peak_memory_bytes\": " << profile.peakMemory << ",\n";
+
+    out << field << "\"threads\": [";
+    for (std::size_t k = 0; k < profile.threads.size(); ++k)
+    {
+        RenderProfile::Thread const & thread = profile.threads[k];
+        out << ((k == 0) ? "\n" : ",\n") << field << "  {"
+            << "\"busy_seconds\": " << thread.busy.count()
+            << ", \"idle_seconds\": " << thread.idle.count()
+            << ", \"tiles\": " << thread.tiles
+            << ", \"evaluated_points\": " << thread.points << "}";
+    }
+    out << (profile.threads.empty() ? "" : "\n" + field) << "],\n";
+
+    out << field << "\"batches\": " << profile.batches << ",\n"
+        << field << "\"sampled_batches\": " << profile.sampledBatches << ",\n"
+        << field << "\"operators\": [";
+    for (std::size_t k = 0; k < profile.operators.size(); ++k)
+    {
+        RenderProfile::Operator const & op = profile.operators[k];
+        out << ((k == 0) ? "\n" : ",\n") << field << "  {"
+            << "\"name\": " << jsonString(op.name)
+            << ", \"estimated_seconds\": " << op.time.count()
+            << ", \"sampled_instructions\": " << op.sampledInstructions << "}";
+    }
+    out << (profile.operators.empty() ? "" : "\n" + field) << "]\n"
+        << pad << "}";
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+std::string formatProfile(RedrawInfo const & info)
+{
+    RenderProfile const & profile = info.profile;
+
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(3)
+         << "Backend: " << backendName(info.backend) << ", precision: " << precisionName(info.precision) << "\n"
+         << "Parsing: " << info.parsingDuration.count() << " s, computing: " << info.computingDuration.count()
+         << " s, coloring: " << info.coloringDuration.count() << " s\n"
+         << "Rendering: " << profile.renderingDuration.count() << " s, "
+         << std::setprecision(2) << profile.pixelsPerSecond*1e-6 << " Mpixel/s\n"
+         << "Evaluated points: " << profile.points << " (" << profile.framePixels << " pixels";
+    if (info.refinedFraction > 0.0)
+        text << ", " << std::setprecision(1) << 100.0*info.refinedFraction << "% refined";
+    if (profile.interpolatedPixels > 0)
+        text << ", " << profile.interpolatedPixels << " interpolated";
+    text << ")\n"
+         << "NaN results: " << profile.nanResults << ", infinite results: " << profile.infResults << "\n"
+         << "Tiles: " << profile.tiles << "\n";
+    if (profile.peakMemory > 0)
+        text << "Peak memory: " << std::setprecision(1) << profile.peakMemory/1048576.0 << " MiB\n";
+
+    text << "\nThread     busy [s]   idle [s]   tiles   points\n";
+    for (std::size_t k = 0; k < profile.threads.size(); ++k)
+    {
+        RenderProfile::Thread const & thread = profile.threads[k];
+        text << std::setw(6) << k << std::setprecision(3)
+             << std::setw(13) << thread.busy.count() << std::setw(11) << thread.idle.count()
+             << std::setw(8) << thread.tiles << std::setw(9) << thread.points << "\n";
+    }
+
+    if (!profile.operators.empty())
+    {
+        text << "\nOperator   time [s] (estimated from " << profile.sampledBatches << " of "
+             << profile.batches << " batches)\n";
+        for (RenderProfile::Operator const & op : profile.operators)
+            text << std::left << std::setw(8) << op.name << std::right
+                 << std::setprecision(4) << std::setw(11) << op.time.count() << "\n";
+    }
+
+    return text.str();
+}
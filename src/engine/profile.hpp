@@ -0,0 +1,71 @@
+#ifndef COMPLEXPLOT_PROFILE_HPP
+#define COMPLEXPLOT_PROFILE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/*
+ *  Where the time of a render went, measured with a steady clock.
+ *  Filled in by the engine along with RedrawInfo; all counts cover the
+ *  whole render, all passes and anti-aliasing included.
+ */
+struct RenderProfile
+{
+    using DurationType = std::chrono::duration<double>;
+
+    // one worker of the thread pool
+    struct Thread
+    {
+        DurationType busy{0};  // running tiles
+        DurationType idle{0};  // the rest of the rendering time
+        std::size_t tiles = 0;
+        std::size_t points = 0;  // evaluated
+    };
+
+    // estimated time of one operator of the interpreter, scaled up from the
+    // sampled batches
+    struct Operator
+    {
+        std::string name;
+        DurationType time{0};
+        std::size_t sampledInstructions = 0;
+    };
+
+    DurationType renderingDuration{0};  // wall time from parsing done to render done
+
+    std::vector<Thread> threads;
+    std::size_t tiles = 0;        // units of work run on the pool
+    std::size_t framePixels = 0;  // of the image
+    std::size_t points = 0;       // evaluated, anti-aliasing samples included
+    std::size_t interpolatedPixels = 0;  // filled from region corners instead
+    double pixelsPerSecond = 0.0;  // frame pixels over rendering time
+
+    std::size_t nanResults = 0;
+    std::size_t infResults = 0;
+
+    std::size_t batches = 0;         // evaluated by the interpreter
+    std::size_t sampledBatches = 0;  // of which timed per operator
+    std::vector<Operator> operators;  // most expensive first, only those seen
+
+    std::size_t peakMemory = 0;  // peak resident set of the process in bytes, 0 if unknown
+};
+
+// peak resident set size of the process in bytes, 0 where it cannot be queried
+std::size_t peakMemoryBytes();
+
+struct RedrawInfo;
+
+/*
+ *  Writes info and its profile as one JSON object, indented by indent spaces;
+ *  name, if not empty, is added as its "name" field.
+ */
+void writeProfileJson(std::ostream & out, RedrawInfo const & info, std::string const & name = std::string(),
+                      int indent = 0);
+
+// the profile of info as a few lines of plain text, for display
+std::string formatProfile(RedrawInfo const & info);
+
+#endif // COMPLEXPLOT_PROFILE_HPP
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "batch.hpp"
+#include "jit.hpp"
+#include "program.hpp"
+
+namespace {
+
+// programs needing more registers than this fall back to heap storage
+std::size_t const INLINE_REGISTERS = 32;
+
+// range in which the squared modulus is computed without loss
+double const NORM_MIN = 1e-300;
+double const NORM_MAX = 1e300;
+
+// batch kernels of the lane type, double-double ones for extended double lanes
+template <typename Real>
+ComplexKernels<Real> const & complexKernels(bool extended);
+
+template <>
+ComplexKernels<double> const & complexKernels<double>(bool extended)
+{
+    return extended ? batchKernels().extended : batchKernels();
+}
+
+template <>
+ComplexKernels<float> const & complexKernels<float>(bool)
+{
+    return batchKernels().single;
+}
+
+} // namespace
+
+char const * opCodeName(OpCode op)
+{
+    static char const * const NAMES[OPCODE_COUNT] = {
+        "const", "z", "neg", "add", "sub", "mul", "div", "pow", "powi", "powr", "exp"
+    };
+    return NAMES[static_cast<std::size_t>(op)];
+}
+
+void OperatorProfile::merge(OperatorProfile const & other)
+{
+    batches += other.batches;
+    sampled += other.sampled;
+    for (std::size_t k = 0; k < OPCODE_COUNT; ++k)
+    {
+        time[k] += other.time[k];
+        count[k] += other.count[k];
+    }
+}
+
+complex powInt(complex const & a, int n)
+{
+    complex result(1.0);
+    complex x = a;
+
+    // the first factor is copied, multiplying an overflowed one into 1 gives NaN
+    unsigned m = (n < 0) ? 0u - static_cast<unsigned>(n) : static_cast<unsigned>(n);
+    bool first = true;
+    while (m != 0)
+    {
+        if ((m & 1) && first)
+        {
+            result = x;
+            first = false;
+        }
+        else if (m & 1)
+        {
+            result *= x;
+        }
+        m >>= 1;
+        if (m != 0)
+            x *= x;
+    }
+
+    return (n < 0) ? 1.0/result : result;
+}
+
+complex powReal(complex const & a, double x)
+{
+    if (a == 0.0)
+        return (x > 0.0) ? 0.0 : std::numeric_limits<double>::infinity();
+
+    // |a|^x from the squared modulus where that neither overflows nor underflows,
+    // which spares the hypot in std::abs
+    double norm = a.real()*a.real() + a.imag()*a.imag();
+    double r = (norm > NORM_MIN && norm < NORM_MAX) ? std::pow(norm, 0.5*x) : std::pow(std::abs(a), x);
+    double phi = x*std::arg(a);
+    return complex(r*std::cos(phi), r*std::sin(phi));
+}
+
+complex powComplex(complex const & a, complex const & b)
+{
+    if (b == 0.0)
+        return 1.0;
+    if (a == 0.0)
+    {
+        if (b.real() > 0.0)
+            return 0.0;
+        return (b.real() < 0.0) ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+    }
+    return std::exp(b*std::log(a));
+}
+
+void Program::clear()
+{
+    code.clear();
+    constants.clear();
+    parameters.clear();
+    registerCount = 0;
+    native.reset();
+}
+
+std::uint16_t Program::addConstant(complex const & c)
+{
+    if (constants.size() > std::numeric_limits<std::uint16_t>::max())
+        throw std::invalid_argument("formula too long");
+
+    // constants are stored projected, exactly as the reference evaluator sees them
+    constants.push_back(std::proj(c));
+    return static_cast<std::uint16_t>(constants.size() - 1);
+}
+
+std::uint16_t Program::addParameter(complex const & t)
+{
+    std::uint16_t index = addConstant(t);
+    parameters.push_back(index);
+    return index;
+}
+
+void Program::setParameter(complex const & t)
+{
+    if (parameters.empty())
+        return;
+
+    for (std::uint16_t index : parameters)
+        constants[index] = std::proj(t);
+
+    // constants are built into the native code
+    if (native)
+        native = NativeCode::compile(*this);
+}
+
+void Program::emit(OpCode op, std::uint16_t dst, std::uint16_t a, std::uint16_t b)
+{
+    code.push_back(Instruction{op, dst, a, b});
+}
+
+Backend Program::setBackend(Backend backend)
+{
+    native.reset();
+    if (backend == Backend::JIT && precision == Precision::DOUBLE)
+        native = NativeCode::compile(*this);
+    return native ? Backend::JIT : Backend::INTERPRETER;
+}
+
+complex Program::eval(complex const & z) const
+{
+    if (registerCount <= INLINE_REGISTERS)
+    {
+        // left uninitialized on purpose: every register is written before it is read
+        std::aligned_storage<sizeof(complex), alignof(complex)>::type storage[INLINE_REGISTERS];
+        complex * regs = reinterpret_cast<complex *>(storage);
+        run(z, regs);
+        return regs[0];
+    }
+
+    std::vector<complex> regs(registerCount);
+    run(z, regs.data());
+    return regs[0];
+}
+
+void Program::run(complex const & z, complex * regs) const
+{
+    complex const pz = std::proj(z);
+
+    for (Instruction const & in : code)
+    {
+        switch (in.op)
+        {
+        case OpCode::CONST:
+            regs[in.dst] = constants[in.a];
+            break;
+        case OpCode::Z:
+            regs[in.dst] = pz;
+            break;
+        case OpCode::NEG:
+            regs[in.dst] = std::proj(-regs[in.a]);
+            break;
+        case OpCode::ADD:
+            regs[in.dst] = std::proj(regs[in.a] + regs[in.b]);
+            break;
+        case OpCode::SUB:
+            regs[in.dst] = std::proj(regs[in.a] - regs[in.b]);
+            break;
+        case OpCode::MUL:
+            regs[in.dst] = std::proj(regs[in.a]*regs[in.b]);
+            break;
+        case OpCode::DIV:
+            regs[in.dst] = std::proj(regs[in.a]/regs[in.b]);
+            break;
+        case OpCode::POW:
+            regs[in.dst] = std::proj(powComplex(regs[in.a], regs[in.b]));
+            break;
+        case OpCode::POWI:
+            regs[in.dst] = std::proj(powInt(regs[in.a], static_cast<int>(constants[in.b].real())));
+            break;
+        case OpCode::POWR:
+            regs[in.dst] = std::proj(powReal(regs[in.a], constants[in.b].real()));
+            break;
+        case OpCode::EXP:
+            regs[in.dst] = std::proj(std::exp(regs[in.a]));
+            break;
+        }
+    }
+}
+
+void Program::setPrecision(Precision precision)
+{
+    this->precision = precision;
+    if (precision != Precision::DOUBLE)
+        native.reset();
+}
+
+void Program::evalBatch(double const * re, double const * im, double * outRe, double * outIm, std::size_t n,
+                        OperatorProfile * profile) const
+{
+    if (precision != Precision::FLOAT)
+    {
+        runBatch<double>(re, im, nullptr, nullptr, outRe, outIm, n, profile);
+        return;
+    }
+
+    // rounded to single precision batch by batch
+    float re32[BATCH_SIZE], im32[BATCH_SIZE];
+    for (std::size_t offset = 0; offset < n; offset += BATCH_SIZE)
+    {
+        std::size_t count = std::min(BATCH_SIZE, n - offset);
+        std::copy(re + offset, re + offset + count, re32);
+        std::copy(im + offset, im + offset + count, im32);
+        runBatch<float>(re32, im32, nullptr, nullptr, re32, im32, count, profile);
+        std::copy(re32, re32 + count, outRe + offset);
+        std::copy(im32, im32 + count, outIm + offset);
+    }
+}
+
+void Program::evalBatch(double const * re, double const * im, double const * reLo, double const * imLo,
+                        double * outRe, double * outIm, std::size_t n, OperatorProfile * profile) const
+{
+    if (precision == Precision::EXTENDED)
+        runBatch(re, im, reLo, imLo, outRe, outIm, n, profile);
+    else
+        evalBatch(re, im, outRe, outIm, n, profile);
+}
+
+void Program::evalBatch(float const * re, float const * im, float * outRe, float * outIm, std::size_t n,
+                        OperatorProfile * profile) const
+{
+    runBatch<float>(re, im, nullptr, nullptr, outRe, outIm, n, profile);
+}
+
+template <typename Real>
+void Program::runBatch(Real const * re, Real const * im, Real const * reLo, Real const * imLo,
+                       Real * outRe, Real * outIm, std::size_t n, OperatorProfile * profile) const
+{
+    // double-double lanes take a block for the high and one for the low parts
+    bool const extended = std::is_same<Real, double>::value && precision == Precision::EXTENDED;
+    std::size_t const lanes = extended ? 2*BATCH_SIZE : BATCH_SIZE;
+    ComplexKernels<Real> const & kernels = complexKernels<Real>(extended);
+
+    // register r occupies [2r, 2r + 1] blocks of lanes (real, imaginary);
+    // the last register pair holds the projected input
+    thread_local std::vector<Real> scratch;
+    scratch.resize(2*lanes*(registerCount + 1));
+
+    auto real = [&](std::size_t r) { return scratch.data() + 2*lanes*r; };
+    auto imag = [&](std::size_t r) { return scratch.data() + 2*lanes*r + lanes; };
+
+    Real * zr = real(registerCount);
+    Real * zi = imag(registerCount);
+
+    auto execute = [&](Instruction const & in)
+    {
+        Real * dr = real(in.dst);
+        Real * di = imag(in.dst);
+
+        switch (in.op)
+        {
+        case OpCode::CONST:
+            std::fill(dr, dr + BATCH_SIZE, static_cast<Real>(constants[in.a].real()));
+            std::fill(di, di + BATCH_SIZE, static_cast<Real>(constants[in.a].imag()));
+            std::fill(dr + BATCH_SIZE, dr + lanes, Real(0));
+            std::fill(di + BATCH_SIZE, di + lanes, Real(0));
+            break;
+        case OpCode::Z:
+            std::memcpy(dr, zr, lanes*sizeof(Real));
+            std::memcpy(di, zi, lanes*sizeof(Real));
+            break;
+        case OpCode::NEG:
+            kernels.neg(real(in.a), imag(in.a), dr, di);
+            break;
+        case OpCode::ADD:
+            kernels.add(real(in.a), imag(in.a), real(in.b), imag(in.b), dr, di);
+            break;
+        case OpCode::SUB:
+            kernels.sub(real(in.a), imag(in.a), real(in.b), imag(in.b), dr, di);
+            break;
+        case OpCode::MUL:
+            kernels.mul(real(in.a), imag(in.a), real(in.b), imag(in.b), dr, di);
+            break;
+        case OpCode::DIV:
+            kernels.div(real(in.a), imag(in.a), real(in.b), imag(in.b), dr, di);
+            break;
+        case OpCode::POW:
+            kernels.pow(real(in.a), imag(in.a), real(in.b), imag(in.b), dr, di);
+            break;
+        case OpCode::POWI:
+            kernels.powi(real(in.a), imag(in.a), static_cast<int>(constants[in.b].real()), dr, di);
+            break;
+        case OpCode::POWR:
+            kernels.powr(real(in.a), imag(in.a), static_cast<Real>(constants[in.b].real()), dr, di);
+            break;
+        case OpCode::EXP:
+            kernels.exp(real(in.a), imag(in.a), dr, di);
+            break;
+        }
+    };
+
+    for (std::size_t offset = 0; offset < n; offset += BATCH_SIZE)
+    {
+        std::size_t count = std::min(BATCH_SIZE, n - offset);
+
+        std::memcpy(zr, re + offset, count*sizeof(Real));
+        std::memcpy(zi, im + offset, count*sizeof(Real));
+        std::fill(zr + count, zr + BATCH_SIZE, Real(0));
+        std::fill(zi + count, zi + BATCH_SIZE, Real(0));
+        if (extended)
+        {
+            Real * zrLo = zr + BATCH_SIZE;
+            Real * ziLo = zi + BATCH_SIZE;
+            std::fill(zrLo, zrLo + BATCH_SIZE, Real(0));
+            std::fill(ziLo, ziLo + BATCH_SIZE, Real(0));
+            if (reLo != nullptr)
+                std::memcpy(zrLo, reLo + offset, count*sizeof(Real));
+            if (imLo != nullptr)
+                std::memcpy(ziLo, imLo + offset, count*sizeof(Real));
+        }
+        kernels.proj(zr, zi, zr, zi);
+
+        bool ranNative = false;
+        if constexpr (std::is_same<Real, double>::value)
+        {
+            if (native)
+            {
+                native->run(scratch.data());
+                ranNative = true;
+            }
+        }
+
+        // native code is not profiled by operator
+        bool const sample = !ranNative && profile != nullptr &&
+                            profile->batches++ % OperatorProfile::SAMPLE_INTERVAL == 0;
+        if (sample)
+        {
+            ++profile->sampled;
+            for (Instruction const & in : code)
+            {
+                auto start_time = OperatorProfile::Clock::now();
+                execute(in);
+                auto op = static_cast<std::size_t>(in.op);
+                profile->time[op] += OperatorProfile::Clock::now() - start_time;
+                ++profile->count[op];
+            }
+        }
+        else if (!ranNative)
+        {
+            for (Instruction const & in : code)
+                execute(in);
+        }
+
+        std::memcpy(outRe + offset, real(0), count*sizeof(Real));
+        std::memcpy(outIm + offset, imag(0), count*sizeof(Real));
+    }
+}
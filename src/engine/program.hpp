@@ -0,0 +1,143 @@
+#ifndef COMPLEXPLOT_PROGRAM_HPP
+#define COMPLEXPLOT_PROGRAM_HPP
+
+#include <array>
+#include <chrono>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "plotdata.hpp"
+
+using complex = std::complex<double>;
+
+class NativeCode;
+
+enum class OpCode : std::uint8_t
+{
+    CONST, Z,
+    NEG,
+    ADD, SUB, MUL, DIV, POW,
+    POWI, POWR,  // constant integer and real exponent
+    EXP
+};
+
+std::size_t const OPCODE_COUNT = static_cast<std::size_t>(OpCode::EXP) + 1;
+
+// lower case name of an operator, as in profiles
+char const * opCodeName(OpCode op);
+
+/*
+ *  Time spent per operator by the interpreter of Program::evalBatch, measured
+ *  on every SAMPLE_INTERVAL-th batch only to keep the clock reads cheap.
+ *  One profile must only be updated by one thread at a time.
+ */
+struct OperatorProfile
+{
+    using Clock = std::chrono::steady_clock;
+
+    static std::size_t const SAMPLE_INTERVAL = 16;
+
+    std::size_t batches = 0;  // all batches seen by the interpreter
+    std::size_t sampled = 0;  // the batches timed
+    std::array<Clock::duration, OPCODE_COUNT> time{};
+    std::array<std::size_t, OPCODE_COUNT> count{};  // instructions timed
+
+    void merge(OperatorProfile const & other);
+};
+
+// largest |n| for which z^n is computed by repeated squaring
+int const MAX_INTEGER_EXPONENT = 1024;
+
+// a^n by repeated squaring; negative n take the reciprocal
+complex powInt(complex const & a, int n);
+
+// a^x for real x in polar form
+complex powReal(complex const & a, double x);
+
+/*
+ *  a^b = exp(b log(a)) for OpCode::POW, with the limits of the constant
+ *  exponent cases: a^0 = 1 for every a, 0^b = 0 for Re b > 0 and infinity
+ *  for Re b < 0 (NaN for other b). Every evaluator follows this.
+ */
+complex powComplex(complex const & a, complex const & b);
+
+/*
+ *  Flat, register-based form of an Expression.
+ *
+ *  Instructions are stored contiguously in evaluation order; each one reads
+ *  registers 'a' and 'b' (or constant 'a' for CONST) and writes register 'dst'.
+ *  POWI and POWR read their exponent from constant 'b'.
+ *  The result of the whole program is left in register 0.
+ */
+class Program
+{
+public:
+    struct Instruction
+    {
+        OpCode op;
+        std::uint16_t dst;
+        std::uint16_t a;
+        std::uint16_t b;
+    };
+
+    void clear();
+
+    std::uint16_t addConstant(complex const & c);
+
+    // a constant holding the free parameter, changed by setParameter
+    std::uint16_t addParameter(complex const & t);
+
+    // sets every parameter constant to t; native code is generated anew
+    void setParameter(complex const & t);
+    void emit(OpCode op, std::uint16_t dst, std::uint16_t a = 0, std::uint16_t b = 0);
+    void setRegisterCount(std::size_t count) { registerCount = count; }
+
+    // generates native code for evalBatch when the JIT is requested and available;
+    // returns the backend evalBatch will use
+    Backend setBackend(Backend backend);
+    Backend getBackend() const { return native ? Backend::JIT : Backend::INTERPRETER; }
+
+    // arithmetic of evalBatch on doubles, DOUBLE, FLOAT or EXTENDED; native
+    // code is double only, so the others drop it and setBackend falls back
+    // to the interpreter
+    void setPrecision(Precision precision);
+    Precision getPrecision() const { return precision; }
+
+    complex eval(complex const & z) const;
+
+    // evaluate n points given and returned as split real/imaginary arrays;
+    // the interpreter samples the time of its operators into profile if given
+    void evalBatch(double const * re, double const * im, double * outRe, double * outIm, std::size_t n,
+                   OperatorProfile * profile = nullptr) const;
+
+    // the same for the double-double arguments re + reLo and im + imLo; the
+    // low parts, which may be null for zeros, only count in EXTENDED precision
+    void evalBatch(double const * re, double const * im, double const * reLo, double const * imLo,
+                   double * outRe, double * outIm, std::size_t n, OperatorProfile * profile = nullptr) const;
+
+    // the same in single precision, regardless of the precision set
+    void evalBatch(float const * re, float const * im, float * outRe, float * outIm, std::size_t n,
+                   OperatorProfile * profile = nullptr) const;
+
+private:
+    friend class NativeCode;
+
+    std::vector<Instruction> code;
+    std::vector<complex> constants;
+    std::vector<std::uint16_t> parameters;  // indices in constants
+    std::size_t registerCount = 0;
+
+    std::shared_ptr<NativeCode const> native;
+    Precision precision = Precision::DOUBLE;
+
+    void run(complex const & z, complex * regs) const;
+
+    template <typename Real>
+    void runBatch(Real const * re, Real const * im, Real const * reLo, Real const * imLo,
+                  Real * outRe, Real * outIm, std::size_t n, OperatorProfile * profile) const;
+};
+
+#endif // COMPLEXPLOT_PROGRAM_HPP
@@ -0,0 +1,300 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <tuple>
+
+#include "function.hpp"
+#include "rendercache.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+char const DISK_MAGIC[] = "complex-plot values 1";
+char const DISK_EXTENSION[] = ".values";
+
+// FNV-1a, names the file of a key in the disk tier
+std::uint64_t hashKey(std::string const & key)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (char c : key)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::size_t gridBytes(ValueGrid const & values)
+{
+    return (values.re.size() + values.im.size())*sizeof(double);
+}
+
+} // namespace
+
+RenderCache::RenderCache(std::size_t budget) :
+    budget(budget)
+{
+}
+
+void RenderCache::setBudget(std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = bytes;
+    evict();
+}
+
+std::size_t RenderCache::memoryUsed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return used;
+}
+
+bool RenderCache::setDiskTier(std::string const & directory, std::size_t budget)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->directory.clear();
+    diskBudget = budget;
+
+    if (directory.empty())
+        return true;
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (error || !fs::is_directory(directory, error))
+        return false;
+
+    this->directory = directory;
+    return true;
+}
+
+std::shared_ptr<ValueGrid const> RenderCache::findValues(PlotData const & plotData)
+{
+    std::string const key = valuesKey(plotData);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (Entry const * entry = find(key))
+        return entry->values;
+
+    std::shared_ptr<ValueGrid const> values = readDisk(key);
+    if (values)
+        insert(Entry{key, values, nullptr, gridBytes(*values)});
+    return values;
+}
+
+bool RenderCache::findImage(PlotData const & plotData, ImageView const & image)
+{
+    std::string const key = imageKey(plotData);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry const * entry = find(key);
+    if (entry == nullptr)
+        return false;
+
+    std::size_t const rowBytes = 3*std::size_t(image.width);
+    for (int y = 0; y < image.height; ++y)
+        std::memcpy(image.scanLine(image.top + y), entry->pixels->data() + y*rowBytes, rowBytes);
+    return true;
+}
+
+void RenderCache::insertValues(PlotData const & plotData, ValueGrid const & values)
+{
+    std::string const key = valuesKey(plotData);
+    auto copy = std::make_shared<ValueGrid const>(values);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    insert(Entry{key, copy, nullptr, gridBytes(values)});
+    writeDisk(key, values);
+}
+
+void RenderCache::insertImage(PlotData const & plotData, ImageView const & image)
+{
+    std::string const key = imageKey(plotData);
+
+    std::size_t const rowBytes = 3*std::size_t(image.width);
+    auto pixels = std::make_shared<std::vector<unsigned char>>(rowBytes*image.height);
+    for (int y = 0; y < image.height; ++y)
+        std::memcpy(pixels->data() + y*rowBytes, image.scanLine(image.top + y), rowBytes);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    insert(Entry{key, nullptr, pixels, pixels->size()});
+}
+
+void RenderCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.clear();
+    index.clear();
+    used = 0;
+}
+
+std::string RenderCache::valuesKey(PlotData const & plotData)
+{
+    // hexadecimal floats are exact
+    std::ostringstream key;
+    key << std::hexfloat
+        << canonicalFormula(plotData.formula)
+        << '|' << plotData.reMin << ' ' << plotData.reMax << ' ' << plotData.imMin << ' ' << plotData.imMax
+        << '|' << plotData.imageWidth << 'x' << plotData.imageHeight
+        << '|' << static_cast<int>(plotData.backend) << ' ' << static_cast<int>(plotData.effectivePrecision());
+
+    // only formulas with a parameter depend on it, their keys carry it
+    if (formulaUsesParameter(plotData.formula))
+        key << "|t " << plotData.parameter;
+    return key.str();
+}
+
+std::string RenderCache::imageKey(PlotData const & plotData)
+{
+    std::ostringstream key;
+    key << std::hexfloat
+        << valuesKey(plotData)
+        << '|' << plotData.coloringMethod << ' ' << plotData.colorSlope
+        << '|' << plotData.antialiasing;
+    if (plotData.antialiasing > 1)
+        key << ' ' << plotData.antialiasingThreshold;
+    return key.str();
+}
+
+RenderCache::Entry const * RenderCache::find(std::string const & key)
+{
+    auto found = index.find(key);
+    if (found == index.end())
+        return nullptr;
+
+    entries.splice(entries.begin(), entries, found->second);
+    return &entries.front();
+}
+
+void RenderCache::insert(Entry entry)
+{
+    auto found = index.find(entry.key);
+    if (found != index.end())
+    {
+        used -= found->second->bytes;
+        entries.erase(found->second);
+        index.erase(found);
+    }
+
+    if (entry.bytes > budget)
+        return;
+
+    used += entry.bytes;
+    entries.push_front(std::move(entry));
+    index[entries.front().key] = entries.begin();
+    evict();
+}
+
+void RenderCache::evict()
+{
+    while (used > budget && !entries.empty())
+    {
+        used -= entries.back().bytes;
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+std::shared_ptr<ValueGrid const> RenderCache::readDisk(std::string const & key) const
+{
+    if (directory.empty())
+        return nullptr;
+
+    std::ostringstream name;
+    name << std::hex << hashKey(key) << DISK_EXTENSION;
+    fs::path const path = fs::path(directory)/name.str();
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return nullptr;
+
+    // a hash collision shows as a different key
+    std::string magic, storedKey;
+    std::getline(file, magic);
+    std::getline(file, storedKey);
+    if (!file || magic != DISK_MAGIC || storedKey != key)
+        return nullptr;
+
+    std::int32_t size[2];
+    file.read(reinterpret_cast<char *>(size), sizeof(size));
+    if (!file || size[0] <= 0 || size[1] <= 0)
+        return nullptr;
+
+    auto values = std::make_shared<ValueGrid>();
+    values->resize(size[0], size[1]);
+    file.read(reinterpret_cast<char *>(values->re.data()), values->re.size()*sizeof(double));
+    file.read(reinterpret_cast<char *>(values->im.data()), values->im.size()*sizeof(double));
+    if (!file)
+        return nullptr;
+
+    // recently used files are the last to be removed
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+
+    return values;
+}
+
+void RenderCache::writeDisk(std::string const & key, ValueGrid const & values) const
+{
+    if (directory.empty() || gridBytes(values) > diskBudget)
+        return;
+
+    std::ostringstream name;
+    name << std::hex << hashKey(key) << DISK_EXTENSION;
+    fs::path const path = fs::path(directory)/name.str();
+    fs::path temporary = path;
+    temporary += ".tmp";
+
+    // written aside and renamed, so that readers never see a partial file
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        std::int32_t const size[2] = {values.width, values.height};
+        file << DISK_MAGIC << '\n' << key << '\n';
+        file.write(reinterpret_cast<char const *>(size), sizeof(size));
+        file.write(reinterpret_cast<char const *>(values.re.data()), values.re.size()*sizeof(double));
+        file.write(reinterpret_cast<char const *>(values.im.data()), values.im.size()*sizeof(double));
+        if (!file.flush())
+        {
+            file.close();
+            std::error_code error;
+            fs::remove(temporary, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(temporary, path, error);
+    if (error)
+        return;
+
+    // remove the least recently used files beyond the budget
+    std::vector<std::tuple<fs::file_time_type, std::uintmax_t, fs::path>> files;
+    for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+    {
+        if (it->path().extension() != DISK_EXTENSION)
+            continue;
+        std::error_code fileError;
+        auto time = it->last_write_time(fileError);
+        auto bytes = it->file_size(fileError);
+        if (!fileError)
+            files.emplace_back(time, bytes, it->path());
+    }
+
+    std::sort(files.begin(), files.end());
+    std::uintmax_t total = 0;
+    for (auto const & file : files)
+        total += std::get<1>(file);
+    for (auto const & file : files)
+    {
+        if (total <= diskBudget)
+            break;
+        if (std::get<2>(file) == path)
+            continue;
+        if (fs::remove(std::get<2>(file), error))
+            total -= std::get<1>(file);
+    }
+}
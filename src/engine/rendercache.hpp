@@ -0,0 +1,83 @@
+#ifndef COMPLEXPLOT_RENDERCACHE_HPP
+#define COMPLEXPLOT_RENDERCACHE_HPP
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "framecache.hpp"
+#include "image.hpp"
+#include "plotdata.hpp"
+
+/*
+ *  Least recently used cache of rendered frames within a memory budget.
+ *  Function values are keyed by the canonical formula, the viewport, the
+ *  image size, the backend and the precision; images additionally by the coloring
+ *  parameters and anti-aliasing, so that a frame differing only in
+ *  colorSlope or coloringMethod is recolored from cached values instead of
+ *  being evaluated again.
+ *
+ *  Values can also be kept in a directory (the disk tier), so that they
+ *  survive restarts; the oldest files are removed beyond its budget.
+ *  Disk errors are treated as misses. All methods are thread safe.
+ */
+class RenderCache
+{
+public:
+    static std::size_t const DEFAULT_BUDGET = std::size_t(256) << 20;
+
+    explicit RenderCache(std::size_t budget = DEFAULT_BUDGET);
+
+    void setBudget(std::size_t bytes);
+    std::size_t memoryUsed() const;
+
+    // an empty directory turns the disk tier off; false if it cannot be created
+    bool setDiskTier(std::string const & directory, std::size_t budget);
+
+    // values of plotData, from memory or disk; null if not cached
+    std::shared_ptr<ValueGrid const> findValues(PlotData const & plotData);
+
+    // copies the cached image of plotData into image; false if not cached
+    bool findImage(PlotData const & plotData, ImageView const & image);
+
+    void insertValues(PlotData const & plotData, ValueGrid const & values);
+    void insertImage(PlotData const & plotData, ImageView const & image);
+
+    void clear();
+
+private:
+    struct Entry
+    {
+        std::string key;
+        std::shared_ptr<ValueGrid const> values;
+        std::shared_ptr<std::vector<unsigned char> const> pixels;  // rows of 3*width bytes
+        std::size_t bytes;
+    };
+
+    static std::string valuesKey(PlotData const & plotData);
+    static std::string imageKey(PlotData const & plotData);
+
+    Entry const * find(std::string const & key);
+    void insert(Entry entry);
+    void evict();
+
+    std::shared_ptr<ValueGrid const> readDisk(std::string const & key) const;
+    void writeDisk(std::string const & key, ValueGrid const & values) const;
+
+    mutable std::mutex mutex;
+    std::size_t budget;
+    std::size_t used = 0;
+
+    // most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+    std::string directory;
+    std::size_t diskBudget = 0;
+};
+
+#endif // COMPLEXPLOT_RENDERCACHE_HPP
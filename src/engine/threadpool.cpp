@@ -0,0 +1,153 @@
+#include <algorithm>
+
+#include "threadpool.hpp"
+
+namespace {
+
+thread_local std::size_t workerIndex = ThreadPool::NO_WORKER;
+
+} // namespace
+
+ThreadPool::ThreadPool(std::size_t threadCount) :
+    generation(0),
+    pending(0),
+    stopping(false),
+    currentTask(nullptr)
+{
+    threadCount = std::max<std::size_t>(threadCount, 1);
+
+    for (std::size_t i = 0; i < threadCount; ++i)
+        workers.emplace_back(new Worker);
+
+    for (std::size_t i = 0; i < threadCount; ++i)
+        workers[i]->thread = std::thread(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto & worker : workers)
+        worker->thread.join();
+}
+
+void ThreadPool::run(std::size_t count, Task const & task)
+{
+    if (count == 0)
+        return;
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+
+    // publish the task before any index becomes visible to the workers
+    currentTask = &task;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = count;
+    }
+
+    // deal contiguous chunks so that neighbouring tiles tend to stay on one core
+    std::size_t const n = workers.size();
+    for (std::size_t w = 0; w < n; ++w)
+    {
+        std::size_t begin = count*w/n;
+        std::size_t end = count*(w + 1)/n;
+
+        std::lock_guard<std::mutex> lock(workers[w]->mutex);
+        for (std::size_t i = begin; i < end; ++i)
+            workers[w]->queue.push_back(i);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++generation;
+    }
+    wake.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return pending == 0; });
+    currentTask = nullptr;
+}
+
+ThreadPool & ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+std::size_t ThreadPool::defaultThreadCount()
+{
+    return std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+std::size_t ThreadPool::currentWorker()
+{
+    return workerIndex;
+}
+
+void ThreadPool::workerLoop(std::size_t id)
+{
+    std::size_t seen = 0;
+    workerIndex = id;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        std::size_t finished = 0;
+        std::size_t index;
+        while (next(id, index))
+        {
+            // the task cannot change while one of its indices is outstanding
+            (*currentTask.load())(index);
+            ++finished;
+        }
+
+        if (finished > 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending -= finished;
+            if (pending == 0)
+                done.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::next(std::size_t id, std::size_t & index)
+{
+    {
+        Worker & own = *workers[id];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.queue.empty())
+        {
+            index = own.queue.front();
+            own.queue.pop_front();
+            return true;
+        }
+    }
+
+    std::size_t const n = workers.size();
+    for (std::size_t k = 1; k < n; ++k)
+    {
+        Worker & victim = *workers[(id + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.queue.empty())
+        {
+            index = victim.queue.back();
+            victim.queue.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,71 @@
+#ifndef COMPLEXPLOT_THREADPOOL_HPP
+#define COMPLEXPLOT_THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ *  Fixed set of worker threads executing indexed tasks.
+ *
+ *  run(count, task) calls task(index) for every index in [0, count) and
+ *  blocks until all of them are done. Indices are dealt to the workers in
+ *  contiguous chunks; a worker that runs out of its own work steals from the
+ *  back of another worker's queue, so slow regions do not leave cores idle.
+ */
+class ThreadPool
+{
+public:
+    using Task = std::function<void(std::size_t)>;
+
+    explicit ThreadPool(std::size_t threadCount = defaultThreadCount());
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool & operator=(ThreadPool const &) = delete;
+
+    std::size_t size() const { return workers.size(); }
+
+    void run(std::size_t count, Task const & task);
+
+    // pool shared by all renders in the process
+    static ThreadPool & shared();
+
+    static std::size_t defaultThreadCount();
+
+    // index of the calling worker in its pool, NO_WORKER outside of any pool
+    static std::size_t const NO_WORKER = static_cast<std::size_t>(-1);
+    static std::size_t currentWorker();
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::size_t> queue;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::mutex runMutex;  // serializes concurrent run() calls
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::size_t generation;
+    std::size_t pending;
+    bool stopping;
+
+    std::atomic<Task const *> currentTask;
+
+    void workerLoop(std::size_t id);
+    bool next(std::size_t id, std::size_t & index);
+};
+
+#endif // COMPLEXPLOT_THREADPOOL_HPP
@@ -0,0 +1,136 @@
+#include <csignal>
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "server/server.hpp"
+
+namespace {
+
+// set while serving, for the signal handlers
+RenderServer * server = nullptr;
+
+extern "C" void onStop(int)
+{
+    if (server != nullptr)
+        server->stop();
+}
+
+char const * usage()
+{
+    return
+        "Usage: complex-plot-server [options] SOCKET\n"
+        "\n"
+        "Renders plots for any number of clients on the Unix domain socket SOCKET,\n"
+        "keeping the worker threads and the compiled formulas of the jobs warm.\n"
+        "Requests are lines 'render ID FORMAT OPTIONS...', with the plot options of\n"
+        "complex-plot-cli and FORMAT one of png, ppm, rgb (raw pixels) or shm (raw\n"
+        "pixels in shared memory, passed as a file descriptor), and 'cancel ID'.\n"
+        "See the README for the replies.\n"
+        "\n"
+        "Options:\n"
+        "  -t, --threads N     worker threads (default: one per hardware thread)\n"
+        "      --functions N   compiled formulas kept (default 64)\n"
+        "      --max-image MB  largest image of a job, in megabytes of RGB (default 1024)\n"
+        "  -q, --quiet         do not print the timings of every job\n"
+        "  -h, --help          show this help\n";
+}
+
+std::size_t toCount(std::string const & option, std::string const & value)
+{
+    try
+    {
+        std::size_t used;
+        int i = std::stoi(value, &used);
+        if (used == value.size() && i >= 0)
+            return std::size_t(i);
+    }
+    catch (std::logic_error const &)
+    {
+    }
+    throw std::invalid_argument("invalid count '" + value + "' for " + option);
+}
+
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    std::string socketPath;
+    std::size_t threads = 0;
+    std::size_t functions = FunctionCache::DEFAULT_CAPACITY;
+    std::size_t maxImage = RenderServer::DEFAULT_MAX_IMAGE_MB;
+    bool quiet = false;
+
+    try
+    {
+        for (int k = 1; k < argc; ++k)
+        {
+            std::string const option = argv[k];
+            if (option == "-h" || option == "--help")
+            {
+                std::cout << usage();
+                return 0;
+            }
+            if (option == "-q" || option == "--quiet")
+            {
+                quiet = true;
+            }
+            else if (option == "-t" || option == "--threads" || option == "--functions" || option == "--max-image")
+            {
+                if (k + 1 == argc)
+                    throw std::invalid_argument("missing value for " + option);
+                std::size_t const count = toCount(option, argv[++k]);
+                if (option == "--functions")
+                    functions = count;
+                else if (option == "--max-image")
+                    maxImage = count;
+                else
+                    threads = count;
+            }
+            else if (option.size() > 1 && option[0] == '-')
+            {
+                throw std::invalid_argument("unknown option '" + option + "'");
+            }
+            else if (socketPath.empty())
+            {
+                socketPath = option;
+            }
+            else
+            {
+                throw std::invalid_argument("more than one socket given");
+            }
+        }
+        if (socketPath.empty())
+            throw std::invalid_argument("missing socket path");
+    }
+    catch (std::invalid_argument const & e)
+    {
+        std::cerr << "complex-plot-server: " << e.what() << "\n\n" << usage();
+        return 2;
+    }
+
+    try
+    {
+        RenderServer renderServer(socketPath, threads, functions, maxImage << 20, quiet);
+
+        // a client that goes away while a reply is sent is no reason to exit
+        std::signal(SIGPIPE, SIG_IGN);
+        server = &renderServer;
+        std::signal(SIGINT, onStop);
+        std::signal(SIGTERM, onStop);
+
+        renderServer.run();
+
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        server = nullptr;
+    }
+    catch (std::exception const & e)
+    {
+        std::cerr << "complex-plot-server: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,711 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cli/imagefile.hpp"
+#include "cli/options.hpp"
+#include "engine/engine.hpp"
+#include "server/server.hpp"
+
+namespace {
+
+// longest request line; a client sending a longer one is disconnected
+std::size_t const MAX_LINE = std::size_t(64) << 10;
+
+#ifdef MSG_NOSIGNAL
+int const SEND_FLAGS = MSG_NOSIGNAL;
+#else
+int const SEND_FLAGS = 0;  // SIGPIPE is ignored by main instead
+#endif
+
+enum class Format { RGB, PPM, PNG, SHM };
+
+Format formatFromName(std::string const & name)
+{
+    if (name == "rgb")
+        return Format::RGB;
+    if (name == "ppm")
+        return Format::PPM;
+#ifdef COMPLEXPLOT_HAVE_PNG
+    if (name == "png")
+        return Format::PNG;
+#endif
+    if (name == "shm")
+        return Format::SHM;
+    throw std::invalid_argument("unknown format '" + name + "'");
+}
+
+std::runtime_error systemError(std::string const & what)
+{
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// a reply line may not span lines
+std::string oneLine(std::string text)
+{
+    std::replace(text.begin(), text.end(), '\n', ' ');
+    return text;
+}
+
+// shared memory object of size bytes, unlinked at once: only descriptors refer to it
+int sharedMemory(std::size_t size)
+{
+    static unsigned counter = 0;
+    for (int attempt = 0; attempt < 16; ++attempt)
+    {
+        std::string const name = "/complex-plot-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST)
+            continue;
+        if (fd < 0)
+            break;
+
+        shm_unlink(name.c_str());
+
+        // allocate the pages now, so that a full /dev/shm fails here rather
+        // than with SIGBUS when the image is rendered into the mapping
+#ifdef __linux__
+        int const error = posix_fallocate(fd, 0, static_cast<off_t>(size));
+#else
+        int const error = (ftruncate(fd, static_cast<off_t>(size)) != 0) ? errno : 0;
+#endif
+        if (error != 0)
+        {
+            ::close(fd);
+            errno = error;
+            break;
+        }
+        return fd;
+    }
+    throw systemError("cannot create shared memory");
+}
+
+#ifdef COMPLEXPLOT_HAVE_PNG
+std::vector<unsigned char> encodePng(ImageView const & image)
+{
+    char * data = nullptr;
+    std::size_t size = 0;
+    std::FILE * stream = open_memstream(&data, &size);
+    if (stream == nullptr)
+        throw systemError("cannot encode image");
+
+    try
+    {
+        ImageFile file(stream, ImageFile::Format::PNG, image.width, image.height);
+        for (int y = 0; y < image.height; ++y)
+            file.writeRow(image.scanLine(y));
+        file.close();
+    }
+    catch (...)
+    {
+        std::fclose(stream);
+        std::free(data);
+        throw;
+    }
+
+    std::fclose(stream);
+    std::vector<unsigned char> bytes(data, data + size);
+    std::free(data);
+    return bytes;
+}
+#endif
+
+} // namespace
+
+// bytes of a reply: in memory, or in a shared memory object passed on as a descriptor
+struct RenderServer::Buffer
+{
+    std::vector<unsigned char> memory;
+    unsigned char * data = nullptr;
+    std::size_t size = 0;
+    int fd = -1;
+
+    Buffer(std::size_t size, bool shared);
+    explicit Buffer(std::vector<unsigned char> bytes);
+    ~Buffer();
+
+    Buffer(Buffer const &) = delete;
+    Buffer & operator=(Buffer const &) = delete;
+};
+
+RenderServer::Buffer::Buffer(std::size_t size, bool shared) :
+    size(size)
+{
+    if (!shared)
+    {
+        memory.resize(size);
+        data = memory.data();
+        return;
+    }
+
+    fd = sharedMemory(size);
+    void * mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        ::close(fd);
+        throw systemError("cannot map shared memory");
+    }
+    data = static_cast<unsigned char *>(mapping);
+}
+
+RenderServer::Buffer::Buffer(std::vector<unsigned char> bytes) :
+    memory(std::move(bytes))
+{
+    data = memory.data();
+    size = memory.size();
+}
+
+RenderServer::Buffer::~Buffer()
+{
+    if (fd >= 0)
+    {
+        munmap(data, size);
+        ::close(fd);
+    }
+}
+
+struct RenderServer::Reply
+{
+    std::string header;             // the reply line, and the header of a PPM image
+    std::shared_ptr<Buffer> body;   // bytes after the header, or the shared memory passed along
+    std::size_t sent = 0;           // bytes of header and body
+
+    Reply(std::string header, std::shared_ptr<Buffer> body = nullptr) :
+        header(std::move(header)),
+        body(std::move(body))
+    {
+    }
+
+    bool passesDescriptor() const { return body && body->fd >= 0; }
+    std::size_t bodyBytes() const { return (body && !passesDescriptor()) ? body->size : 0; }
+};
+
+struct RenderServer::Job
+{
+    int client;  // number, for the log
+    std::string id;
+    Format format;
+    PlotData plotData;
+    std::atomic_bool cancelled{false};
+
+    // set up on its first turn, by the dispatcher
+    std::shared_ptr<Function const> function;
+    std::shared_ptr<Buffer> pixels;
+    std::unique_ptr<RenderStats> stats;
+    std::unique_ptr<RenderSlices> slices;
+    RedrawInfo::DurationType parsing{0};
+    RedrawInfo::DurationType rendering{0};  // its own slices, not the turns of other jobs
+};
+
+struct RenderServer::Client
+{
+    int fd;
+    int number;
+    std::string input;  // received, not yet a whole line; I/O thread only
+
+    // guarded by the server mutex
+    std::deque<std::shared_ptr<Job>> jobs;  // the first one may be running
+    std::deque<std::unique_ptr<Reply>> replies;
+    bool scheduled = false;  // in ready, or its first job running
+    bool closed = false;
+};
+
+RenderServer::RenderServer(std::string const & socketPath, std::size_t threads, std::size_t functions,
+                           std::size_t maxImageBytes, bool quiet) :
+    socketPath(socketPath),
+    listener(-1),
+    wakeRead(-1),
+    wakeWrite(-1),
+    stopRequested(false),
+    maxImageBytes(maxImageBytes),
+    quiet(quiet),
+    connections(0),
+    pool((threads == 0) ? ThreadPool::defaultThreadCount() : threads),
+    functions(functions),
+    stopping(false)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("invalid socket path '" + socketPath + "'");
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    sockaddr const * name = reinterpret_cast<sockaddr const *>(&address);
+
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw systemError("cannot create pipe");
+    wakeRead = fds[0];
+    wakeWrite = fds[1];
+    setNonBlocking(wakeRead);
+    setNonBlocking(wakeWrite);
+
+    try
+    {
+        // a socket left behind by a server that is gone is replaced, a live one is not
+        struct stat status;
+        if (stat(socketPath.c_str(), &status) == 0)
+        {
+            if (!S_ISSOCK(status.st_mode))
+                throw std::runtime_error("'" + socketPath + "' exists and is not a socket");
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            bool const live = (probe >= 0 && connect(probe, name, sizeof(address)) == 0);
+            if (probe >= 0)
+                ::close(probe);
+            if (live)
+                throw std::runtime_error("'" + socketPath + "' is served already");
+            unlink(socketPath.c_str());
+        }
+
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+            throw systemError("cannot create socket");
+        if (bind(listener, name, sizeof(address)) != 0)
+        {
+            ::close(listener);
+            listener = -1;
+            throw systemError("cannot bind '" + socketPath + "'");
+        }
+        if (listen(listener, SOMAXCONN) != 0)
+            throw systemError("cannot listen on '" + socketPath + "'");
+        setNonBlocking(listener);
+    }
+    catch (...)
+    {
+        if (listener >= 0)
+        {
+            ::close(listener);
+            unlink(socketPath.c_str());
+        }
+        ::close(wakeRead);
+        ::close(wakeWrite);
+        throw;
+    }
+}
+
+RenderServer::~RenderServer()
+{
+    ::close(listener);
+    unlink(socketPath.c_str());
+    ::close(wakeRead);
+    ::close(wakeWrite);
+}
+
+void RenderServer::stop()
+{
+    stopRequested = true;
+    wake();
+}
+
+void RenderServer::wake()
+{
+    char const byte = 0;
+    if (write(wakeWrite, &byte, 1) < 0)
+    {
+        // the pipe is full: a wake-up is pending anyway
+    }
+}
+
+void RenderServer::run()
+{
+    std::thread dispatcher(&RenderServer::dispatch, this);
+
+    std::vector<std::shared_ptr<Client>> clients;
+    std::vector<pollfd> fds;
+
+    while (!stopRequested)
+    {
+        fds.clear();
+        fds.push_back(pollfd{listener, POLLIN, 0});
+        fds.push_back(pollfd{wakeRead, POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::shared_ptr<Client> const & client : clients)
+                fds.push_back(pollfd{client->fd, short(client->replies.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0)
+            continue;  // interrupted by a signal
+
+        if (fds[1].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(wakeRead, drain, sizeof(drain)) > 0)
+            {
+            }
+        }
+
+        for (std::size_t k = 2; k < fds.size(); ++k)
+        {
+            std::shared_ptr<Client> const & client = clients[k - 2];
+            bool open = true;
+            if (fds[k].revents & (POLLIN | POLLHUP | POLLERR))
+                open = receive(client);
+            if (open && (fds[k].revents & POLLOUT))
+                open = flush(*client);
+            if (!open)
+                disconnect(*client);
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                     [](std::shared_ptr<Client> const & client) { return client->fd < 0; }),
+                      clients.end());
+
+        if (fds[0].revents & POLLIN)
+            acceptClients(clients);
+    }
+
+    for (std::shared_ptr<Client> const & client : clients)
+        disconnect(*client);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobsReady.notify_all();
+    dispatcher.join();
+}
+
+void RenderServer::acceptClients(std::vector<std::shared_ptr<Client>> & clients)
+{
+    while (true)
+    {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0)
+            return;  // none left, or a connection that failed
+
+        setNonBlocking(fd);
+        auto client = std::make_shared<Client>();
+        client->fd = fd;
+        client->number = ++connections;
+        clients.push_back(client);
+    }
+}
+
+bool RenderServer::receive(std::shared_ptr<Client> const & client)
+{
+    char data[4096];
+    ssize_t received = recv(client->fd, data, sizeof(data), 0);
+    if (received == 0)
+        return false;
+    if (received < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    client->input.append(data, std::size_t(received));
+
+    std::string::size_type end;
+    while ((end = client->input.find('\n')) != std::string::npos)
+    {
+        std::string const line = client->input.substr(0, end);
+        client->input.erase(0, end + 1);
+        request(client, line);
+    }
+    return client->input.size() <= MAX_LINE;
+}
+
+void RenderServer::request(std::shared_ptr<Client> const & client, std::string const & line)
+{
+    std::vector<std::string> words;
+    std::unique_ptr<Reply> error;
+    auto job = std::make_shared<Job>();
+    job->client = client->number;
+
+    try
+    {
+        words = splitLine(line);
+        if (words.empty())
+            return;
+        job->id = (words.size() > 1) ? words[1] : "-";
+
+        if (words[0] == "cancel")
+        {
+            if (words.size() != 2)
+            {
+                job->id = "-";
+                throw std::invalid_argument("expected 'cancel ID'");
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto pending = client->jobs.begin(); pending != client->jobs.end(); ++pending)
+            {
+                if ((*pending)->id != job->id)
+                    continue;
+
+                // the first job may be running: the dispatcher answers it on its next turn
+                (*pending)->cancelled = true;
+                if (pending != client->jobs.begin())
+                {
+                    client->jobs.erase(pending);
+                    client->replies.emplace_back(new Reply("cancelled " + job->id + "\n"));
+                }
+                return;
+            }
+            client->replies.emplace_back(new Reply("error " + job->id + " no such job\n"));
+            return;
+        }
+
+        if (words[0] != "render" || words.size() < 3)
+            throw std::invalid_argument("expected 'render ID FORMAT OPTIONS...' or 'cancel ID'");
+
+        job->format = formatFromName(words[2]);
+
+        RenderJob renderJob = Options().job;
+        parseJob(std::vector<std::string>(words.begin() + 3, words.end()), renderJob);
+        if (!renderJob.output.empty())
+            throw std::invalid_argument("images are sent back, not written to a file");
+        job->plotData = renderJob.plotData;
+
+        std::size_t const bytes = 3*std::size_t(job->plotData.imageWidth)*job->plotData.imageHeight;
+        if (bytes > maxImageBytes)
+        {
+            throw std::invalid_argument("image of " + std::to_string(bytes) + " bytes exceeds the limit of " +
+                                        std::to_string(maxImageBytes) + " bytes");
+        }
+    }
+    catch (std::invalid_argument const & e)
+    {
+        error.reset(new Reply("error " + (job->id.empty() ? "-" : job->id) + " " + oneLine(e.what()) + "\n"));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error)
+    {
+        for (std::shared_ptr<Job> const & pending : client->jobs)
+        {
+            // not answered on the ID, which still belongs to the pending job
+            if (pending->id == job->id)
+                error.reset(new Reply("error - duplicate id " + job->id + "\n"));
+        }
+    }
+    if (error)
+    {
+        client->replies.push_back(std::move(error));
+        return;
+    }
+
+    client->jobs.push_back(job);
+    if (!client->scheduled)
+    {
+        client->scheduled = true;
+        ready.push_back(client);
+        jobsReady.notify_one();
+    }
+}
+
+bool RenderServer::flush(Client & client)
+{
+    while (true)
+    {
+        // the dispatcher only appends replies, so the first one stays put while it is sent
+        Reply * reply;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (client.replies.empty())
+                return true;
+            reply = client.replies.front().get();
+        }
+
+        std::size_t const headerBytes = reply->header.size();
+        std::size_t const total = headerBytes + reply->bodyBytes();
+
+        iovec parts[2];
+        int count = 0;
+        if (reply->sent < headerBytes)
+            parts[count++] = iovec{&reply->header[reply->sent], headerBytes - reply->sent};
+        if (reply->bodyBytes() > 0)
+        {
+            std::size_t const offset = std::max(reply->sent, headerBytes) - headerBytes;
+            parts[count++] = iovec{reply->body->data + offset, reply->bodyBytes() - offset};
+        }
+
+        msghdr message{};
+        message.msg_iov = parts;
+        message.msg_iovlen = count;
+
+        // the descriptor of the shared memory comes with the first byte of the reply
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (reply->passesDescriptor() && reply->sent == 0)
+        {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            cmsghdr * header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(header), &reply->body->fd, sizeof(int));
+        }
+
+        ssize_t sent = sendmsg(client.fd, &message, SEND_FLAGS);
+        if (sent < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+        reply->sent += std::size_t(sent);
+        if (reply->sent < total)
+            return true;  // the rest when the socket takes more
+
+        std::lock_guard<std::mutex> lock(mutex);
+        client.replies.pop_front();
+    }
+}
+
+void RenderServer::disconnect(Client & client)
+{
+    ::close(client.fd);
+    client.fd = -1;
+
+    // the dispatcher drops the jobs on the client's next turn
+    std::lock_guard<std::mutex> lock(mutex);
+    client.closed = true;
+    for (std::shared_ptr<Job> const & job : client.jobs)
+        job->cancelled = true;
+    client.replies.clear();
+}
+
+void RenderServer::dispatch()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        jobsReady.wait(lock, [&]() { return stopping || !ready.empty(); });
+        if (stopping)
+            return;
+
+        // one slice of the first job of every client in turn
+        std::shared_ptr<Client> client = ready.front();
+        ready.pop_front();
+        std::unique_ptr<Reply> reply;
+        if (!client->closed)
+        {
+            std::shared_ptr<Job> job = client->jobs.front();
+            lock.unlock();
+            reply = step(*job);
+            lock.lock();
+        }
+
+        if (client->closed)
+        {
+            client->jobs.clear();
+        }
+        else if (reply)
+        {
+            client->jobs.pop_front();
+            client->replies.push_back(std::move(reply));
+            wake();
+        }
+
+        if (client->jobs.empty())
+            client->scheduled = false;
+        else
+            ready.push_back(client);
+    }
+}
+
+std::unique_ptr<RenderServer::Reply> RenderServer::step(Job & job)
+{
+    using Clock = RenderStats::Clock;
+
+    auto cancelled = [&]() { return std::unique_ptr<Reply>(new Reply("cancelled " + job.id + "\n")); };
+    if (job.cancelled)
+        return cancelled();
+
+    try
+    {
+        auto start_time = Clock::now();
+        if (!job.slices)
+        {
+            PlotData const & plotData = job.plotData;
+            int const width = plotData.imageWidth;
+            int const height = plotData.imageHeight;
+
+            job.function = functions.get(plotData);
+            job.pixels = std::make_shared<Buffer>(3*std::size_t(width)*height, job.format == Format::SHM);
+            job.stats.reset(new RenderStats(pool.size()));
+            job.slices.reset(new RenderSlices(plotData, ImageView{job.pixels->data, 3*std::ptrdiff_t(width), width, height}));
+
+            auto parsing_done_time = Clock::now();
+            job.parsing = parsing_done_time - start_time;
+            start_time = parsing_done_time;
+        }
+
+        job.slices->next(*job.function, job.cancelled, pool, *job.stats);
+        job.rendering += Clock::now() - start_time;
+
+        if (job.cancelled)
+            return cancelled();
+        return job.slices->done() ? finish(job) : nullptr;
+    }
+    catch (std::invalid_argument const & e)
+    {
+        return std::unique_ptr<Reply>(new Reply("error " + job.id + " Formula error: " + oneLine(e.what()) + ".\n"));
+    }
+    catch (std::exception const & e)
+    {
+        return std::unique_ptr<Reply>(new Reply("error " + job.id + " " + oneLine(e.what()) + "\n"));
+    }
+}
+
+std::unique_ptr<RenderServer::Reply> RenderServer::finish(Job & job)
+{
+    PlotData const & plotData = job.plotData;
+    int const width = plotData.imageWidth;
+    int const height = plotData.imageHeight;
+
+    RedrawInfo info;
+    info.status = RedrawInfo::Status::FINISHED;
+    info.backend = job.function->backend();
+    info.precision = job.function->precision();
+    info.parsingDuration = job.parsing;
+    job.stats->report(job.rendering, std::size_t(width)*height, info);
+
+    std::string image;
+    std::shared_ptr<Buffer> body = job.pixels;
+    if (job.format == Format::PPM)
+    {
+        image = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    }
+#ifdef COMPLEXPLOT_HAVE_PNG
+    else if (job.format == Format::PNG)
+    {
+        ImageView const pixels{body->data, 3*std::ptrdiff_t(width), width, height};
+        body = std::make_shared<Buffer>(encodePng(pixels));
+    }
+#endif
+
+    std::unique_ptr<Reply> reply(new Reply(
+        "done " + job.id + " " + std::to_string(width) + " " + std::to_string(height) + " " +
+        std::to_string(image.size() + body->size) + "\n" + image, body));
+
+    if (!quiet)
+    {
+        std::cout << std::fixed << std::setprecision(3)
+                  << "client " << job.client << ", " << job.id
+                  << ": Parsing: " << info.parsingDuration.count()
+                  << "s; Computing: " << info.computingDuration.count()
+                  << "s; Coloring: " << info.coloringDuration.count()
+                  << "s; Functions cached: " << functions.size() << "." << std::endl;
+    }
+
+    // the pixels live on in the reply only
+    job.function.reset();
+    job.pixels.reset();
+    job.slices.reset();
+    job.stats.reset();
+    return reply;
+}
@@ -0,0 +1,111 @@
+#ifndef COMPLEXPLOT_SERVER_HPP
+#define COMPLEXPLOT_SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "engine/functioncache.hpp"
+#include "engine/threadpool.hpp"
+
+/*
+ *  Render server on a Unix domain socket. One thread pool and a cache of
+ *  compiled functions stay warm across the jobs of any number of clients,
+ *  so a job costs neither process startup, nor thread creation, nor, for a
+ *  formula seen before, parsing and native code generation.
+ *
+ *  Requests are lines of words, quoted as in a job file:
+ *
+ *    render ID FORMAT OPTIONS...  renders the plot given by the plot options
+ *                                 of the command line renderer (-f, --re, -s,
+ *                                 ...), with its defaults
+ *    cancel ID                    abandons a queued or running job, which is
+ *                                 then answered with "cancelled ID"; an ID
+ *                                 with no pending job gets "error ID no such job"
+ *
+ *  ID is any word naming the job, unique among the client's pending jobs.
+ *  Each job is answered with one line:
+ *
+ *    done ID WIDTH HEIGHT BYTES   followed by BYTES bytes of the image
+ *    cancelled ID
+ *    error ID MESSAGE
+ *
+ *  A render request reusing the ID of a pending job is refused with
+ *  "error - duplicate id ID", which leaves the reply of that job unambiguous.
+ *
+ *  FORMAT is png (when built with libpng), ppm, or rgb for packed 8-bit
+ *  RGB rows; or shm, for which the image is rendered into a shared memory
+ *  object of BYTES bytes of packed RGB that comes with the done line as a
+ *  file descriptor (SCM_RIGHTS) for the client to map, and no bytes follow.
+ *
+ *  Images larger than maxImageBytes of packed RGB are refused with an
+ *  error, before any memory is taken for them.
+ *
+ *  Jobs are run in slices of a band of rows (see RenderSlices), taking
+ *  turns between the clients with pending jobs; the jobs of a client run in
+ *  the order they came in. Closing the connection cancels its jobs.
+ */
+class RenderServer
+{
+public:
+    // default limit of the image size, in megabytes: 1 GiB, a 18000 x 18000 image
+    static std::size_t const DEFAULT_MAX_IMAGE_MB = 1024;
+
+    // listens on socketPath; throws std::runtime_error if that fails
+    RenderServer(std::string const & socketPath, std::size_t threads, std::size_t functions,
+                 std::size_t maxImageBytes, bool quiet);
+    ~RenderServer();
+
+    RenderServer(RenderServer const &) = delete;
+    RenderServer & operator=(RenderServer const &) = delete;
+
+    // serves clients until stop()
+    void run();
+
+    // makes run() return after cancelling all jobs; async-signal-safe
+    void stop();
+
+private:
+    struct Buffer;
+    struct Reply;
+    struct Job;
+    struct Client;
+
+    std::string socketPath;
+    int listener;
+    int wakeRead;
+    int wakeWrite;  // written to by stop() and whenever replies are ready
+    std::atomic_bool stopRequested;
+    std::size_t maxImageBytes;
+    bool quiet;
+    int connections;  // accepted so far, numbers the clients in the log
+
+    ThreadPool pool;
+    FunctionCache functions;
+
+    // guards the jobs and replies of all clients, and ready
+    std::mutex mutex;
+    std::condition_variable jobsReady;
+    std::deque<std::shared_ptr<Client>> ready;  // clients with jobs, in turn
+    bool stopping;
+
+    void dispatch();
+    std::unique_ptr<Reply> step(Job & job);
+    std::unique_ptr<Reply> finish(Job & job);
+
+    // I/O thread
+    void acceptClients(std::vector<std::shared_ptr<Client>> & clients);
+    bool receive(std::shared_ptr<Client> const & client);
+    bool flush(Client & client);
+    void request(std::shared_ptr<Client> const & client, std::string const & line);
+    void disconnect(Client & client);
+
+    void wake();
+};
+
+#endif // COMPLEXPLOT_SERVER_HPP
@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "engine/batch.hpp"
+#include "engine/engine.hpp"
+#include "engine/jit.hpp"
+
+namespace {
+
+// formulas of the checks: the benchmark corpus, every operator, and powers at 0
+char const * const FORMULAS[] = {
+    "z^2 + 1",
+    "exp(1/z)",
+    "-z*(z - 1)/(z + i)^3",
+    "z^13 - z^7 + 1/z^5",
+    "(z^2 + 1)^(z - i)",
+    "1 + z + z^2/2 + z^3/6 + z^4/24 + z^5/120 + z^6/720 + z^7/5040 + z^8/40320",
+    "z^z",
+    "z^(z + 1)",
+    "z^(z - 1)",
+    "z^(0*z)",
+    "z^0",
+    "z^1.5",
+    "z^(-3)",
+};
+
+// formulas of exponentials whose imaginary parts leave the range of the
+// batch sin and cos, on the points of largePoints and of nested exp
+char const * const LARGE_ARGUMENT_FORMULAS[] = {
+    "exp(z)",
+    "exp(z)*0 + 1",
+    "exp(exp(exp(z)))",
+    "z^(1 + 1000000000000*i)",
+};
+
+int failures = 0;
+
+void check(bool condition, std::string const & what)
+{
+    if (condition)
+        return;
+    ++failures;
+    std::cerr << "FAILED: " << what << "\n";
+}
+
+std::string toString(complex const & c)
+{
+    return "(" + std::to_string(c.real()) + ", " + std::to_string(c.imag()) + ")";
+}
+
+bool isFinite(complex const & c)
+{
+    return std::isfinite(c.real()) && std::isfinite(c.imag());
+}
+
+// both finite and within relative error, or both not finite
+bool close(complex const & actual, complex const & expected, double error)
+{
+    if (!isFinite(actual) || !isFinite(expected))
+        return isFinite(actual) == isFinite(expected);
+    return std::abs(actual - expected) <= error*std::max(std::abs(expected), 1e-300);
+}
+
+PlotData view(char const * formula, double reMin, double reMax, double imMin, double imMax, int size,
+              Precision precision)
+{
+    PlotData plotData;
+    plotData.formula = formula;
+    plotData.reMin = reMin;
+    plotData.reMax = reMax;
+    plotData.imMin = imMin;
+    plotData.imMax = imMax;
+    plotData.imageWidth = size;
+    plotData.imageHeight = size;
+    plotData.coloringMethod = 0;
+    plotData.colorSlope = 1.0;
+    plotData.precision = precision;
+    return plotData;
+}
+
+std::vector<unsigned char> render(PlotData const & plotData)
+{
+    std::vector<unsigned char> pixels(3*std::size_t(plotData.imageWidth)*plotData.imageHeight);
+    ImageView image{pixels.data(), 3*std::ptrdiff_t(plotData.imageWidth), plotData.imageWidth, plotData.imageHeight};
+    std::atomic_bool cancellationToken(false);
+    redraw(plotData, image, []() {}, cancellationToken);
+    return pixels;
+}
+
+int maxChannelError(std::vector<unsigned char> const & actual, std::vector<unsigned char> const & expected)
+{
+    int error = 0;
+    for (std::size_t c = 0; c < actual.size(); ++c)
+        error = std::max(error, std::abs(int(actual[c]) - int(expected[c])));
+    return error;
+}
+
+// one batch of points off the axes (away from the branch cut), with 0 in lane 0
+void batchPoints(std::vector<double> & re, std::vector<double> & im)
+{
+    re.assign(BATCH_SIZE, 0.0);
+    im.assign(BATCH_SIZE, 0.0);
+    for (std::size_t k = 1; k < BATCH_SIZE; ++k)
+    {
+        re[k] = -2.3 + 0.071*k;
+        im[k] = 1.7 - 0.053*k + 0.01;
+    }
+}
+
+// one batch of points with imaginary parts from 1 to 1e300, around 2^30 and
+// far past it
+void largePoints(std::vector<double> & re, std::vector<double> & im)
+{
+    re.resize(BATCH_SIZE);
+    im.resize(BATCH_SIZE);
+    for (std::size_t k = 0; k < BATCH_SIZE; ++k)
+    {
+        re[k] = 0.5 - 0.02*k;
+        im[k] = ((k % 2 != 0) ? -1.0 : 1.0)*std::pow(10.0, 300.0*k/(BATCH_SIZE - 1));
+    }
+    im[1] = 1e18;
+    im[2] = 1e16;
+    im[3] = std::ldexp(1.0, 30);
+    im[4] = std::nextafter(std::ldexp(1.0, 30), 0.0);
+    im[5] = 1e300;
+    re[5] = 1.0;
+}
+
+// batch evaluators, the JIT and the extended kernels agree with the scalar
+// reference on formula at the points re + i im
+void checkBatch(char const * formula, std::vector<double> const & re, std::vector<double> const & im)
+{
+    Function f;
+    f.fromFormula(formula);
+
+    struct Variant { char const * name; Precision precision; Backend backend; };
+    std::vector<Variant> variants{{"batch", Precision::DOUBLE, Backend::INTERPRETER},
+                                  {"extended", Precision::EXTENDED, Backend::INTERPRETER}};
+    if (NativeCode::available())
+        variants.push_back({"jit", Precision::DOUBLE, Backend::JIT});
+
+    for (Variant const & variant : variants)
+    {
+        f.setPrecision(variant.precision);
+        check(f.setBackend(variant.backend) == variant.backend, std::string(variant.name) + " available");
+
+        std::vector<double> outRe(BATCH_SIZE), outIm(BATCH_SIZE);
+        f.evalBatch(re.data(), im.data(), nullptr, nullptr, outRe.data(), outIm.data(), BATCH_SIZE);
+
+        for (std::size_t k = 0; k < BATCH_SIZE; ++k)
+        {
+            complex const z(re[k], im[k]);
+            complex const expected = f.evalReference(z);
+            complex const actual(outRe[k], outIm[k]);
+            check(close(f(z), expected, 1e-12),
+                  std::string("scalar ") + formula + " at " + toString(z) + ": " + toString(f(z)) +
+                  " against the tree " + toString(expected));
+            check(close(actual, expected, 1e-9),
+                  std::string(variant.name) + " " + formula + " at " + toString(z) + ": " +
+                  toString(actual) + " against " + toString(expected));
+        }
+    }
+}
+
+void checkBatchAgainstScalar()
+{
+    std::vector<double> re, im;
+    batchPoints(re, im);
+    for (char const * formula : FORMULAS)
+        checkBatch(formula, re, im);
+    for (char const * formula : LARGE_ARGUMENT_FORMULAS)
+        checkBatch(formula, re, im);
+
+    largePoints(re, im);
+    for (char const * formula : LARGE_ARGUMENT_FORMULAS)
+        checkBatch(formula, re, im);
+}
+
+// on views double precision resolves, extended precision gives the same values and colors
+void checkExtendedShallow()
+{
+    for (char const * formula : FORMULAS)
+    {
+        PlotData const plotData = view(formula, -2.0, 2.0, -2.0, 2.0, 96, Precision::EXTENDED);
+
+        Function f;
+        f.fromFormula(formula);
+        f.setPrecision(Precision::EXTENDED);
+        Function g;
+        g.fromFormula(formula);
+
+        std::vector<double> re(BATCH_SIZE), im(BATCH_SIZE), reLo(BATCH_SIZE), imLo(BATCH_SIZE);
+        std::vector<double> outRe(BATCH_SIZE), outIm(BATCH_SIZE), expectedRe(BATCH_SIZE), expectedIm(BATCH_SIZE);
+        for (int j = 0; j < plotData.imageHeight; j += 7)
+        {
+            for (std::size_t k = 0; k < BATCH_SIZE; ++k)
+            {
+                double x, y;
+                plotData.image2complex(int(k), j, x, y);
+                plotData.image2complex(int(k), j, re[k], im[k], reLo[k], imLo[k]);
+                check(std::abs(re[k] - x) <= 2e-16*std::abs(x) + 1e-300 && std::abs(im[k] - y) <= 2e-16*std::abs(y) + 1e-300,
+                      "extended image2complex of pixel (" + std::to_string(k) + ", " + std::to_string(j) + ")");
+            }
+
+            f.evalBatch(re.data(), im.data(), reLo.data(), imLo.data(), outRe.data(), outIm.data(), BATCH_SIZE);
+            g.evalBatch(re.data(), im.data(), expectedRe.data(), expectedIm.data(), BATCH_SIZE);
+            for (std::size_t k = 0; k < BATCH_SIZE; ++k)
+            {
+                complex const actual(outRe[k], outIm[k]);
+                complex const expected(expectedRe[k], expectedIm[k]);
+                check(close(actual, expected, 1e-9),
+                      std::string("extended ") + formula + " at " + toString(complex(re[k], im[k])) + ": " +
+                      toString(actual) + " against double " + toString(expected));
+            }
+        }
+
+        PlotData reference = plotData;
+        reference.precision = Precision::DOUBLE;
+        int const error = maxChannelError(render(plotData), render(reference));
+        check(error <= 1, std::string("extended colors of ") + formula + " off by " + std::to_string(error) + " steps");
+    }
+}
+
+// past DOUBLE_MIN_PIXEL_SPACING neighbouring pixels keep distinct coordinates
+// and values; 1/(z - c) at the corner c of the view cancels all leading digits
+void checkExtendedDeep()
+{
+    int const size = 64;
+    double const reMin = 0.3;
+    double const imMin = 0.25;
+    double const reMax = std::nextafter(reMin, 1.0);
+    double const imMax = std::nextafter(imMin, 1.0);
+    PlotData const plotData = view("1/(z - (0.3 + 0.25*i))", reMin, reMax, imMin, imMax, size, Precision::DOUBLE);
+
+    check(plotData.effectivePrecision() == Precision::EXTENDED, "a view of one double step is rendered extended");
+
+    Function f;
+    f.fromFormula(plotData.formula);
+    f.setPrecision(plotData.effectivePrecision());
+
+    double const spacingRe = (reMax - reMin)/size;
+    double const spacingIm = (imMax - imMin)/size;
+    check(spacingRe < DOUBLE_MIN_PIXEL_SPACING*reMax, "the view is past DOUBLE_MIN_PIXEL_SPACING");
+
+    std::vector<double> re(BATCH_SIZE), im(BATCH_SIZE), reLo(BATCH_SIZE), imLo(BATCH_SIZE);
+    std::vector<double> outRe(BATCH_SIZE), outIm(BATCH_SIZE);
+    for (int j = 0; j < size; j += 5)
+    {
+        for (int i = 0; i < size; ++i)
+            plotData.image2complex(i, j, re[i], im[i], reLo[i], imLo[i]);
+        f.evalBatch(re.data(), im.data(), reLo.data(), imLo.data(), outRe.data(), outIm.data(), size);
+
+        for (int i = 0; i < size; ++i)
+        {
+            // offsets from the corner, exact as the high parts are within a step of it
+            double const dx = (re[i] - reMin) + reLo[i];
+            double const dy = (im[i] - imMin) + imLo[i];
+            std::string const pixel = "pixel (" + std::to_string(i) + ", " + std::to_string(j) + ")";
+            check(std::abs(dx - (i + 0.5)*spacingRe) <= 1e-12*spacingRe, "extended real coordinate of " + pixel);
+            check(std::abs(dy - (size - j - 0.5)*spacingIm) <= 1e-12*spacingIm, "extended imaginary coordinate of " + pixel);
+
+            complex const expected = 1.0/complex(dx, dy);
+            complex const actual(outRe[i], outIm[i]);
+            check(close(actual, expected, 1e-9), "1/(z - c) at " + pixel + ": " + toString(actual) +
+                  " against " + toString(expected));
+            if (i > 0)
+                check(actual != complex(outRe[i - 1], outIm[i - 1]), "distinct values at " + pixel + " and its left neighbour");
+        }
+    }
+}
+
+// single precision colors stay within one step of double precision, also on
+// the default view where exponentials reach large imaginary parts
+void checkFloatColors()
+{
+    std::vector<char const *> formulas(std::begin(FORMULAS), std::end(FORMULAS));
+    formulas.insert(formulas.end(), std::begin(LARGE_ARGUMENT_FORMULAS), std::end(LARGE_ARGUMENT_FORMULAS));
+    formulas.push_back("exp(z^6)");
+
+    for (char const * formula : formulas)
+    for (double size : {2.0, 5.0})
+    for (Precision precision : {Precision::FLOAT, Precision::AUTO})
+    {
+        PlotData const plotData = view(formula, -size, size, -size, size, 256, precision);
+        PlotData reference = plotData;
+        reference.precision = Precision::DOUBLE;
+        int const error = maxChannelError(render(plotData), render(reference));
+        check(error <= 1, std::string("float colors of ") + formula + " on [-" + std::to_string(size) + ", " +
+              std::to_string(size) + "]^2 off by " + std::to_string(error) + " steps");
+    }
+
+    check(view("z^1.5 + z^(-3)", -5.0, 5.0, -5.0, 5.0, 256, Precision::AUTO).effectivePrecision() == Precision::FLOAT,
+          "auto precision of powers with number exponents is float");
+    check(view("exp(z)", -5.0, 5.0, -5.0, 5.0, 256, Precision::FLOAT).effectivePrecision() == Precision::DOUBLE,
+          "float precision of exp is double");
+    check(view("z^z", -5.0, 5.0, -5.0, 5.0, 256, Precision::AUTO).effectivePrecision() == Precision::DOUBLE,
+          "auto precision of z^z is double");
+}
+
+// formulas that cannot be evaluated end the redraw with a formula error,
+// numbers outside the range of double included
+void checkFormulaErrors()
+{
+    std::string const huge = "1" + std::string(400, '0');
+    std::string const tiny = "0." + std::string(400, '0') + "1";
+    for (std::string const & formula : {std::string("z +"), std::string("sin(z)"), huge + "*z", "z^" + huge})
+    {
+        PlotData const plotData = view(formula.c_str(), -2.0, 2.0, -2.0, 2.0, 16, Precision::DOUBLE);
+        std::vector<unsigned char> pixels(3*16*16);
+        std::atomic_bool cancellationToken(false);
+        bool exited = false;
+        RedrawInfo const info = redraw(plotData, ImageView{pixels.data(), 3*16, 16, 16}, [&]() { exited = true; },
+                                       cancellationToken);
+        check(info.status == RedrawInfo::Status::ERROR && info.message.rfind("Formula error: ", 0) == 0,
+              "formula error for " + formula.substr(0, 20));
+        check(exited, "exit notified for " + formula.substr(0, 20));
+    }
+
+    Function f;
+    f.fromFormula(tiny + " + z");
+    check(f(complex(1.0, 0.0)) == complex(1.0, 0.0), "numbers below the range of double are 0");
+}
+
+// the exit is notified also when the output of a redraw throws, before the
+// exception is passed on
+void checkExitNotified()
+{
+    PlotData const plotData = view("z^2 + 1", -2.0, 2.0, -2.0, 2.0, 64, Precision::DOUBLE);
+    std::atomic_bool cancellationToken(false);
+    bool exited = false;
+    bool thrown = false;
+    try
+    {
+        redrawBands(plotData, [](ImageView const &) { throw std::runtime_error("disk full"); }, [](int) {},
+                    [&]() { exited = true; }, cancellationToken);
+    }
+    catch (std::runtime_error const &)
+    {
+        thrown = true;
+    }
+    check(thrown, "the error of writeBand is passed on");
+    check(exited, "exit notified when writeBand throws");
+}
+
+// cached frames are reused, translated or recolored, only for the backend
+// and precision they were computed with
+void checkFrameCache()
+{
+    FrameCache cache;
+    cache.plotData = view("z^2 + 1", -2.0, 2.0, -2.0, 2.0, 64, Precision::DOUBLE);
+    cache.valid = true;
+
+    // one pixel to the right
+    PlotData next = cache.plotData;
+    next.reMin += 4.0/64;
+    next.reMax += 4.0/64;
+
+    int dx = 0, dy = 0;
+    check(cache.translation(next, dx, dy) && dx == 1 && dy == 0, "a one pixel pan is a translation");
+
+    PlotData other = next;
+    other.backend = Backend::JIT;
+    check(!cache.translation(other, dx, dy), "no translation into another backend");
+    other = next;
+    other.precision = Precision::FLOAT;
+    check(!cache.translation(other, dx, dy), "no translation into another precision");
+
+    other = cache.plotData;
+    other.backend = Backend::JIT;
+    check(!cache.recolorable(other), "no recoloring into another backend");
+    other = cache.plotData;
+    other.precision = Precision::FLOAT;
+    check(!cache.recolorable(other), "no recoloring into another precision");
+}
+
+struct Test
+{
+    char const * name;
+    std::function<void()> run;
+};
+
+Test const TESTS[] = {
+    {"batch_scalar", checkBatchAgainstScalar},
+    {"extended_shallow", checkExtendedShallow},
+    {"extended_deep", checkExtendedDeep},
+    {"float_colors", checkFloatColors},
+    {"formula_errors", checkFormulaErrors},
+    {"exit_notified", checkExitNotified},
+    {"frame_cache", checkFrameCache},
+};
+
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    // runs the named tests, or all of them
+    bool found = false;
+    for (Test const & test : TESTS)
+    {
+        if (argc > 1 && std::strcmp(argv[1], test.name) != 0)
+            continue;
+        found = true;
+        int const before = failures;
+        test.run();
+        std::cout << test.name << ": " << ((failures == before) ? "passed" : "FAILED") << std::endl;
+    }
+
+    if (!found)
+    {
+        std::cerr << "complex-plot-test: unknown test '" << argv[1] << "'\n";
+        return 2;
+    }
+    return (failures == 0) ? 0 : 1;
+}
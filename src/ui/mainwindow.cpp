@@ -1,22 +1,42 @@
+#include <cmath>
 #include <future>
 #include <iomanip>
 #include <sstream>
+#include <stdexcept>
 
 #include <QApplication>
+#include <QDialog>
+#include <QDialogButtonBox>
 #include <QFileDialog>
+#include <QFontDatabase>
+#include <QLineEdit>
 #include <QMessageBox>
 #include <QMouseEvent>
+#include <QPlainTextEdit>
+#include <QVBoxLayout>
 
+#include "engine/function.hpp"
 #include "ui/mainwindow.hpp"
 #include "version.hpp"
 
 #include "ui_mainwindow.h"
 
+namespace {
+
+// pause in typing, in milliseconds, after which drawing as you type starts
+int const AUTO_DRAW_DELAY = 150;
+
+} // namespace
+
 MainWindow::MainWindow(QWidget * parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
     state(State::READY),
-    cancellationToken(false)
+    cancellationToken(false),
+    recolorPending(false),
+    drawPending(false),
+    drawTimer(nullptr),
+    profileButton(nullptr)
 {
     ui->setupUi(this);
 
@@ -32,8 +52,25 @@ MainWindow::MainWindow(QWidget * parent) :
     connect(ui->plotWidget, &PlotWidget::engineThreadExited, this, &MainWindow::on_engineThreadExited_triggered);
     connect(ui->plotWidget, &PlotWidget::mouseMove, this, &MainWindow::on_plotWidget_mouseMoved);
     connect(ui->plotWidget, &PlotWidget::mouseLeave, this, &MainWindow::on_plotWidget_mouseLeft);
+    // on_plotWidget_panned and on_plotWidget_zoomed are connected by name in setupUi
 
-    readPlotData();
+    profileButton = new QPushButton("Profile...", this);
+    profileButton->setFlat(true);
+    profileButton->setEnabled(false);
+    ui->statusBar->addPermanentWidget(profileButton);
+    connect(profileButton, &QPushButton::clicked, this, &MainWindow::showProfile);
+
+    drawTimer = new QTimer(this);
+    drawTimer->setSingleShot(true);
+    drawTimer->setInterval(AUTO_DRAW_DELAY);
+    connect(drawTimer, &QTimer::timeout, this, &MainWindow::drawAfterTyping);
+    for (QLineEdit * edit : {ui->formulaLineEdit, ui->reminLineEdit, ui->remaxLineEdit,
+                             ui->imminLineEdit, ui->immaxLineEdit})
+        connect(edit, &QLineEdit::textEdited, this, &MainWindow::plotEdited);
+
+    QString error;
+    readPlotData(plotData, error);
+    shownPlotData = plotData;
     ui->plotWidget->clear(plotData);
 
     ui->statusBar->showMessage("Ready");
@@ -49,7 +86,7 @@ void MainWindow::on_drawButton_clicked()
     switch (state)
     {
     case State::READY:
-        draw();
+        draw(true);
         break;
     case State::BUSY:
         cancel();
@@ -82,24 +119,50 @@ void MainWindow::on_engineThreadExited_triggered()
     ui->drawButton->setText("Draw");
     state = State::READY;
     RedrawInfo info = engineFuture.get();
-    if (info.status == RedrawInfo::Status::FINISHED)
+
+    // plotData describes the image on screen again
+    if (ui->plotWidget->endDraw(info))
+        shownPlotData = plotData;
+    else
+        plotData = shownPlotData;
+
+    // a newer plot preempted this one
+    if (drawPending)
+    {
+        drawPending = false;
+        plotData = pendingPlotData;
+        startDrawing();
+        return;
+    }
+
+    showResult(info);
+
+    if (recolorPending)
     {
-        ui->plotWidget->repaint();
+        recolorPending = false;
+        recolor();
+    }
+}
 
+void MainWindow::showResult(RedrawInfo const & info)
+{
+    if (info.status == RedrawInfo::Status::FINISHED)
+    {
         std::stringstream message;
         message << std::fixed << std::setprecision(2)
                 << "Parsing: " << info.parsingDuration.count()
                 << "s; Computing: " << info.computingDuration.count()
-                << "s; Coloring: " << info.coloringDuration.count() << "s.";
+                << "s; Coloring: " << info.coloringDuration.count()
+                << "s; " << info.profile.pixelsPerSecond*1e-6 << " Mpixel/s.";
 
+        lastInfo = info;
+        profileButton->setEnabled(true);
         ui->actionSave->setEnabled(true);
         ui->statusBar->showMessage(QString::fromStdString(message.str()));
 
         return;
     }
 
-    ui->plotWidget->clear(plotData);
-
     if (info.status == RedrawInfo::Status::ERROR)
     {
         QMessageBox::warning(this, QString("Error"), QString::fromStdString(info.message));
@@ -111,20 +174,110 @@ void MainWindow::on_engineThreadExited_triggered()
         ui->statusBar->showMessage("Cancelled");
 }
 
-void MainWindow::readPlotData()
+void MainWindow::showProfile()
 {
-    plotData.formula = ui->formulaLineEdit->text().toStdString();
-    plotData.reMin = ui->reminLineEdit->text().toDouble();
-    plotData.reMax = ui->remaxLineEdit->text().toDouble();
-    plotData.imMin = ui->imminLineEdit->text().toDouble();
-    plotData.imMax = ui->immaxLineEdit->text().toDouble();
-    plotData.imageWidth = ui->imageWidthSpinBox->value();
-    plotData.imageHeight = ui->imageHeightSpinBox->value();
-    plotData.coloringMethod = ui->coloringMethodComboBox->currentIndex();
-    plotData.colorSlope = ui->colorSlopeLineEdit->text().toDouble();
+    QDialog dialog(this);
+    dialog.setWindowTitle("Render profile");
+
+    QPlainTextEdit * text = new QPlainTextEdit(QString::fromStdString(formatProfile(lastInfo)), &dialog);
+    text->setReadOnly(true);
+    text->setLineWrapMode(QPlainTextEdit::NoWrap);
+    text->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    text->setMinimumSize(480, 360);
+
+    QDialogButtonBox * buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dialog);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+
+    QVBoxLayout * layout = new QVBoxLayout(&dialog);
+    layout->addWidget(text);
+    layout->addWidget(buttons);
+
+    dialog.exec();
+}
+
+bool MainWindow::readPlotData(PlotData & next, QString & error) const
+{
+    if (!ui->reminLineEdit->hasAcceptableInput() || !ui->remaxLineEdit->hasAcceptableInput() ||
+        !ui->imminLineEdit->hasAcceptableInput() || !ui->immaxLineEdit->hasAcceptableInput() ||
+        !ui->colorSlopeLineEdit->hasAcceptableInput())
+    {
+        error = "The bounds and the color slope must be numbers.";
+        return false;
+    }
+
+    next = plotData;
+    next.formula = ui->formulaLineEdit->text().toStdString();
+    next.reMin = ui->reminLineEdit->text().toDouble();
+    next.reMax = ui->remaxLineEdit->text().toDouble();
+    next.imMin = ui->imminLineEdit->text().toDouble();
+    next.imMax = ui->immaxLineEdit->text().toDouble();
+    next.imageWidth = ui->imageWidthSpinBox->value();
+    next.imageHeight = ui->imageHeightSpinBox->value();
+    next.coloringMethod = ui->coloringMethodComboBox->currentIndex();
+    next.colorSlope = ui->colorSlopeLineEdit->text().toDouble();
+
+    if (!(next.reMin < next.reMax && next.imMin < next.imMax))
+    {
+        error = "The minimum bounds must be less than the maximum ones.";
+        return false;
+    }
+
+    // parsing is cheap next to a render, and the engine is not disturbed by a typo
+    try
+    {
+        Function f;
+        f.fromFormula(next.formula);
+    }
+    catch (std::exception const & e)
+    {
+        // nothing may escape a slot
+        error = QString("Formula error: ") + e.what() + ".";
+        return false;
+    }
+
+    return true;
+}
+
+void MainWindow::writeRanges(double reMin, double reMax, double imMin, double imMax)
+{
+    // full precision, so that a pan by whole pixels stays a whole pixel translation
+    ui->reminLineEdit->setText(QString::number(reMin, 'g', 17));
+    ui->remaxLineEdit->setText(QString::number(reMax, 'g', 17));
+    ui->imminLineEdit->setText(QString::number(imMin, 'g', 17));
+    ui->immaxLineEdit->setText(QString::number(imMax, 'g', 17));
+}
+
+void MainWindow::draw(bool showErrors)
+{
+    drawTimer->stop();
+
+    // a rejected plot leaves the image on screen and any draw in progress alone
+    PlotData next;
+    QString error;
+    if (!readPlotData(next, error))
+    {
+        if (showErrors)
+            QMessageBox::warning(this, QString("Error"), error);
+        else
+            ui->statusBar->showMessage(error);
+        return;
+    }
+
+    // the engine checks the token on every row of a tile, so it gives up the
+    // current plot within milliseconds and the new one starts as it exits
+    if (state == State::BUSY)
+    {
+        pendingPlotData = next;
+        drawPending = true;
+        cancellationToken = true;
+        return;
+    }
+
+    plotData = next;
+    startDrawing();
 }
 
-void MainWindow::draw()
+void MainWindow::startDrawing()
 {
     cancellationToken = false;
     ui->actionSave->setEnabled(false);
@@ -132,15 +285,49 @@ void MainWindow::draw()
     ui->drawButton->setText("Cancel");
     state = State::BUSY;
 
-    readPlotData();
-
     // process
     engineFuture = ui->plotWidget->draw(plotData, cancellationToken);
 }
 
+void MainWindow::recolor()
+{
+    // drawing as you type takes the new colors along, otherwise they are
+    // applied once the engine is done
+    if (state != State::READY)
+    {
+        if (ui->autoRenderCheckBox->isChecked())
+            drawTimer->start();
+        else
+            recolorPending = true;
+        return;
+    }
+
+    if (!ui->colorSlopeLineEdit->hasAcceptableInput())
+        return;
+
+    PlotData next = plotData;
+    next.coloringMethod = ui->coloringMethodComboBox->currentIndex();
+    next.colorSlope = ui->colorSlopeLineEdit->text().toDouble();
+    if (next.coloringMethod == plotData.coloringMethod && next.colorSlope == plotData.colorSlope)
+        return;
+
+    // only the colors of the frame on screen change live, other edits wait
+    // for Draw or for drawing as you type
+    if (!ui->plotWidget->canRecolor(next))
+    {
+        plotEdited();
+        return;
+    }
+
+    plotData = next;
+    startDrawing();
+}
+
 void MainWindow::cancel()
 {
     cancellationToken = true;
+    drawPending = false;
+    drawTimer->stop();
     ui->statusBar->showMessage("Cancelling...");
 }
 
@@ -158,3 +345,61 @@ void MainWindow::on_plotWidget_mouseLeft()
 {
     ui->statusBar->showMessage("Ready");
 }
+
+// pans and zooms while busy move the latest view asked for, which draw
+// hands on to the engine once it has given up the current one
+void MainWindow::on_plotWidget_panned(int dx, int dy)
+{
+    PlotData const & view = drawPending ? pendingPlotData : plotData;
+
+    // the image follows the mouse, so the viewport moves the other way
+    double reShift = -dx*(view.reMax - view.reMin)/view.imageWidth;
+    double imShift = dy*(view.imMax - view.imMin)/view.imageHeight;
+    writeRanges(view.reMin + reShift, view.reMax + reShift,
+                view.imMin + imShift, view.imMax + imShift);
+    draw(false);
+}
+
+void MainWindow::on_plotWidget_zoomed(int x, int y, double steps)
+{
+    PlotData const & view = drawPending ? pendingPlotData : plotData;
+
+    // zoom in by 20% per notch, keeping the point under the mouse in place
+    double factor = std::pow(0.8, steps);
+    double re, im;
+    view.image2complex(x, y, re, im);
+    writeRanges(re + (view.reMin - re)*factor, re + (view.reMax - re)*factor,
+                im + (view.imMin - im)*factor, im + (view.imMax - im)*factor);
+    draw(false);
+}
+
+void MainWindow::on_colorSlopeLineEdit_textEdited(QString const & text)
+{
+    Q_UNUSED(text);
+    recolor();
+}
+
+void MainWindow::on_coloringMethodComboBox_activated(int index)
+{
+    Q_UNUSED(index);
+    recolor();
+}
+
+void MainWindow::on_autoRenderCheckBox_toggled(bool checked)
+{
+    if (checked)
+        drawTimer->start();
+    else
+        drawTimer->stop();
+}
+
+void MainWindow::plotEdited()
+{
+    if (ui->autoRenderCheckBox->isChecked())
+        drawTimer->start();
+}
+
+void MainWindow::drawAfterTyping()
+{
+    draw(false);
+}
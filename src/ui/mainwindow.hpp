@@ -4,6 +4,9 @@
 #include <future>
 
 #include <QMainWindow>
+#include <QPushButton>
+#include <QString>
+#include <QTimer>
 
 #include "engine/plotdata.hpp"
 
@@ -27,6 +30,16 @@ private slots:
     void on_engineThreadExited_triggered();
     void on_plotWidget_mouseMoved(QMouseEvent * event);
     void on_plotWidget_mouseLeft();
+    void on_plotWidget_panned(int dx, int dy);
+    void on_plotWidget_zoomed(int x, int y, double steps);
+    void on_colorSlopeLineEdit_textEdited(QString const & text);
+    void on_coloringMethodComboBox_activated(int index);
+    void on_autoRenderCheckBox_toggled(bool checked);
+
+    // connected by hand to objects made after setupUi, so not named on_<object>_<signal>
+    void showProfile();
+    void plotEdited();
+    void drawAfterTyping();
 
 private:
     Ui::MainWindow * ui;
@@ -36,11 +49,32 @@ private:
     State state;
     std::atomic_bool cancellationToken;
 
+    // the colors were edited while the engine was busy
+    bool recolorPending;
+
+    // plot to draw once the engine has given up the current one
+    bool drawPending;
+    PlotData pendingPlotData;
+
+    // waits for a pause in typing before drawing as you type
+    QTimer * drawTimer;
+
+    // the plot being drawn, or else the one on screen
     PlotData plotData;
+    PlotData shownPlotData;
     std::future<RedrawInfo> engineFuture;
 
-    void readPlotData();
-    void draw();
+    // details of the last finished render, shown on demand from the status bar
+    RedrawInfo lastInfo;
+    QPushButton * profileButton;
+
+    // false, with the reason in error, if the form does not describe a plot
+    bool readPlotData(PlotData & next, QString & error) const;
+    void writeRanges(double reMin, double reMax, double imMin, double imMax);
+    void showResult(RedrawInfo const & info);
+    void draw(bool showErrors);
+    void startDrawing();
+    void recolor();
     void cancel();
 };
 
@@ -2,28 +2,82 @@
 #include <future>
 
 #include <QColor>
+#include <QMouseEvent>
 #include <QPainter>
 #include <QString>
+#include <QWheelEvent>
 
 #include "engine/engine.hpp"
 #include "ui/plotwidget.hpp"
 
+namespace {
+
+// step of the first, coarsest preview pass
+int const PREVIEW_STEP = 8;
+
+QColor const BLANK(64, 64, 64);
+
+} // namespace
+
+PlotWidget::PlotWidget(QWidget * parent) :
+    QWidget(parent),
+    frame(0),
+    presented(false),
+    dragging(false)
+{
+    // passes finish on the engine thread, repaint on the GUI thread
+    connect(this, &PlotWidget::enginePassFinished, this,
+            [this](int finished)
+            {
+                if (finished != frame)
+                    return;
+                if (presented)
+                    update();
+                else
+                    present();
+            },
+            Qt::QueuedConnection);
+}
+
 void PlotWidget::clear(PlotData const & plotData)
 {
     imageBuffer = QImage(plotData.imageWidth, plotData.imageHeight, QImage::Format_RGB888);
     setFixedSize(plotData.imageWidth, plotData.imageHeight);
-    QColor blank(64, 64, 64);
-    imageBuffer.fill(blank);
+    imageBuffer.fill(BLANK);
+    frameCache.valid = false;
+    presented = false;
+    dragOffset = QPoint();
     repaint();
 }
 
 std::future<RedrawInfo> PlotWidget::draw(PlotData const & plotData, std::atomic_bool const & cancellationToken)
 {
-    clear(plotData);
+    ++frame;
+    presented = false;
+    if (renderBuffer.width() != plotData.imageWidth || renderBuffer.height() != plotData.imageHeight)
+        renderBuffer = QImage(plotData.imageWidth, plotData.imageHeight, QImage::Format_RGB888);
 
-    auto update = [this](int x, int y, double r, double g, double b)
+    int dx, dy;
+    if (frameCache.translation(plotData, dx, dy))
     {
-        imageBuffer.setPixelColor(x, y, QColor(int(r*255.9), int(g*255.9), int(b*255.9)));
+        // show the known part at its new place until the engine is done
+        renderBuffer.fill(BLANK);
+        {
+            QPainter painter(&renderBuffer);
+            painter.drawImage(-dx, -dy, imageBuffer);
+        }
+        dragOffset = QPoint();
+        present();
+    }
+
+    // bits() detaches here, on the GUI thread; the engine then owns the pixels until it exits
+    ImageView image{renderBuffer.bits(), renderBuffer.bytesPerLine(), renderBuffer.width(), renderBuffer.height()};
+
+    // every pass covers the whole image, the coarse preview included
+    int const current = frame;
+    auto notifyPass = [this, current](int)
+    {
+        emit enginePassFinished(current);
     };
 
     auto notifyExit = [this]()
@@ -31,11 +85,23 @@ std::future<RedrawInfo> PlotWidget::draw(PlotData const & plotData, std::atomic_
         emit engineThreadExited();
     };
 
-    return std::async(&redraw<decltype(update), decltype(notifyExit)>,
-                      std::ref(plotData),
-                      std::move(update),
-                      std::move(notifyExit),
-                      std::ref(cancellationToken));
+    return std::async(std::launch::async,
+                      [this, &plotData, &cancellationToken, image, notifyPass, notifyExit]()
+                      {
+                          return redrawCached(plotData, image, frameCache, renderCache, PREVIEW_STEP,
+                                              notifyPass, notifyExit, cancellationToken);
+                      });
+}
+
+bool PlotWidget::endDraw(RedrawInfo const & info)
+{
+    bool const shown = info.status == RedrawInfo::Status::FINISHED || presented;
+    if (shown)
+        imageBuffer.swap(renderBuffer);
+    presented = false;
+    setFixedSize(imageBuffer.width(), imageBuffer.height());
+    update();
+    return shown;
 }
 
 bool PlotWidget::saveImage(QString const & path) const
@@ -48,14 +114,60 @@ void PlotWidget::paintEvent(QPaintEvent * event)
     Q_UNUSED(event);
 
     QPainter painter(this);
-    painter.drawImage(0, 0, imageBuffer);
+    if (!dragOffset.isNull())
+        painter.fillRect(rect(), BLANK);
+    painter.drawImage(dragOffset, presented ? renderBuffer : imageBuffer);
+}
+
+void PlotWidget::present()
+{
+    presented = true;
+    setFixedSize(renderBuffer.width(), renderBuffer.height());
+    update();
+}
+
+void PlotWidget::mousePressEvent(QMouseEvent * event)
+{
+    if (event->button() != Qt::LeftButton)
+        return;
+
+    dragging = true;
+    dragStart = event->pos();
 }
 
 void PlotWidget::mouseMoveEvent(QMouseEvent * event)
 {
+    if (dragging)
+    {
+        dragOffset = event->pos() - dragStart;
+        update();
+    }
+
     emit mouseMove(event);
 }
 
+void PlotWidget::mouseReleaseEvent(QMouseEvent * event)
+{
+    if (event->button() != Qt::LeftButton || !dragging)
+        return;
+
+    dragging = false;
+    dragOffset = event->pos() - dragStart;
+    if (!dragOffset.isNull())
+        emit panned(dragOffset.x(), dragOffset.y());
+
+    // a redraw started for the pan has already moved the image
+    dragOffset = QPoint();
+    update();
+}
+
+void PlotWidget::wheelEvent(QWheelEvent * event)
+{
+    // one notch is 120 eighths of a degree
+    emit zoomed(event->pos().x(), event->pos().y(), event->angleDelta().y()/120.0);
+    event->accept();
+}
+
 void PlotWidget::leaveEvent(QEvent * event)
 {
     emit mouseLeave();
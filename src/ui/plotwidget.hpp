@@ -6,34 +6,80 @@
 
 #include <QWidget>
 #include <QImage>
+#include <QPoint>
 
+#include "engine/framecache.hpp"
 #include "engine/plotdata.hpp"
+#include "engine/rendercache.hpp"
 
 class PlotWidget : public QWidget
 {
     Q_OBJECT
 
 public:
-    explicit PlotWidget(QWidget * parent = nullptr) : QWidget(parent) {}
+    explicit PlotWidget(QWidget * parent = nullptr);
 
     void clear(PlotData const & plotData);
+
+    // renders into a back buffer; the frame on screen stays until the first
+    // pass of the new one is done, so a redraw never shows a blank image
     std::future<RedrawInfo> draw(PlotData const & plotData, std::atomic_bool const & cancellationToken);
+
+    // to be called with the result of draw() once the engine has exited: a
+    // finished frame replaces the one on screen, a cancelled one only if some
+    // pass of it was shown already; returns whether the new frame is shown
+    bool endDraw(RedrawInfo const & info);
+
     bool saveImage(QString const & path) const;
 
+    // true if plotData only changes the colors of the last frame, which then
+    // redraws without evaluating the function; only valid while no draw runs
+    bool canRecolor(PlotData const & plotData) const { return frameCache.recolorable(plotData); }
+
 signals:
     void engineThreadExited();
+    void enginePassFinished(int frame);
     void mouseMove(QMouseEvent * event);
     void mouseLeave();
 
+    // the image was dragged by (dx, dy) pixels
+    void panned(int dx, int dy);
+
+    // the wheel was turned by steps notches over pixel (x, y)
+    void zoomed(int x, int y, double steps);
+
 public slots:
 
 protected:
     void paintEvent(QPaintEvent * event);
+    void mousePressEvent(QMouseEvent * event);
     void mouseMoveEvent(QMouseEvent * event);
+    void mouseReleaseEvent(QMouseEvent * event);
+    void wheelEvent(QWheelEvent * event);
     void leaveEvent(QEvent * event);
 
 private:
+    // the last finished frame, and the one the engine draws into
     QImage imageBuffer;
+    QImage renderBuffer;
+
+    // number of the current draw, so that passes of a preempted one are ignored
+    int frame;
+
+    // renderBuffer is on screen, imageBuffer otherwise
+    bool presented;
+
+    // values of the last frame, reused when the next one is a translation of it
+    FrameCache frameCache;
+
+    // recent frames, so that going back or changing only the colors is cheap
+    RenderCache renderCache;
+
+    void present();
+
+    bool dragging;
+    QPoint dragStart;
+    QPoint dragOffset;
 };
 
 #endif // COMPLEXPLOT_PLOTWIDGET_HPP